@@ -0,0 +1,199 @@
+#ifndef CHIPS_H
+#define CHIPS_H	1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fec.h"
+#include "mode.h"
+
+/*
+ * 情報信号から送信パターンへの符号化
+ *
+ * 1 フレームは 4 bit を運び、下位 2 bit を Layer 1 に、上位 2 bit を反転して Layer 2 に載せる。
+ * 各層の 2 bit は 2 個の符号を多重した 16 チップのパターンになり、
+ * 各チップを 2 スロットずつ並べた 32 bit の送信パターンとして送信機のバッファに詰める。
+ *
+ * 送信方式 'r' では、ホストがこの符号化を行い、各フレームの Layer 1 用及び Layer 2 用の
+ * 送信パターン（それぞれ 32 bit、リトルエンディアン）の RAW_FRAME byte を送信機に送る。
+ * 送信機はそれをそのままバッファに詰める。
+ *
+ * 各層の 2 個の符号は、16 チップのうち互いに重ならない 8 チップ（スロット）を占め、
+ * スロットの 8 チップを長さ 8 の Walsh 系列（アダマール行列の WALSH_ROW0 行）の正負に従って
+ * 点灯させる。送信方式 'w' では、これに直交する WALSH_ROW1 行も使い、どちらの行か（上位 bit）と
+ * その正負（下位 bit）とで各スロットに 2 bit を載せる（双直交符号）。
+ * 1 フレームは 8 bit を運び、下位 4 bit を Layer 1 に、上位 4 bit を反転して Layer 2 に載せる。
+ * どの行も平均が 0 であるから、各層の点灯チップ数はこれまでと同じく 1 フレームに 8 個である。
+ */
+
+/* 送信方式 'r' で 1 フレームを表す文字数 */
+#define RAW_FRAME	8
+
+/* 1 スロットのチップ数 */
+#define WALSH_CHIPS	8
+/*
+ * 送信方式 'w' で使う Walsh 系列（アダマール行列の行）
+ * 4 行及び 6 行は両層とも消灯したチップが 1 フレーム分続くことがあって受信機がキャリアを見失い、
+ * 残りのうちでは 5 行が立ち上がりの遅い通信路で最も誤りが少なかった
+ */
+#define WALSH_ROW0	7
+#define WALSH_ROW1	5
+
+/* 各スロットを構成するチップの位置 */
+static const uint8_t walshSlots[2][WALSH_CHIPS] = {
+	{ 0, 2, 4, 6, 9, 11, 13, 15 },
+	{ 1, 3, 5, 7, 8, 10, 12, 14 },
+};
+
+/*
+ * 2 bit のかたまりに対応する同強度のチップパターンを得る
+ * パターンは Layer 1 用であるから、Layer 2 の場合は b2 を反転してから入力する
+ */
+static inline uint16_t
+bit2ToChips(uint8_t b2)
+{
+#define PATTERN(b00, b01, b02, b03, b10, b11, b12, b13, \
+			b20, b21, b22, b23, b30, b31, b32, b33) \
+		(0B ## b33 ## b32 ## b31 ## b30 ## b23 ## b22 ## b21 ## b20 \
+			## b13 ## b12 ## b11 ## b10 ## b03 ## b02 ## b01 ## b00)
+	/*
+	 * チップパターン（2 チャネル多重済）
+	 *
+	 * n-th item | Code 1 | Code 2
+	 * ----------|--------|--------
+	 *      0    |    0   |    0
+	 *      1    |    1   |    0
+	 *      2    |    0   |    1
+	 *      3    |    1   |    1
+	 */
+	static const uint16_t convTab[] = {
+		PATTERN(1, 1, 0, 0,  0, 0, 1, 1,  0, 0, 1, 1,  1, 1, 0, 0),
+		PATTERN(0, 1, 1, 0,  1, 0, 0, 1,  0, 1, 1, 0,  1, 0, 0, 1),
+		PATTERN(1, 0, 0, 1,  0, 1, 1, 0,  1, 0, 0, 1,  0, 1, 1, 0),
+		PATTERN(0, 0, 1, 1,  1, 1, 0, 0,  1, 1, 0, 0,  0, 0, 1, 1),
+	};
+#undef PATTERN
+
+	return convTab[b2 & 0x03];
+}
+
+/*
+ * 4 bit のかたまりに対応するチップパターンを得る
+ * p[0] が Layer 1 用、p[1] が Layer 2 用
+ */
+static inline void
+bit4ToChips(uint8_t b4, uint16_t p[2])
+{
+	p[0] = bit2ToChips( b4 >> 0 & 0x03);
+	p[1] = bit2ToChips(~b4 >> 2 & 0x03);
+}
+
+/*
+ * 4 bit（2 スロット分）に対応する同強度のチップパターンを得る（送信方式 'w'）
+ * パターンは Layer 1 用であるから、Layer 2 の場合は b4 を反転してから入力する
+ */
+static inline uint16_t
+walshToChips(uint8_t b4)
+{
+	uint16_t p = 0;
+
+	for (int s = 0; s < 2; s++) {
+		const unsigned v = b4 >> 2*s & 0x03;
+		const unsigned row = v & 0x02 ? WALSH_ROW1 : WALSH_ROW0;
+		/* 行の値が正（row & i のビットが偶数個）で下位 bit が 0 か、負で 1 なら点灯する */
+		for (unsigned i = 0; i < WALSH_CHIPS; i++)
+			if ((0x6996 >> (row & i) & 1) == (v & 0x01))
+				p |= 1 << walshSlots[s][i];
+	}
+
+	return p;
+}
+
+/*
+ * 8 bit のかたまりに対応するチップパターンを得る（送信方式 'w'）
+ * p[0] が Layer 1 用、p[1] が Layer 2 用
+ */
+static inline void
+bit8ToChips(uint8_t b8, uint16_t p[2])
+{
+	p[0] = walshToChips( b8 >> 0 & 0x0F);
+	p[1] = walshToChips(~b8 >> 4 & 0x0F);
+}
+
+/*
+ * 1 フレームの情報信号に対応するチップパターンを送信方式に従って得る
+ */
+static inline void
+frameToChips(uint8_t b, uint8_t mode, uint16_t p[2])
+{
+	if (mode & MODE_WALSH)
+		bit8ToChips(b, p);
+	else
+		bit4ToChips(b, p);
+}
+
+/*
+ * 1 文字を送信方式に従ってフレームの情報信号に分け、そのフレーム数を返す
+ */
+static inline size_t
+byteToFrames(uint8_t c, uint8_t mode, uint8_t b[FEC_FRAMES])
+{
+	if (mode & MODE_WALSH) {
+		if (mode & MODE_FEC) {
+			fecEncodeWalsh(c, b);
+			return FEC_WALSH_FRAMES;
+		}
+		b[0] = c;
+		return 1;
+	}
+	if (mode & MODE_FEC) {
+		fecEncode(c, b);
+		return FEC_FRAMES;
+	}
+	b[0] = c & 0x0F;
+	b[1] = c >> 4 & 0x0F;
+	return 2;
+}
+
+/*
+ * チップパターンを送信パターンに変換する
+ * 0b10100101 → 0b1100110000110011
+ */
+static inline uint32_t
+chipsToPattern(uint16_t p)
+{
+	uint32_t r = 0;
+
+	for (size_t i = 0; i < 16; i++)
+		r |= (uint32_t)(p & (1 << i)) << i;
+	r |= r << 1;
+
+	return r;
+}
+
+/*
+ * 1 文字を送信方式に従ってフレームに分け、各フレームの送信パターンを out に並べる
+ * 並べた文字数（RAW_FRAME の modeByteFrames(mode) 倍）を返す
+ */
+static inline size_t
+encodeRaw(uint8_t c, uint8_t mode, uint8_t *out)
+{
+	uint8_t b[FEC_FRAMES];
+	uint16_t p[2];
+	uint32_t w;
+	size_t i, j, k, n;
+
+	n = byteToFrames(c, mode, b);
+	for (k = 0; k < n; k++) {
+		frameToChips(b[k], mode, p);
+		for (j = 0; j < 2; j++) {
+			w = chipsToPattern(p[j]);
+			for (i = 0; i < 4; i++)
+				*out++ = w >> 8 * i;
+		}
+	}
+
+	return n * RAW_FRAME;
+}
+
+#endif	/* !CHIPS_H */
@@ -0,0 +1,173 @@
+#ifndef FEC_H
+#define FEC_H	1
+
+#include <stdint.h>
+
+/*
+ * 拡大ハミング符号 (8,4) による誤り訂正
+ *
+ * 4 bit を 8 bit の符号語にして、1 bit の誤りを訂正し、2 bit の誤りを検出する。
+ * 符号語の bit 0-3 はデータそのもの、bit 4-6 は検査ビット、bit 7 は全体のパリティ。
+ *
+ * 1 文字は 2 個の符号語（16 bit）になり、FEC_FRAMES フレームに分けて送る。
+ * フレームの 4 bit（i11, i21, i12, i22）のうち i11 と i22 とを一方の符号語に、
+ * i21 と i12 とをもう一方の符号語に割り当てるので、ある層あるいはある符号の
+ * 判定がまるごと誤っても、各符号語の誤りは 1 bit に収まる。
+ *
+ * 送信方式 'w' ではフレームが 4 スロット分の 8 bit を運ぶので、1 文字は FEC_WALSH_FRAMES フレームになる。
+ * 各スロットの 2 bit の一方を一方の符号語に、もう一方をもう一方の符号語に割り当てるので、
+ * あるスロットの判定がまるごと誤っても、各符号語の誤りは 1 bit に収まる。
+ */
+
+/* 1 文字の送信にかかるフレーム数 */
+#define FEC_FRAMES	4
+#define FEC_WALSH_FRAMES	2
+
+/* 復号表の印（訂正した、訂正できなかった） */
+#define FEC_CORRECTED	0x10
+#define FEC_FAILED	0x20
+
+/* 符号化表 */
+static const uint8_t fecEncodeTab[16] = {
+	0x00, 0xB1, 0xD2, 0x63, 0xE4, 0x55, 0x36, 0x87,
+	0x78, 0xC9, 0xAA, 0x1B, 0x9C, 0x2D, 0x4E, 0xFF,
+};
+
+/*
+ * 復号表
+ * 最も近い符号語のデータに印を付けたもの
+ * 訂正できなければ受け取ったデータ部分をそのまま使う
+ */
+static const uint8_t fecDecodeTab[256] = {
+	0x00, 0x10, 0x10, 0x23, 0x10, 0x25, 0x26, 0x17,
+	0x10, 0x29, 0x2A, 0x1B, 0x2C, 0x1D, 0x1E, 0x2F,
+	0x10, 0x21, 0x22, 0x1B, 0x24, 0x15, 0x16, 0x27,
+	0x28, 0x1B, 0x1B, 0x0B, 0x1C, 0x2D, 0x2E, 0x1B,
+	0x10, 0x21, 0x22, 0x13, 0x24, 0x1D, 0x16, 0x27,
+	0x28, 0x1D, 0x1A, 0x2B, 0x1D, 0x0D, 0x2E, 0x1D,
+	0x20, 0x11, 0x16, 0x23, 0x16, 0x25, 0x06, 0x16,
+	0x18, 0x29, 0x2A, 0x1B, 0x2C, 0x1D, 0x16, 0x2F,
+	0x10, 0x21, 0x22, 0x13, 0x24, 0x15, 0x1E, 0x27,
+	0x28, 0x19, 0x1E, 0x2B, 0x1E, 0x2D, 0x0E, 0x1E,
+	0x20, 0x15, 0x12, 0x23, 0x15, 0x05, 0x26, 0x15,
+	0x18, 0x29, 0x2A, 0x1B, 0x2C, 0x15, 0x1E, 0x2F,
+	0x20, 0x13, 0x13, 0x03, 0x14, 0x25, 0x26, 0x13,
+	0x18, 0x29, 0x2A, 0x13, 0x2C, 0x1D, 0x1E, 0x2F,
+	0x18, 0x21, 0x22, 0x13, 0x24, 0x15, 0x16, 0x27,
+	0x08, 0x18, 0x18, 0x2B, 0x18, 0x2D, 0x2E, 0x1F,
+	0x10, 0x21, 0x22, 0x17, 0x24, 0x17, 0x17, 0x07,
+	0x28, 0x19, 0x1A, 0x2B, 0x1C, 0x2D, 0x2E, 0x17,
+	0x20, 0x11, 0x12, 0x23, 0x1C, 0x25, 0x26, 0x17,
+	0x1C, 0x29, 0x2A, 0x1B, 0x0C, 0x1C, 0x1C, 0x2F,
+	0x20, 0x11, 0x1A, 0x23, 0x14, 0x25, 0x26, 0x17,
+	0x1A, 0x29, 0x0A, 0x1A, 0x2C, 0x1D, 0x1A, 0x2F,
+	0x11, 0x01, 0x22, 0x11, 0x24, 0x11, 0x16, 0x27,
+	0x28, 0x11, 0x1A, 0x2B, 0x1C, 0x2D, 0x2E, 0x1F,
+	0x20, 0x19, 0x12, 0x23, 0x14, 0x25, 0x26, 0x17,
+	0x19, 0x09, 0x2A, 0x19, 0x2C, 0x19, 0x1E, 0x2F,
+	0x12, 0x21, 0x02, 0x12, 0x24, 0x15, 0x12, 0x27,
+	0x28, 0x19, 0x12, 0x2B, 0x1C, 0x2D, 0x2E, 0x1F,
+	0x14, 0x21, 0x22, 0x13, 0x04, 0x14, 0x14, 0x27,
+	0x28, 0x19, 0x1A, 0x2B, 0x14, 0x2D, 0x2E, 0x1F,
+	0x20, 0x11, 0x12, 0x23, 0x14, 0x25, 0x26, 0x1F,
+	0x18, 0x29, 0x2A, 0x1F, 0x2C, 0x1F, 0x1F, 0x0F,
+};
+
+/*
+ * フレームの bit i を割り当てる符号語
+ */
+static inline int
+fecWord(int i)
+{
+	return (i ^ i >> 1) & 1;
+}
+
+/*
+ * 文字 c を FEC_FRAMES フレーム分の 4 bit に符号化する
+ */
+static inline void
+fecEncode(uint8_t c, uint8_t *b4)
+{
+	const uint8_t cw[2] = {
+		fecEncodeTab[c & 0x0F], fecEncodeTab[c >> 4 & 0x0F],
+	};
+
+	for (int k = 0; k < FEC_FRAMES; k++) {
+		b4[k] = 0;
+		for (int i = 0; i < 4; i++)
+			b4[k] |= (cw[fecWord(i)] >> (2*k + (i >> 1)) & 1) << i;
+	}
+}
+
+/*
+ * 2 個の符号語を検査して文字を得る
+ */
+static inline uint8_t
+fecCheck(const uint8_t *cw, uint32_t *corrected, uint32_t *failed)
+{
+	uint8_t c = 0;
+
+	for (int j = 0; j < 2; j++) {
+		const uint8_t d = fecDecodeTab[cw[j]];
+		c |= (d & 0x0F) << 4*j;
+		if (d & FEC_CORRECTED)
+			(*corrected)++;
+		if (d & FEC_FAILED)
+			(*failed)++;
+	}
+
+	return c;
+}
+
+/*
+ * FEC_FRAMES フレーム分の 4 bit を復号して文字を得る
+ * 訂正した符号語及び訂正できなかった符号語の数を数え上げる
+ */
+static inline uint8_t
+fecDecode(const uint8_t *b4, uint32_t *corrected, uint32_t *failed)
+{
+	uint8_t cw[2] = { 0, 0 };
+
+	for (int k = 0; k < FEC_FRAMES; k++)
+		for (int i = 0; i < 4; i++)
+			cw[fecWord(i)] |= (b4[k] >> i & 1) << (2*k + (i >> 1));
+
+	return fecCheck(cw, corrected, failed);
+}
+
+/*
+ * 文字 c を FEC_WALSH_FRAMES フレーム分の 8 bit に符号化する（送信方式 'w'）
+ * フレームの bit 2s 及び bit 2s+1 がスロット s の 2 bit になる
+ */
+static inline void
+fecEncodeWalsh(uint8_t c, uint8_t *b8)
+{
+	const uint8_t cw[2] = {
+		fecEncodeTab[c & 0x0F], fecEncodeTab[c >> 4 & 0x0F],
+	};
+
+	for (int k = 0; k < FEC_WALSH_FRAMES; k++) {
+		b8[k] = 0;
+		for (int s = 0; s < 4; s++)
+			for (int j = 0; j < 2; j++)
+				b8[k] |= (cw[j] >> (4*k + s) & 1) << (2*s + j);
+	}
+}
+
+/*
+ * FEC_WALSH_FRAMES フレーム分の 8 bit を復号して文字を得る（送信方式 'w'）
+ */
+static inline uint8_t
+fecDecodeWalsh(const uint8_t *b8, uint32_t *corrected, uint32_t *failed)
+{
+	uint8_t cw[2] = { 0, 0 };
+
+	for (int k = 0; k < FEC_WALSH_FRAMES; k++)
+		for (int s = 0; s < 4; s++)
+			for (int j = 0; j < 2; j++)
+				cw[j] |= (b8[k] >> (2*s + j) & 1) << (4*k + s);
+
+	return fecCheck(cw, corrected, failed);
+}
+
+#endif	/* !FEC_H */
@@ -0,0 +1,244 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stripe.h"
+
+#include "fountain.h"
+
+/* ロバスト・ソリトン分布の母数 */
+#define SOLITON_C	0.1
+#define SOLITON_DELTA	0.5
+
+/*
+ * CRC-32（多項式 0x04C11DB7 のビット反転）
+ */
+uint32_t
+fountainCrc(uint32_t crc, const uint8_t *p, size_t n)
+{
+	crc = ~crc;
+	while (n-- > 0) {
+		crc ^= *p++;
+		for (int i = 0; i < 8; i++)
+			crc = crc & 1 ? crc >> 1 ^ 0xEDB88320 : crc >> 1;
+	}
+
+	return ~crc;
+}
+
+/*
+ * 擬似乱数（splitmix64）
+ */
+static uint64_t
+next(uint64_t *s)
+{
+	uint64_t z;
+
+	z = *s += 0x9E3779B97F4A7C15ULL;
+	z = (z ^ z >> 30) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ z >> 27) * 0x94D049BB133111EBULL;
+
+	return z ^ z >> 31;
+}
+
+/*
+ * [0, 1) の一様乱数
+ */
+static double
+uniform(uint64_t *s)
+{
+	return (next(s) >> 11) * 0x1.0p-53;
+}
+
+/*
+ * 準備する
+ */
+int
+initFountain(struct fountain *f, uint32_t length, uint16_t symlen,
+		uint32_t id)
+{
+	double r, sum, *w;
+	uint32_t i, k, spike;
+
+	memset(f, 0, sizeof(*f));
+	if (length == 0 || symlen == 0)
+		return -1;
+	f->id = id;
+	f->length = length;
+	f->symlen = symlen;
+	f->k = k = (uint32_t)(((uint64_t)length + symlen - 1) / symlen);
+
+	f->cdf = malloc(k * sizeof(*f->cdf));
+	f->mark = calloc(k, 1);
+	if (f->cdf == NULL || f->mark == NULL) {
+		freeFountain(f);
+		return -1;
+	}
+
+	/*
+	 * ロバスト・ソリトン分布
+	 * 理想ソリトン分布 ρ に、次数 1 及び k/R 付近を増やす τ を足して正規化する
+	 */
+	w = f->cdf;
+	r = SOLITON_C * log(k / SOLITON_DELTA) * sqrt(k);
+	spike = r > 0 ? (uint32_t)(k / r) : k;
+	if (spike < 1)
+		spike = 1;
+	if (spike > k)
+		spike = k;
+	for (i = 1; i <= k; i++) {
+		w[i - 1] = i == 1 ? 1.0 / k : 1.0 / ((double)i * (i - 1));
+		if (i < spike)
+			w[i - 1] += r / ((double)i * k);
+		else if (i == spike && r > SOLITON_DELTA)
+			w[i - 1] += r * log(r / SOLITON_DELTA) / k;
+	}
+	sum = 0;
+	for (i = 0; i < k; i++)
+		w[i] = sum += w[i];
+	for (i = 0; i < k; i++)
+		w[i] /= sum;
+
+	return 0;
+}
+
+/*
+ * 片付ける
+ */
+void
+freeFountain(struct fountain *f)
+{
+	free(f->cdf);
+	free(f->mark);
+	f->cdf = NULL;
+	f->mark = NULL;
+}
+
+/*
+ * シンボルの長さ
+ */
+size_t
+fountainSize(const struct fountain *f)
+{
+	return FOUNTAIN_HEADER + (size_t)f->symlen + FOUNTAIN_TRAILER;
+}
+
+/*
+ * もとになるブロックの番号を選ぶ
+ * ESI が k 未満なら ESI 番目のブロックだけ、さもなくば次数をロバスト・ソリトン分布から選び、
+ * その数だけ異なるブロックを一様に選ぶ
+ */
+size_t
+fountainNeighbours(struct fountain *f, uint32_t esi, uint32_t *idx)
+{
+	uint64_t s;
+	uint32_t d, i, lo, hi;
+	double u;
+
+	if (esi < f->k) {
+		idx[0] = esi;
+		return 1;
+	}
+
+	/* ファイルの ID と ESI とで乱数の種を決める */
+	s = (uint64_t)f->id << 32 | esi;
+
+	/* 累積分布を二分探索して次数を決める */
+	u = uniform(&s);
+	lo = 0;
+	hi = f->k - 1;
+	while (lo < hi) {
+		i = lo + (hi - lo) / 2;
+		if (f->cdf[i] > u)
+			hi = i;
+		else
+			lo = i + 1;
+	}
+	d = lo + 1;
+
+	/* 重ならないように選ぶ */
+	for (i = 0; i < d; ) {
+		idx[i] = (uint32_t)(next(&s) % f->k);
+		if (f->mark[idx[i]])
+			continue;
+		f->mark[idx[i++]] = 1;
+	}
+	for (i = 0; i < d; i++)
+		f->mark[idx[i]] = 0;
+
+	return d;
+}
+
+/*
+ * シンボルを作る
+ */
+void
+encodeFountain(struct fountain *f, const uint8_t *data, uint32_t esi,
+		uint32_t *idx, uint8_t *out)
+{
+	uint8_t *h = out, *p = out + FOUNTAIN_HEADER;
+	size_t d, i, j, n, off;
+	uint32_t crc;
+
+	/* ヘッダを詰める */
+	h[0] = FOUNTAIN_MAGIC;
+	for (i = 0; i < 4; i++) {
+		h[1 + i] = f->id >> 8 * i;
+		h[5 + i] = f->length >> 8 * i;
+		h[11 + i] = esi >> 8 * i;
+	}
+	h[9] = f->symlen;
+	h[10] = f->symlen >> 8;
+	h[FOUNTAIN_HEADER - 1] = stripeCrc(h, FOUNTAIN_HEADER - 1);
+
+	/* もとになるブロックの排他的論理和をとる（ファイルの外は 0） */
+	memset(p, 0, f->symlen);
+	d = fountainNeighbours(f, esi, idx);
+	for (i = 0; i < d; i++) {
+		off = (size_t)idx[i] * f->symlen;
+		n = f->length - off < f->symlen ? f->length - off : f->symlen;
+		for (j = 0; j < n; j++)
+			p[j] ^= data[off + j];
+	}
+
+	crc = fountainCrc(0, p, f->symlen);
+	for (i = 0; i < FOUNTAIN_TRAILER; i++)
+		p[f->symlen + i] = crc >> 8 * i;
+}
+
+/*
+ * ヘッダを読む
+ */
+int
+getFountainHeader(const uint8_t *h, uint32_t *id, uint32_t *length,
+		uint16_t *symlen, uint32_t *esi)
+{
+	if (h[0] != FOUNTAIN_MAGIC
+			|| stripeCrc(h, FOUNTAIN_HEADER - 1)
+			!= h[FOUNTAIN_HEADER - 1])
+		return -1;
+	*id = *length = *esi = 0;
+	for (int i = 0; i < 4; i++) {
+		*id |= (uint32_t)h[1 + i] << 8 * i;
+		*length |= (uint32_t)h[5 + i] << 8 * i;
+		*esi |= (uint32_t)h[11 + i] << 8 * i;
+	}
+	*symlen = h[9] | h[10] << 8;
+
+	return 0;
+}
+
+/*
+ * シンボルの中身の CRC-32 を確かめる
+ */
+int
+checkFountain(const uint8_t *sym, uint16_t symlen)
+{
+	const uint8_t *p = sym + FOUNTAIN_HEADER;
+	uint32_t crc = 0;
+
+	for (int i = 0; i < FOUNTAIN_TRAILER; i++)
+		crc |= (uint32_t)p[symlen + i] << 8 * i;
+
+	return fountainCrc(0, p, symlen) == crc ? 0 : -1;
+}
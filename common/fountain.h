@@ -0,0 +1,85 @@
+#ifndef FOUNTAIN_H
+#define FOUNTAIN_H	1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 噴水符号（LT 符号）で繰り返し送るファイルの形式
+ *
+ * ファイルを symlen 文字ずつの k 個のブロックに分け（最後のブロックは 0 で埋める）、
+ * 符号化シンボルを通し番号（ESI）の順に送り続ける。
+ * ESI が k 未満のシンボルは ESI 番目のブロックそのもので、
+ * それ以降のシンボルは ESI から決まるいくつかのブロックの排他的論理和である。
+ * 受信側は、どのシンボルをいくつ失っても、おおよそ k 個より少し多く受け取れば元に戻せる。
+ *
+ * 各シンボルは、印（FOUNTAIN_MAGIC）、ファイルの ID（32 bit）、ファイルの長さ（32 bit）、
+ * ブロックの長さ（16 bit）、ESI（32 bit）、それまでの 15 byte の CRC-8 の
+ * 16 byte のヘッダに、symlen 文字の中身とその CRC-32 とが続く。
+ * 多バイトの値はリトルエンディアンで詰める。
+ * ファイルの ID はファイル全体の CRC-32 で、元に戻したファイルの検査にも使う。
+ */
+
+/* シンボルの先頭の印 */
+#define FOUNTAIN_MAGIC	0x5A
+/* ヘッダ及び末尾の CRC-32 の長さ */
+#define FOUNTAIN_HEADER	16
+#define FOUNTAIN_TRAILER	4
+
+/*
+ * 符号化及び復号に共通の情報
+ */
+struct fountain {
+	uint32_t id, length;	/* ファイルの ID 及び長さ */
+	uint16_t symlen;	/* ブロックの長さ */
+	uint32_t k;		/* ブロックの数 */
+	double *cdf;		/* 次数の累積分布（ロバスト・ソリトン分布） */
+	uint8_t *mark;		/* 近傍を選ぶときの印 */
+};
+
+/*
+ * CRC-32（IEEE 802.3）を crc に続けて計算する（最初は 0 を与える）
+ */
+uint32_t fountainCrc(uint32_t crc, const uint8_t *p, size_t n);
+
+/*
+ * ファイルの長さ、ブロックの長さ及び ID から準備する（失敗すれば -1 を返す）
+ */
+int initFountain(struct fountain *f, uint32_t length, uint16_t symlen,
+		uint32_t id);
+
+/*
+ * 片付ける
+ */
+void freeFountain(struct fountain *f);
+
+/*
+ * シンボルの長さ（ヘッダ等を含む）
+ */
+size_t fountainSize(const struct fountain *f);
+
+/*
+ * ESI esi のシンボルのもとになるブロックの番号を idx に並べて、その数を返す
+ * idx には k 個分の場所が必要
+ */
+size_t fountainNeighbours(struct fountain *f, uint32_t esi, uint32_t *idx);
+
+/*
+ * ファイルの内容 data から ESI esi のシンボルを作る
+ * idx には k 個分の場所が必要
+ */
+void encodeFountain(struct fountain *f, const uint8_t *data, uint32_t esi,
+		uint32_t *idx, uint8_t *out);
+
+/*
+ * ヘッダを読む（印か CRC が合わなければ -1 を返す）
+ */
+int getFountainHeader(const uint8_t *h, uint32_t *id, uint32_t *length,
+		uint16_t *symlen, uint32_t *esi);
+
+/*
+ * ブロックの長さ symlen のシンボルの中身の CRC-32 を確かめる（合わなければ -1 を返す）
+ */
+int checkFountain(const uint8_t *sym, uint16_t symlen);
+
+#endif	/* !FOUNTAIN_H */
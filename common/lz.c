@@ -0,0 +1,129 @@
+#include <string.h>
+
+#include "lz.h"
+
+/* 一致を探すハッシュ表の大きさ及びたどる候補の最大数 */
+#define HASH_BITS	12
+#define HASH_SIZE	(1 << HASH_BITS)
+#define CHAIN_MAX	64
+
+/* 各ハッシュ値の直近の位置及び同じハッシュ値の一つ前の位置（なければ -1） */
+static int32_t heads[HASH_SIZE];
+static int32_t prevs[LZ_BLOCK_MAX];
+
+/*
+ * 3 文字のハッシュ値
+ */
+static unsigned
+hash(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2])
+			* 2654435761U >> (32 - HASH_BITS);
+}
+
+/*
+ * 位置 i を表に入れる
+ */
+static void
+insert(const uint8_t *in, size_t n, size_t i)
+{
+	unsigned h;
+
+	if (i + LZ_MATCH_MIN > n)
+		return;
+	h = hash(in + i);
+	prevs[i] = heads[h];
+	heads[h] = (int32_t)i;
+}
+
+/*
+ * 位置 i から始まる最も長い一致を探し、その長さを返す（距離は dist に）
+ */
+static size_t
+longest(const uint8_t *in, size_t n, size_t i, size_t *dist)
+{
+	size_t best, len, max;
+	int32_t j;
+	int chain;
+
+	best = 0;
+	if (i + LZ_MATCH_MIN > n)
+		return 0;
+	max = n - i < LZ_MATCH_MAX ? n - i : LZ_MATCH_MAX;
+	for (j = heads[hash(in + i)], chain = 0;
+			j >= 0 && i - (size_t)j <= LZ_WINDOW && chain < CHAIN_MAX;
+			j = prevs[j], chain++) {
+		for (len = 0; len < max && in[j + len] == in[i + len]; len++)
+			;
+		if (len > best) {
+			best = len;
+			*dist = i - (size_t)j;
+			if (len == max)
+				break;
+		}
+	}
+
+	return best >= LZ_MATCH_MIN ? best : 0;
+}
+
+/*
+ * n 文字（LZ_BLOCK_MAX 以下）を 1 ブロックにする
+ * 圧縮しても短くならなければそのまま入れる
+ */
+static size_t
+block(const uint8_t *in, size_t n, uint8_t *out)
+{
+	uint8_t *body = out + LZ_HEADER, *flags;
+	size_t dist, i, k, len, m, nTokens;
+	uint16_t h;
+
+	/* 欲張り法で記号に分ける（元より長くなれば止める） */
+	memset(heads, 0xFF, sizeof(heads));
+	m = nTokens = 0;
+	flags = NULL;
+	for (i = 0; i < n && m + 3 < n; ) {
+		if (nTokens++ % 8 == 0) {
+			flags = body + m++;
+			*flags = 0;
+		}
+		len = longest(in, n, i, &dist);
+		if (len == 0) {
+			body[m++] = in[i];
+			insert(in, n, i++);
+			continue;
+		}
+		*flags |= 1 << (nTokens - 1) % 8;
+		body[m++] = (dist - 1) & 0xFF;
+		body[m++] = (uint8_t)((dist - 1) >> 8 << 6
+				| (len - LZ_MATCH_MIN));
+		for (k = 0; k < len; k++)
+			insert(in, n, i++);
+	}
+
+	h = (uint16_t)m | LZ_COMPRESSED;
+	if (i < n || m >= n) {
+		memcpy(body, in, n);
+		h = (uint16_t)(m = n);
+	}
+	out[0] = h & 0xFF;
+	out[1] = h >> 8;
+	out[2] = stripeCrc(out, LZ_HEADER - 1);
+
+	return LZ_HEADER + m;
+}
+
+/*
+ * ブロックの並びに圧縮する
+ */
+size_t
+compressLz(const uint8_t *in, size_t n, uint8_t *out)
+{
+	size_t m, off, piece;
+
+	for (m = off = 0; off < n; off += piece) {
+		piece = n - off < LZ_BLOCK_MAX ? n - off : LZ_BLOCK_MAX;
+		m += block(in + off, piece, out + m);
+	}
+
+	return m;
+}
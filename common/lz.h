@@ -0,0 +1,172 @@
+#ifndef LZ_H
+#define LZ_H	1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stripe.h"
+
+/*
+ * 圧縮したデータの形式
+ *
+ * 送信方式 'z' では、ホストは送るデータを LZ 方式（LZSS）で圧縮したブロックに分けて送信機に渡し、
+ * 受信機は復号した文字を伸長してからシリアル通信に出力する。
+ * 各ブロックは、中身の長さ（15 bit）及び圧縮したかどうか（1 bit）の 2 byte（リトルエンディアン）と
+ * その CRC-8 との 3 byte のヘッダに中身が続く。
+ * 圧縮していない中身はそのまま使う。
+ * 圧縮した中身は、8 個の記号ごとにその種類を表す 1 byte（下位ビットから、0 ならリテラル、
+ * 1 なら一致）が前に付いた記号の並びである。
+ * リテラルは 1 byte で、その文字を表す。
+ * 一致は 2 byte で、距離から 1 を引いた 10 bit（1 byte 目が下位 8 bit、2 byte 目の上位 2 bit が残り）と
+ * 長さから LZ_MATCH_MIN を引いた 6 bit（2 byte 目の下位 6 bit）とで、
+ * その距離だけ前から長さだけ写すことを表す。
+ * 一致は同じブロックの中だけを指すので、ブロックは互いに独立している。
+ * 受信機は、ヘッダの CRC が合わなければ 1 文字ずつずらして次のヘッダを探す。
+ */
+
+/* ヘッダの長さ */
+#define LZ_HEADER	3
+/* 一ブロックの中身の最大の長さ */
+#define LZ_BLOCK_MAX	0x7FFF
+/* 圧縮したことを表すビット */
+#define LZ_COMPRESSED	0x8000
+/* 窓の大きさ（一致の最大の距離） */
+#define LZ_WINDOW	1024
+/* 一致の最小及び最大の長さ */
+#define LZ_MATCH_MIN	3
+#define LZ_MATCH_MAX	(LZ_MATCH_MIN + 0x3F)
+
+/* n 文字を圧縮したブロックの並びの最大の長さ */
+#define LZ_BOUND(n)	((n) + LZ_HEADER * ((n) / LZ_BLOCK_MAX + 1))
+
+/*
+ * 伸長の段階
+ */
+enum lzState {
+	LZ_HEAD,	/* ヘッダを待っている */
+	LZ_STORED,	/* 圧縮していない中身 */
+	LZ_FLAGS,	/* 記号の種類 */
+	LZ_TOKEN,	/* リテラルか一致の 1 byte 目 */
+	LZ_MATCH,	/* 一致の 2 byte 目 */
+};
+
+/*
+ * 伸長する状態
+ */
+struct lz {
+	enum lzState state;
+	uint8_t head[LZ_HEADER];
+	size_t nHead;
+	uint16_t left;		/* ブロックの中身の残りの文字数 */
+	uint8_t flags, nFlags;	/* 記号の種類及びその残りの数 */
+	uint8_t first;		/* 一致の 1 byte 目 */
+	uint8_t window[LZ_WINDOW];	/* 直近に伸長した文字 */
+	size_t pos, done;	/* 窓の次の位置及びブロックで伸長した文字数 */
+};
+
+/*
+ * ヘッダから探し始める
+ */
+static inline void
+initLz(struct lz *z)
+{
+	z->state = LZ_HEAD;
+	z->nHead = 0;
+	z->pos = z->done = 0;
+}
+
+/*
+ * 伸長した 1 文字を窓に入れる
+ */
+static inline void
+putLz(struct lz *z, uint8_t c)
+{
+	z->window[z->pos] = c;
+	z->pos = (z->pos + 1) % LZ_WINDOW;
+	z->done++;
+}
+
+/*
+ * 次の記号へ進む
+ */
+static inline void
+nextLz(struct lz *z)
+{
+	z->flags >>= 1;
+	z->state = --z->nFlags == 0 ? LZ_FLAGS : LZ_TOKEN;
+}
+
+/*
+ * 1 文字を与えて伸長し、伸長した文字を out に並べてその数を返す
+ * out には LZ_MATCH_MAX 文字分の場所が必要
+ */
+static inline size_t
+feedLz(struct lz *z, uint8_t c, uint8_t *out)
+{
+	size_t dist, len, n = 0;
+
+	switch (z->state) {
+	case LZ_HEAD:
+	default:
+		z->head[z->nHead++] = c;
+		if (z->nHead < LZ_HEADER)
+			return 0;
+		z->left = z->head[0] | (z->head[1] & 0x7F) << 8;
+		if (stripeCrc(z->head, LZ_HEADER - 1) != z->head[2]
+				|| z->left == 0) {
+			/* 1 文字ずらして探し直す */
+			z->head[0] = z->head[1];
+			z->head[1] = z->head[2];
+			z->nHead = LZ_HEADER - 1;
+			return 0;
+		}
+		z->nHead = 0;
+		z->done = 0;
+		z->nFlags = 0;
+		z->state = z->head[1] & (LZ_COMPRESSED >> 8)
+				? LZ_FLAGS : LZ_STORED;
+		return 0;
+	case LZ_STORED:
+		putLz(z, out[n++] = c);
+		break;
+	case LZ_FLAGS:
+		z->flags = c;
+		z->nFlags = 8;
+		z->state = LZ_TOKEN;
+		break;
+	case LZ_TOKEN:
+		if (z->flags & 1) {
+			z->first = c;
+			z->state = LZ_MATCH;
+			break;
+		}
+		putLz(z, out[n++] = c);
+		nextLz(z);
+		break;
+	case LZ_MATCH:
+		dist = (z->first | (size_t)(c >> 6) << 8) + 1;
+		len = (c & 0x3F) + LZ_MATCH_MIN;
+		/* ブロックの外を指していれば壊れているので捨てる */
+		if (dist <= z->done)
+			while (n < len)
+				putLz(z, out[n++] = z->window[
+						(z->pos + LZ_WINDOW - dist)
+						% LZ_WINDOW]);
+		nextLz(z);
+		break;
+	}
+
+	/* ブロックの終わりなら次のヘッダを待つ */
+	if (--z->left == 0)
+		z->state = LZ_HEAD;
+
+	return n;
+}
+
+/*
+ * n 文字を LZ_BLOCK_MAX 文字ごとのブロックに圧縮して out に並べ、その長さを返す
+ * out には LZ_BOUND(n) 文字分の場所が必要
+ */
+size_t compressLz(const uint8_t *in, size_t n, uint8_t *out);
+
+#endif	/* !LZ_H */
@@ -0,0 +1,105 @@
+#ifndef MODE_H
+#define MODE_H	1
+
+#include <stdint.h>
+
+#include "packet.h"
+
+/*
+ * 送信の方式
+ *
+ * 送信機に送るチップレートの後ろに方式を表す文字を並べると（例えば "9600f"）、
+ * 送信機はレベルチェックパターンの後に方式を表す 1 byte を MODE_HEADER 回送り、
+ * それからデータをその方式で送る。
+ * 受信機は MODE_HEADER 回分の多数決で方式を知る。
+ * 方式を表す 1 byte は、どの方式でも方式なしのときと同じように送る。
+ */
+
+/* 'f': 拡大ハミング符号による誤り訂正（fec.h） */
+#define MODE_FEC	0x01
+/* 'p': 同期語、長さ、通し番号及び CRC を付けた枠（packet.h） */
+#define MODE_FRAMED	0x02
+/* 's': PRBS15 による白色化（scramble.h） */
+#define MODE_SCRAMBLE	0x04
+/* 'z': ホストが LZ 方式で圧縮したデータの伸長（lz.h） */
+#define MODE_COMPRESS	0x08
+/* 'r': ホストが符号化した送信パターンをそのまま送る（chips.h） */
+#define MODE_RAW	0x10
+/* 'w': 各符号で Walsh 系列を選んで 1 フレームに 8 bit を載せる（chips.h） */
+#define MODE_WALSH	0x20
+
+/* 方式を表す 1 byte を送る回数 */
+#define MODE_HEADER	3
+/* 1 フレームのチップ数 */
+#define MODE_FRAME_CHIPS	16
+
+/*
+ * 方式を表す文字の並びを読む（知らない文字があれば -1 を返す）
+ */
+static inline int
+parseMode(const char *s, uint8_t *mode)
+{
+	*mode = 0;
+	for (; *s != '\0'; s++)
+		switch (*s) {
+		case 'f':
+			*mode |= MODE_FEC;
+			break;
+		case 'p':
+			*mode |= MODE_FRAMED;
+			break;
+		case 's':
+			*mode |= MODE_SCRAMBLE;
+			break;
+		case 'z':
+			*mode |= MODE_COMPRESS;
+			break;
+		case 'r':
+			*mode |= MODE_RAW;
+			break;
+		case 'w':
+			*mode |= MODE_WALSH;
+			break;
+		default:
+			return -1;
+		}
+
+	return 0;
+}
+
+/*
+ * MODE_HEADER 回分の方式からビットごとの多数決で方式を決める
+ */
+static inline uint8_t
+voteMode(const uint8_t *h)
+{
+	return (h[0] & h[1]) | (h[0] & h[2]) | (h[1] & h[2]);
+}
+
+/*
+ * 1 文字の送信にかかるフレーム数
+ */
+static inline unsigned
+modeByteFrames(uint8_t mode)
+{
+	if (mode & MODE_WALSH)
+		return mode & MODE_FEC ? 2 : 1;
+
+	return mode & MODE_FEC ? 4 : 2;
+}
+
+/*
+ * データ 1 文字の送信にかかるチップ数（枠にするなら、満杯の枠の中身以外の分を含む）
+ */
+static inline double
+modeByteChips(uint8_t mode)
+{
+	double chips = MODE_FRAME_CHIPS * modeByteFrames(mode);
+
+	if (mode & MODE_FRAMED)
+		chips = chips * (PACKET_MAX + PACKET_OVERHEAD) / PACKET_MAX;
+
+	return chips;
+}
+
+#endif	/* !MODE_H */
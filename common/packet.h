@@ -0,0 +1,169 @@
+#ifndef PACKET_H
+#define PACKET_H	1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 無線区間の枠の形式
+ *
+ * 送信方式 'p' では、送信機はデータを PACKET_MAX 文字までの枠に分けて送る。
+ * 各枠は、同期語（PACKET_SYNC0, PACKET_SYNC1）、中身の長さ（8 bit）、
+ * 通し番号（8 bit）、中身、長さから中身までの CRC-16（CCITT、リトルエンディアン）からなる。
+ * 受信機は CRC の合った枠だけを同じ形式のままシリアル通信に出力するので、
+ * ホスト上のプログラムも同じ方法で枠を切り分けられる。
+ */
+
+/* 同期語 */
+#define PACKET_SYNC0	0x2D
+#define PACKET_SYNC1	0xD4
+/* 中身の最大の長さ */
+#define PACKET_MAX	64
+/* 枠の中身以外の長さ（同期語、長さ、通し番号及び CRC） */
+#define PACKET_OVERHEAD	6
+
+/* CRC-16 の表（多項式 x^16 + x^12 + x^5 + 1） */
+static const uint16_t packetCrcTab[256] = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+	0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+	0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+	0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+	0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+	0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+	0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+	0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+	0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+	0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+	0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+	0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+	0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+	0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+	0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+	0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+	0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+	0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+	0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+	0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+	0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+	0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+	0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+	0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+	0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+	0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+	0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+	0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+	0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+	0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+	0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0,
+};
+
+/*
+ * CRC-16 を crc に続けて 1 文字分計算する（最初は 0xFFFF を与える）
+ */
+static inline uint16_t
+packetCrc(uint16_t crc, uint8_t c)
+{
+	return (uint16_t)(crc << 8) ^ packetCrcTab[(crc >> 8 ^ c) & 0xFF];
+}
+
+/*
+ * 枠を切り分ける段階
+ */
+enum packetState {
+	PACKET_HUNT0,	/* 同期語の 1 文字目を探している */
+	PACKET_HUNT1,	/* 同期語の 2 文字目を待っている */
+	PACKET_LENGTH,
+	PACKET_SEQ,
+	PACKET_DATA,
+	PACKET_CRC0,
+	PACKET_CRC1,
+};
+
+/*
+ * 枠を切り分ける状態
+ */
+struct packet {
+	enum packetState state;
+	uint8_t len, seq;
+	uint8_t data[PACKET_MAX];
+	size_t n;
+	uint16_t crc, got;
+};
+
+/* feedPacket() の結果 */
+#define PACKET_MORE	0	/* 枠の途中 */
+#define PACKET_GOOD	1	/* CRC の合った枠が揃った */
+#define PACKET_BAD	2	/* 壊れた枠を捨てた */
+
+/*
+ * 同期語から探し始める
+ */
+static inline void
+huntPacket(struct packet *p)
+{
+	p->state = PACKET_HUNT0;
+}
+
+/*
+ * 同期語を受け取ったものとして、長さから受け取り始める
+ */
+static inline void
+syncPacket(struct packet *p)
+{
+	p->state = PACKET_LENGTH;
+	p->crc = 0xFFFF;
+}
+
+/*
+ * 1 文字を与えて枠を切り分ける
+ * 枠が揃うか壊れた枠を捨てたら、次は同期語から探す
+ */
+static inline int
+feedPacket(struct packet *p, uint8_t c)
+{
+	switch (p->state) {
+	case PACKET_HUNT0:
+		if (c == PACKET_SYNC0)
+			p->state = PACKET_HUNT1;
+		return PACKET_MORE;
+	case PACKET_HUNT1:
+		if (c == PACKET_SYNC1)
+			syncPacket(p);
+		else if (c != PACKET_SYNC0)
+			p->state = PACKET_HUNT0;
+		return PACKET_MORE;
+	case PACKET_LENGTH:
+		p->crc = packetCrc(p->crc, c);
+		if (c == 0 || c > PACKET_MAX) {
+			p->state = PACKET_HUNT0;
+			return PACKET_BAD;
+		}
+		p->len = c;
+		p->state = PACKET_SEQ;
+		return PACKET_MORE;
+	case PACKET_SEQ:
+		p->crc = packetCrc(p->crc, c);
+		p->seq = c;
+		p->n = 0;
+		p->state = PACKET_DATA;
+		return PACKET_MORE;
+	case PACKET_DATA:
+		p->crc = packetCrc(p->crc, c);
+		p->data[p->n++] = c;
+		if (p->n == p->len)
+			p->state = PACKET_CRC0;
+		return PACKET_MORE;
+	case PACKET_CRC0:
+		p->got = c;
+		p->state = PACKET_CRC1;
+		return PACKET_MORE;
+	case PACKET_CRC1:
+	default:
+		p->got |= (uint16_t)c << 8;
+		p->state = PACKET_HUNT0;
+		return p->got == p->crc ? PACKET_GOOD : PACKET_BAD;
+	}
+}
+
+#endif	/* !PACKET_H */
@@ -0,0 +1,34 @@
+#ifndef SCRAMBLE_H
+#define SCRAMBLE_H	1
+
+#include <stdint.h>
+
+/*
+ * 白色化のスクランブラ
+ *
+ * 送信方式 's' では、送信機はデータの各文字に PRBS15（x^15 + x^14 + 1）の系列を
+ * 8 bit ずつ排他的論理和してから送り、受信機は復号した文字に同じ系列を排他的論理和して元に戻す。
+ * 同じ文字が続いても、送るチップパターンは偏らない。
+ * 系列は送信方式の直後で SCRAMBLE_SEED から始め、枠にするなら各枠の同期語の直後でも始め直す
+ * （同期語そのものは白色化しない）。
+ * 1 bit の誤りは 1 bit の誤りのままで、誤りが広がることはない。
+ */
+
+/* 系列の始めの状態（15 bit、0 以外） */
+#define SCRAMBLE_SEED	0x6B3C
+
+/*
+ * 系列の次の 8 bit を返して状態を進める
+ * 帰還の位置（14 と 15）が 8 bit より離れているので、8 bit をまとめて求められる
+ */
+static inline uint8_t
+scrambleNext(uint16_t *s)
+{
+	const uint8_t k = (*s ^ *s >> 1) >> 6 & 0xFF;
+
+	*s = (uint16_t)(*s << 8 | k) & 0x7FFF;
+
+	return k;
+}
+
+#endif	/* !SCRAMBLE_H */
@@ -0,0 +1,71 @@
+#ifndef STRIPE_H
+#define STRIPE_H	1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 複数の送信機に分けて送る塊の形式
+ *
+ * 各塊は、印（STRIPE_MAGIC）、通し番号（32 bit）、中身の長さ（16 bit）、
+ * それまでの 7 byte の CRC-8 の 8 byte のヘッダに中身が続く。
+ * 多バイトの値はリトルエンディアンで詰める。
+ */
+
+/* 塊の先頭の印 */
+#define STRIPE_MAGIC	0xA5
+/* ヘッダの長さ */
+#define STRIPE_HEADER	8
+/* 塊の中身の既定の長さ及び最大の長さ */
+#define STRIPE_CHUNK	256
+#define STRIPE_MAX	65535
+
+/*
+ * CRC-8（多項式 x^8 + x^2 + x + 1）
+ */
+static inline uint8_t
+stripeCrc(const uint8_t *p, size_t n)
+{
+	uint8_t crc = 0;
+
+	while (n-- > 0) {
+		crc ^= *p++;
+		for (int i = 0; i < 8; i++)
+			crc = crc & 0x80 ? (uint8_t)(crc << 1 ^ 0x07) : crc << 1;
+	}
+
+	return crc;
+}
+
+/*
+ * ヘッダを詰める
+ */
+static inline void
+putStripeHeader(uint8_t *h, uint32_t seq, uint16_t len)
+{
+	h[0] = STRIPE_MAGIC;
+	for (int i = 0; i < 4; i++)
+		h[1 + i] = seq >> 8 * i;
+	h[5] = len;
+	h[6] = len >> 8;
+	h[7] = stripeCrc(h, STRIPE_HEADER - 1);
+}
+
+/*
+ * ヘッダを読む（印か CRC が合わなければ -1 を返す）
+ */
+static inline int
+getStripeHeader(const uint8_t *h, uint32_t *seq, uint16_t *len)
+{
+	if (h[0] != STRIPE_MAGIC
+			|| stripeCrc(h, STRIPE_HEADER - 1) != h[STRIPE_HEADER - 1])
+		return -1;
+	*seq = 0;
+	for (int i = 0; i < 4; i++)
+		*seq |= (uint32_t)h[1 + i] << 8 * i;
+	*len = h[5] | h[6] << 8;
+
+	return 0;
+}
+
+#endif	/* !STRIPE_H */
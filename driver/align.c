@@ -0,0 +1,236 @@
+#include <string.h>
+
+#include "align.h"
+
+/* 合わせ直しを試みる保留中のビット誤りの数（ランダムなら半分が誤る） */
+#define RESYNC_ERRORS	(ALIGN_WINDOW * 8 / 4)
+
+/*
+ * 送信データのニブル位置 nib から始まる文字
+ */
+static uint8_t
+expected(const struct aligner *al, size_t nib)
+{
+	const size_t i = nib / 2;
+
+	if (nib % 2 == 0)
+		return al->tbuf[i];
+	return al->tbuf[i] >> 4 | al->tbuf[i + 1] << 4;
+}
+
+/*
+ * 送信データのニブル位置 nib からの n 文字と buf とのハミング距離
+ * 8 文字ずつ 64 bit の XOR と popcount とで比べる
+ */
+static size_t
+hamming(const struct aligner *al, size_t nib, const uint8_t *buf, size_t n)
+{
+	uint64_t t, r;
+	size_t d, i, j;
+
+	d = 0;
+	i = 0;
+	j = nib / 2;
+	for (; i + 8 <= n && j + 9 <= al->nByte; i += 8, j += 8) {
+		memcpy(&t, al->tbuf + j, sizeof(t));
+		memcpy(&r, buf + i, sizeof(r));
+		if (nib % 2 != 0)
+			t = t >> 4 | (uint64_t)al->tbuf[j + 8] << 60;
+		d += __builtin_popcountll(t ^ r);
+	}
+	for (; i < n; i++)
+		d += __builtin_popcount((uint8_t)(expected(al, nib + 2 * i)
+				^ buf[i]));
+
+	return d;
+}
+
+/*
+ * ニブル位置 nib から n 文字が送信データに収まるか
+ */
+static int
+fits(const struct aligner *al, size_t nib, size_t n)
+{
+	return nib + 2 * n + (nib % 2) <= 2 * al->nByte;
+}
+
+/*
+ * 受信した文字 c と送信データのニブル位置 nib の文字とのビット誤りの数
+ * 送信データに収まらなければ miss を返す
+ */
+static size_t
+mismatch(const struct aligner *al, size_t nib, uint8_t c, size_t miss)
+{
+	if (!fits(al, nib, 1))
+		return miss;
+	return __builtin_popcount((uint8_t)(expected(al, nib) ^ c));
+}
+
+/*
+ * 溜めておいたビット誤りを統計に渡す
+ */
+static void
+flush(struct aligner *al)
+{
+	if (al->st != NULL && al->nDiff > 0)
+		addErrors(al->st, al->diff, al->nDiff == 8 ? ~(uint64_t)0
+				: ((uint64_t)1 << 8 * al->nDiff) - 1);
+	al->diff = 0;
+	al->nDiff = 0;
+}
+
+/*
+ * 受信した文字 c を送信データのニブル位置 nib の文字と比べる
+ * 送信データの末尾を越えたものは余計な文字として数える
+ */
+static size_t
+compare(struct aligner *al, size_t nib, uint8_t c)
+{
+	if (!fits(al, nib, 1)) {
+		al->insertions += 2;
+		return 0;
+	}
+
+	const uint8_t d = expected(al, nib) ^ c;
+	const size_t e = __builtin_popcount(d);
+	al->bits += 8;
+	al->errors += e;
+
+	/* 統計には 8 文字ずつまとめて渡す */
+	al->diff |= (uint64_t)d << 8 * al->nDiff;
+	if (++al->nDiff == 8)
+		flush(al);
+	return e;
+}
+
+/*
+ * 保留中の最も古い文字を確定させる
+ */
+static void
+commit(struct aligner *al)
+{
+	al->windowErrors -= compare(al, al->pos - 2 * al->nWindow,
+			al->window[0]);
+	memmove(al->window, al->window + 1, --al->nWindow);
+}
+
+/*
+ * 保留中の受信データが最もよく一致する位置に合わせ直す
+ */
+static void
+resync(struct aligner *al)
+{
+	const size_t start = al->pos - 2 * al->nWindow;
+	size_t best, bestErrors, split, splitErrors, e, eOld, eNew;
+
+	best = start;
+	bestErrors = al->windowErrors;
+	for (size_t d = 1; d <= ALIGN_RANGE; d++) {
+		/* 欠落（送信データの先へ）と挿入（送信データの手前へ）とを交互に */
+		if (fits(al, start + d, al->nWindow)) {
+			e = hamming(al, start + d, al->window, al->nWindow);
+			if (e < bestErrors) {
+				best = start + d;
+				bestErrors = e;
+			}
+		}
+		if (d <= start && fits(al, start - d, al->nWindow)) {
+			e = hamming(al, start - d, al->window, al->nWindow);
+			if (e < bestErrors) {
+				best = start - d;
+				bestErrors = e;
+			}
+		}
+	}
+
+	/* 半分以下に減らないならビット誤りが多いだけとみなす */
+	if (best == start || bestErrors * 2 > al->windowErrors)
+		return;
+
+	/*
+	 * ずれた場所を探す
+	 * そこより前は元の位置で、後は新しい位置で比べたときに誤りが最も少ない
+	 */
+	split = 0;
+	splitErrors = e = bestErrors;
+	for (size_t i = 0; i < al->nWindow; i++) {
+		eOld = mismatch(al, start + 2 * i, al->window[i], 8);
+		eNew = mismatch(al, best + 2 * i, al->window[i], 8);
+		e = e - eNew + eOld;
+		if (e < splitErrors) {
+			split = i + 1;
+			splitErrors = e;
+		}
+	}
+
+	/* ずれる前の文字は元の位置で確定させる */
+	for (size_t i = 0; i < split; i++)
+		(void)compare(al, start + 2 * i, al->window[i]);
+	memmove(al->window, al->window + split, al->nWindow - split);
+	al->nWindow -= split;
+
+	if (best > start)
+		al->deletions += best - start;
+	else
+		al->insertions += start - best;
+	al->slips++;
+	al->pos = best + 2 * (split + al->nWindow);
+	al->windowErrors = 0;
+	for (size_t i = 0; i < al->nWindow; i++)
+		al->windowErrors += mismatch(al,
+				al->pos - 2 * (al->nWindow - i), al->window[i], 0);
+}
+
+/*
+ * 位置合わせの状態を初期化する
+ */
+void
+initAligner(struct aligner *al, const uint8_t *tbuf, size_t nByte,
+		struct stats *st)
+{
+	memset(al, 0, sizeof(*al));
+	al->tbuf = tbuf;
+	al->nByte = nByte;
+	al->st = st;
+}
+
+/*
+ * 受信データを比べる
+ */
+void
+alignBytes(struct aligner *al, const uint8_t *buf, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		if (al->nWindow == ALIGN_WINDOW)
+			commit(al);
+
+		const size_t nib = al->pos;
+		al->window[al->nWindow++] = buf[i];
+		al->pos += 2;
+		al->windowErrors += mismatch(al, nib, buf[i], 0);
+
+		if (al->nWindow == ALIGN_WINDOW
+				&& al->windowErrors > RESYNC_ERRORS)
+			resync(al);
+	}
+}
+
+/*
+ * 送信データの全てに対応する受信データを受け取ったか
+ */
+int
+alignerDone(const struct aligner *al)
+{
+	return al->pos >= 2 * al->nByte;
+}
+
+/*
+ * 保留中の受信データを確定させる
+ */
+void
+finishAligner(struct aligner *al)
+{
+	while (al->nWindow > 0)
+		commit(al);
+	flush(al);
+}
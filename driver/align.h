@@ -0,0 +1,67 @@
+#ifndef ALIGN_H
+#define ALIGN_H	1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stats.h"
+
+/* 位置合わせを確定させるまで保留する文字数 */
+#define ALIGN_WINDOW	16
+/* 位置合わせで探す範囲（ニブル単位、前後それぞれ） */
+#define ALIGN_RANGE	64
+
+/*
+ * 送信データと受信データとの位置合わせをしながら比べる
+ *
+ * 受信機は 4 bit（ニブル）ずつ復号して 2 つずつ文字にするので、
+ * 取りこぼしや余計な復号があるとニブル単位でずれる。
+ * 直近の受信データのビット誤りが多すぎるときは、送信データの前後を探して
+ * 最もよく一致する位置に合わせ直し、そのずれを挿入または欠落として数える。
+ */
+struct aligner {
+	/* 送信データ */
+	const uint8_t *tbuf;
+	size_t nByte;
+	/* 次に受け取る文字に対応する送信データの位置（ニブル単位） */
+	size_t pos;
+	/* 保留中の受信データ及びそのビット誤りの数 */
+	uint8_t window[ALIGN_WINDOW];
+	size_t nWindow, windowErrors;
+
+	/* 比べたビット数及びビット誤りの数 */
+	size_t bits, errors;
+	/* 余計に受け取ったニブル数及び欠落したニブル数 */
+	size_t insertions, deletions;
+	/* 位置を合わせ直した回数 */
+	size_t slips;
+
+	/* ビット誤りの統計（NULL なら取らない）及びそれに渡していない誤り */
+	struct stats *st;
+	uint64_t diff;
+	unsigned nDiff;
+};
+
+/*
+ * 位置合わせの状態を初期化する
+ */
+void initAligner(struct aligner *al, const uint8_t *tbuf, size_t nByte,
+		struct stats *st);
+
+/*
+ * 受信データを比べる
+ */
+void alignBytes(struct aligner *al, const uint8_t *buf, size_t n);
+
+/*
+ * 送信データの全てに対応する受信データを受け取ったか
+ */
+int alignerDone(const struct aligner *al);
+
+/*
+ * 保留中の受信データを確定させる
+ * 受け取っていない末尾の送信データは欠落として数えない
+ */
+void finishAligner(struct aligner *al);
+
+#endif	/* !ALIGN_H */
@@ -0,0 +1,155 @@
+#include <math.h>
+
+#include "confidence.h"
+
+/*
+ * 信頼水準 confidence（両側）に対応する標準正規分布の分位点
+ * 両側の確率 erfc(z / √2) が 1 - confidence になる z を二分法で求める
+ */
+double
+zScore(double confidence)
+{
+	double lo, hi, mid;
+
+	lo = 0.0;
+	hi = 40.0;
+	for (int i = 0; i < 100; i++) {
+		mid = (lo + hi) / 2;
+		if (erfc(mid / M_SQRT2) > 1.0 - confidence)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return (lo + hi) / 2;
+}
+
+/*
+ * n bit 中 k bit が誤ったときの誤り率の Wilson の信頼区間
+ */
+void
+wilson(size_t k, size_t n, double z, double *lo, double *hi)
+{
+	if (n == 0) {
+		*lo = 0.0;
+		*hi = 1.0;
+		return;
+	}
+
+	const double p = (double)k / n;
+	const double z2 = z * z;
+	const double c = (p + z2 / (2 * n)) / (1 + z2 / n);
+	const double h = z / (1 + z2 / n)
+			* sqrt(p * (1 - p) / n + z2 / (4.0 * n * n));
+	*lo = k == 0 ? 0.0 : fmax(0.0, c - h);
+	*hi = k == n ? 1.0 : fmin(1.0, c + h);
+}
+
+/*
+ * 正則化不完全ベータ関数の連分数（Lentz の方法）
+ */
+static double
+betacf(double a, double b, double x)
+{
+	const double tiny = 1e-300;
+	double c, d, h, aa, del;
+
+	c = 1.0;
+	d = 1.0 - (a + b) * x / (a + 1);
+	d = 1.0 / (fabs(d) < tiny ? tiny : d);
+	h = d;
+	for (int m = 1; m <= 100000; m++) {
+		const int m2 = 2 * m;
+		/* 偶数番目の項 */
+		aa = m * (b - m) * x / ((a + m2 - 1) * (a + m2));
+		d = 1.0 + aa * d;
+		d = 1.0 / (fabs(d) < tiny ? tiny : d);
+		c = 1.0 + aa / c;
+		c = fabs(c) < tiny ? tiny : c;
+		h *= d * c;
+		/* 奇数番目の項 */
+		aa = -(a + m) * (a + b + m) * x / ((a + m2) * (a + m2 + 1));
+		d = 1.0 + aa * d;
+		d = 1.0 / (fabs(d) < tiny ? tiny : d);
+		c = 1.0 + aa / c;
+		c = fabs(c) < tiny ? tiny : c;
+		del = d * c;
+		h *= del;
+		if (fabs(del - 1.0) < 1e-13)
+			break;
+	}
+
+	return h;
+}
+
+/*
+ * 正則化不完全ベータ関数 I_x(a, b)
+ * 連分数が速く収束する側で求める
+ */
+static double
+betai(double a, double b, double x)
+{
+	if (x <= 0.0)
+		return 0.0;
+	if (x >= 1.0)
+		return 1.0;
+
+	const double bt = exp(lgamma(a + b) - lgamma(a) - lgamma(b)
+			+ a * log(x) + b * log1p(-x));
+	if (x < (a + 1) / (a + b + 2))
+		return bt * betacf(a, b, x) / a;
+	return 1.0 - bt * betacf(b, a, 1.0 - x) / b;
+}
+
+/*
+ * I_x(a, b) = p となる x を二分法で求める
+ */
+static double
+betaInv(double p, double a, double b)
+{
+	double lo, hi, mid;
+
+	lo = 0.0;
+	hi = 1.0;
+	for (int i = 0; i < 64; i++) {
+		mid = (lo + hi) / 2;
+		if (betai(a, b, mid) < p)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return (lo + hi) / 2;
+}
+
+/*
+ * n bit 中 k bit が誤ったときの誤り率の Clopper-Pearson の信頼区間
+ * 二項分布の裾を正則化不完全ベータ関数で表し、それぞれ (1 - confidence) / 2 にする
+ */
+void
+clopperPearson(size_t k, size_t n, double confidence, double *lo, double *hi)
+{
+	const double alpha = 1.0 - confidence;
+
+	if (n == 0) {
+		*lo = 0.0;
+		*hi = 1.0;
+		return;
+	}
+
+	*lo = k == 0 ? 0.0 : betaInv(alpha / 2, k, n - k + 1.0);
+	*hi = k == n ? 1.0 : betaInv(1.0 - alpha / 2, k + 1.0, n - k);
+}
+
+/*
+ * n bit 中 k bit が誤ったときの誤り率の信頼区間
+ */
+void
+interval(size_t k, size_t n, double confidence, int exact,
+		double *lo, double *hi)
+{
+	if (exact)
+		clopperPearson(k, n, confidence, lo, hi);
+	else
+		wilson(k, n, zScore(confidence), lo, hi);
+}
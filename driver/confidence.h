@@ -0,0 +1,29 @@
+#ifndef CONFIDENCE_H
+#define CONFIDENCE_H	1
+
+#include <stddef.h>
+
+/*
+ * 信頼水準 confidence（両側）に対応する標準正規分布の分位点
+ */
+double zScore(double confidence);
+
+/*
+ * n bit 中 k bit が誤ったときの誤り率の Wilson の信頼区間
+ */
+void wilson(size_t k, size_t n, double z, double *lo, double *hi);
+
+/*
+ * n bit 中 k bit が誤ったときの誤り率の Clopper-Pearson の信頼区間
+ */
+void clopperPearson(size_t k, size_t n, double confidence,
+		double *lo, double *hi);
+
+/*
+ * n bit 中 k bit が誤ったときの誤り率の信頼区間
+ * exact なら Clopper-Pearson の、さもなくば Wilson の信頼区間
+ */
+void interval(size_t k, size_t n, double confidence, int exact,
+		double *lo, double *hi);
+
+#endif	/* !CONFIDENCE_H */
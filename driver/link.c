@@ -0,0 +1,519 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "mode.h"
+
+#include "link.h"
+
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+#define MAX(a, b)	((a) > (b) ? (a) : (b))
+
+/* 送信機が応答するまでの制限時間（s） */
+#define START_TIMEOUT	5
+/* 受信が途切れてから諦めるまでの時間（s 及び文字数換算） */
+#define IDLE_TIMEOUT	2
+#define IDLE_BYTES	64
+/* 途中経過を報告する間隔（s） */
+#define REPORT_INTERVAL	1
+/* 最初に信頼区間を調べる比べたビット数（以降は倍になるごとに調べる） */
+#define LOOK_BITS	1024
+
+/*
+ * 時刻 a から b までの経過時間（s）
+ */
+static double
+elapsed(const struct timespec *a, const struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) * 1e-9;
+}
+
+/*
+ * 端末を RAW モードかつノンブロッキングで開く
+ */
+static int
+openTerminal(const char *name)
+{
+	struct termios tos;
+	int fd;
+
+	fd = open(name, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (fd == -1)
+		err(1, "%s", name);
+	/* 端末属性を取得する */
+	if (tcgetattr(fd, &tos) == -1)
+		err(1, "%s", name);
+	/* RAW モードにする（XXX: 本来であれば復旧用を用意する） */
+	cfmakeraw(&tos);
+	/* 適用する */
+	if (tcsetattr(fd, TCSANOW, &tos) == -1)
+		err(1, "%s", name);
+
+	return fd;
+}
+
+/*
+ * 送信機が送り終えた文字数の見積もり
+ * 経過時間からの見積もりと受信済みの文字数との大きい方を使うので、
+ * 送信機のクロックがずれていても、受信が途切れても詰まらない
+ */
+static size_t
+sentBytes(const struct link *lk, const struct timespec *now)
+{
+	const double byTime = (elapsed(&lk->start, now) * lk->chipRate
+			- OVERHEAD * BYTE_CHIPS) / lk->byteChips;
+
+	return MAX(byTime > 0 ? (size_t)byTime : 0, lk->nRead);
+}
+
+/*
+ * 送信機のバッファが溢れない範囲で送信データを送る
+ */
+static void
+pace(struct link *lk, const struct timespec *now)
+{
+	ssize_t n;
+
+	/* 送信済みの文字数を見積もり、先行分を足したところまで送る */
+	const size_t sent = sentBytes(lk, now);
+	const size_t lead = lk->lead * BYTE_CHIPS / lk->byteChips;
+	const size_t limit = lk->nByte > 0
+			? MIN(lk->nByte, lead + sent) : lead + sent;
+	if (lk->nWrite >= limit)
+		return;
+
+	if (lk->prbs == NULL) {
+		n = write(lk->tfd, lk->tbuf + lk->nWrite, limit - lk->nWrite);
+		if (n == -1) {
+			if (errno == EAGAIN)
+				return;
+			err(1, "write: %s", lk->tname);
+		}
+		lk->nWrite += n;
+		return;
+	}
+
+	/* 書き込めなかった分を残しておき、無くなったら次を生成する */
+	while (lk->nWrite < limit) {
+		if (lk->pendLen == 0) {
+			lk->pendHead = 0;
+			lk->pendLen = MIN(limit - lk->nWrite, PENDING);
+			generatePrbs(&lk->gen, lk->pending, lk->pendLen);
+		}
+		n = write(lk->tfd, lk->pending + lk->pendHead,
+				MIN(lk->pendLen, limit - lk->nWrite));
+		if (n == -1) {
+			if (errno == EAGAIN)
+				return;
+			err(1, "write: %s", lk->tname);
+		}
+		lk->pendHead += n;
+		lk->pendLen -= n;
+		lk->nWrite += n;
+	}
+}
+
+/*
+ * 送受信機を開く
+ */
+void
+openLink(struct link *lk, const char *rname, const char *tname, size_t lead)
+{
+	memset(lk, 0, sizeof(*lk));
+	lk->rname = rname;
+	lk->tname = tname;
+	lk->lead = lead;
+	lk->modes = "";
+	lk->byteChips = BYTE_CHIPS;
+	lk->rfd = openTerminal(rname);
+	lk->tfd = openTerminal(tname);
+	lk->state = LINK_DONE;
+}
+
+/*
+ * 送信データの代わりに PRBS を使う
+ */
+int
+usePrbs(struct link *lk, const char *name)
+{
+	if (initPrbs(&lk->gen, name) == -1)
+		return -1;
+	lk->prbs = name;
+	return 0;
+}
+
+/*
+ * 送信方式を設定する
+ */
+int
+setMode(struct link *lk, const char *modes)
+{
+	uint8_t mode;
+
+	/*
+	 * 枠にすると受信機の出力が枠の形式になり、圧縮すると受信機が伸長するので、
+	 * 送った文字列とそのままでは比べられない
+	 * 符号化した送信パターンを送ることもしない
+	 */
+	if (parseMode(modes, &mode) == -1
+			|| mode & (MODE_FRAMED | MODE_COMPRESS | MODE_RAW))
+		return -1;
+	lk->modes = modes;
+	lk->byteChips = modeByteChips(mode);
+	return 0;
+}
+
+/*
+ * 信頼区間の信頼水準及び種類
+ */
+void
+setInterval(struct link *lk, double confidence, int exact)
+{
+	lk->confidence = confidence;
+	lk->exact = exact;
+}
+
+/*
+ * 誤り率が決まるか信頼区間が十分に狭くなったら測定を打ち切るようにする
+ */
+void
+setTarget(struct link *lk, double target, double width)
+{
+	lk->target = target;
+	lk->width = width;
+}
+
+/*
+ * 信頼区間を調べて、測定を打ち切るか決める
+ *
+ * 調べるたびに誤って打ち切る確率が積み重なるので、比べたビット数が倍になるごとにだけ調べ、
+ * j 回目（0 から）は信頼水準を 1 - α / ((j + 1)(j + 2)) にする。
+ * その和は α を超えないので、いつ打ち切っても信頼水準 1 - α が保たれる。
+ */
+static void
+look(struct link *lk)
+{
+	const double alpha = (1.0 - lk->confidence)
+			/ ((lk->looks + 1.0) * (lk->looks + 2.0));
+	const size_t bits = linkBits(lk), errors = linkErrors(lk);
+	double lo, hi;
+
+	interval(errors, bits, 1.0 - alpha, lk->exact, &lo, &hi);
+	lk->looks++;
+	while (lk->nextLook <= bits)
+		lk->nextLook *= 2;
+
+	if (lk->target > 0 && hi < lk->target)
+		lk->verdict = 1;
+	else if (lk->target > 0 && lo > lk->target)
+		lk->verdict = -1;
+	if (lk->verdict != 0 || (lk->width > 0 && errors > 0
+			&& hi - lo <= lk->width * errors / bits))
+		lk->settled = 1;
+}
+
+/*
+ * 送信機にチップレートを送り付ける
+ */
+static void
+request(struct link *lk, const struct timespec *now)
+{
+	if (dprintf(lk->tfd, "\r%lu%s\r", lk->chipRate, lk->modes) < 0)
+		err(1, "dprintf: %s", lk->tname);
+	lk->requested = 1;
+	lk->drain = 0;
+	lk->start = lk->lastRecv = lk->lastReport = *now;
+}
+
+/*
+ * 送信機に残っている送信データを送り終えるまでの見積もり時間（s）
+ */
+static double
+drainTime(const struct link *lk, const struct timespec *now)
+{
+	const size_t sent = sentBytes(lk, now);
+
+	return ((double)(lk->nWrite > sent ? lk->nWrite - sent : 0)
+			* lk->byteChips + OVERHEAD * BYTE_CHIPS) / lk->chipRate;
+}
+
+/*
+ * チップレート及び送信データを与えて送信を要求する
+ */
+void
+startLink(struct link *lk, unsigned long chipRate, const uint8_t *tbuf,
+		size_t nByte, const struct timespec *now)
+{
+	/* 前の送信データが送信機に残っていれば、それを送り終えるまでの時間 */
+	if (lk->busy)
+		lk->drain = drainTime(lk, now);
+
+	lk->chipRate = chipRate;
+	lk->tbuf = tbuf;
+	lk->nByte = nByte;
+	lk->nWrite = lk->nRead = 0;
+	initStats(&lk->st);
+	initAligner(&lk->al, tbuf, nByte, &lk->st);
+	if (lk->prbs != NULL) {
+		/* 生成器を先頭に戻し、検査器は同期し直させる */
+		(void)initPrbs(&lk->gen, lk->prbs);
+		(void)initPrbs(&lk->chk, lk->prbs);
+		lk->chk.st = &lk->st;
+		lk->pendLen = 0;
+	}
+	lk->looks = lk->verdict = lk->settled = 0;
+	lk->nextLook = LOOK_BITS;
+	lk->timedOut = 0;
+	lk->start = lk->lastRecv = lk->lastReport = *now;
+	lk->state = LINK_START;
+	lk->requested = 0;
+
+	/* 送信機が空いていればすぐに、さもなくば '?' を待ってから要求する */
+	if (!lk->busy)
+		request(lk, now);
+}
+
+/*
+ * 送信機からの応答を処理する
+ */
+void
+readTransmitter(struct link *lk, const struct timespec *now)
+{
+	ssize_t n;
+	char buf[64];
+
+	n = read(lk->tfd, buf, sizeof(buf));
+	if (n == -1) {
+		if (errno == EAGAIN)
+			return;
+		err(1, "read: %s", lk->tname);
+	}
+
+	/* '?' は送信機が送り終えてチップレートを待っている合図 */
+	if (memchr(buf, '?', n) != NULL) {
+		lk->busy = 0;
+		if (lk->state == LINK_START && !lk->requested)
+			request(lk, now);
+		if (lk->state == LINK_DRAIN)
+			lk->state = LINK_DONE;
+	}
+
+	/* '!' が送信開始の合図 */
+	if (lk->state == LINK_START && lk->requested
+			&& memchr(buf, '!', n) != NULL) {
+		lk->state = LINK_RUNNING;
+		lk->busy = 1;
+		lk->start = lk->lastRecv = *now;
+		/* 送信機はすぐにプリアンブルを送り始めるので、先行分を詰める */
+		pace(lk, now);
+	}
+}
+
+/*
+ * 受信機からの文字を受け取って比べる
+ */
+void
+readReceiver(struct link *lk, const struct timespec *now)
+{
+	ssize_t n;
+	uint8_t buf[4096];
+
+	n = read(lk->rfd, buf, sizeof(buf));
+	if (n == -1) {
+		if (errno == EAGAIN)
+			return;
+		err(1, "read: %s", lk->rname);
+	}
+	if (lk->state != LINK_RUNNING || n == 0)
+		return;
+
+	lk->nRead += n;
+	lk->lastRecv = *now;
+
+	/* PRBS は検査器が同期しながら数え、さもなくば位置を合わせながら数える */
+	if (lk->prbs != NULL) {
+		checkPrbs(&lk->chk, buf, n);
+		if (lk->nByte > 0 && lk->nRead >= lk->nByte) {
+			stopLink(lk);
+			return;
+		}
+	}
+	else {
+		alignBytes(&lk->al, buf, n);
+		if (alignerDone(&lk->al)) {
+			stopLink(lk);
+			return;
+		}
+	}
+
+	/* 誤り率が目標の上か下かが決まるか、信頼区間が十分に狭くなったら打ち切る */
+	if ((lk->target > 0 || lk->width > 0) && linkBits(lk) >= lk->nextLook) {
+		look(lk);
+		if (lk->settled) {
+			stopLink(lk);
+			return;
+		}
+	}
+	pace(lk, now);
+}
+
+/*
+ * 時間の経過を処理する（送信データを送り、タイムアウトを調べる）
+ */
+void
+tickLink(struct link *lk, const struct timespec *now)
+{
+	switch (lk->state) {
+	case LINK_START:
+		if (elapsed(&lk->start, now) > START_TIMEOUT + lk->drain)
+			errx(1, "%s: transmitter did not respond", lk->tname);
+		return;
+	case LINK_DRAIN:
+		if (elapsed(&lk->start, now) > START_TIMEOUT + lk->drain) {
+			warnx("%s: transmitter did not finish", lk->tname);
+			lk->state = LINK_DONE;
+		}
+		return;
+	case LINK_RUNNING:
+		break;
+	case LINK_DONE:
+	default:
+		return;
+	}
+
+	pace(lk, now);
+
+	/* 途中経過を報告する */
+	if (elapsed(&lk->lastReport, now) >= REPORT_INTERVAL) {
+		lk->lastReport = *now;
+		if (lk->prbs != NULL)
+			(void)fprintf(stderr, "%s: %zu written, %zu read,"
+					" %zu errors, BER %g, %s,"
+					" %zu sync losses\n", lk->rname,
+					lk->nWrite, lk->nRead, lk->chk.errors,
+					lk->chk.bits > 0 ? (double)lk->chk.errors
+					/ lk->chk.bits : 0.0, lk->chk.locked
+					? "locked" : "unlocked", lk->chk.losses);
+		else
+			(void)fprintf(stderr, "%s: %zu/%zu written,"
+					" %zu/%zu read, %zu errors, BER %g,"
+					" %zu slips\n", lk->rname, lk->nWrite,
+					lk->nByte, lk->nRead, lk->nByte,
+					lk->al.errors, lk->al.bits > 0
+					? (double)lk->al.errors / lk->al.bits
+					: 0.0, lk->al.slips);
+	}
+
+	/*
+	 * 受信が途切れたら諦める
+	 * 最初の文字はプリアンブル等の後に届くので、その分も待つ
+	 */
+	const double byteTime = lk->byteChips / lk->chipRate;
+	double idle = MAX(IDLE_TIMEOUT, IDLE_BYTES * byteTime);
+	if (lk->nRead == 0)
+		idle += (OVERHEAD + 1) * byteTime;
+	if (elapsed(&lk->lastRecv, now) > idle) {
+		lk->timedOut = 1;
+		stopLink(lk);
+	}
+}
+
+/*
+ * 送信機が残りを送り終えて '?' を返すのを待ち始める
+ */
+void
+drainLink(struct link *lk, const struct timespec *now)
+{
+	if (!lk->busy)
+		return;
+	lk->drain = drainTime(lk, now);
+	lk->start = *now;
+	lk->state = LINK_DRAIN;
+}
+
+/*
+ * 測定を終え、保留中の受信データを確定させる
+ */
+void
+stopLink(struct link *lk)
+{
+	if (lk->state == LINK_DONE || lk->state == LINK_DRAIN)
+		return;
+	if (lk->prbs == NULL)
+		finishAligner(&lk->al);
+	finishStats(&lk->st);
+	lk->state = LINK_DONE;
+
+	/* 打ち切らずに終わったら、最後にもう一度調べる */
+	if ((lk->target > 0 || lk->width > 0) && !lk->settled
+			&& linkBits(lk) > 0)
+		look(lk);
+}
+
+/*
+ * 誤り率が目標を下回ると決まれば 1、上回ると決まれば -1、まだなら 0
+ */
+int
+linkVerdict(const struct link *lk)
+{
+	return lk->verdict;
+}
+
+/*
+ * 誤り率の信頼区間
+ */
+void
+linkInterval(const struct link *lk, double *lo, double *hi)
+{
+	interval(linkErrors(lk), linkBits(lk), lk->confidence, lk->exact,
+			lo, hi);
+}
+
+/*
+ * ビット誤りの数
+ */
+size_t
+linkErrors(const struct link *lk)
+{
+	return lk->prbs != NULL ? lk->chk.errors : lk->al.errors;
+}
+
+/*
+ * 比べたビット数
+ */
+size_t
+linkBits(const struct link *lk)
+{
+	return lk->prbs != NULL ? lk->chk.bits : lk->al.bits;
+}
+
+/*
+ * 受け取れなかった文字数
+ */
+size_t
+lostBytes(const struct link *lk)
+{
+	/* 打ち切ったときは残りを送っていないので数えない */
+	if (lk->settled)
+		return 0;
+	if (lk->prbs != NULL)
+		return lk->nRead < lk->nByte ? lk->nByte - lk->nRead : 0;
+	return lk->al.pos < 2 * lk->nByte ? lk->nByte - lk->al.pos / 2 : 0;
+}
+
+/*
+ * 送受信機を閉じる
+ */
+void
+closeLink(struct link *lk)
+{
+	(void)close(lk->rfd);
+	(void)close(lk->tfd);
+}
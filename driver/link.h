@@ -0,0 +1,175 @@
+#ifndef LINK_H
+#define LINK_H	1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "align.h"
+#include "confidence.h"
+#include "prbs.h"
+#include "stats.h"
+
+/* 送信方式なしで 1 文字の送信にかかるチップ数（2 フレーム） */
+#define BYTE_CHIPS	32
+/* プリアンブル、レベルチェック及び送信方式のパターンの長さ（送信方式なしの文字数換算） */
+#define OVERHEAD	15
+/* 送信機のバッファに先行して詰めておく文字数（送信方式なしの文字数換算）の既定値 */
+#define LEAD		1024
+/* PRBS を生成してから書き込むまで保持しておく文字数 */
+#define PENDING		1024
+
+/*
+ * 送信機と受信機との対
+ */
+struct link {
+	/* デバイスファイルの名前及び記述子 */
+	const char *rname, *tname;
+	int rfd, tfd;
+	/* チップレート及び先行して詰めておく文字数（送信方式なしの文字数換算） */
+	unsigned long chipRate;
+	size_t lead;
+	/* 送信方式及び 1 文字の送信にかかるチップ数 */
+	const char *modes;
+	double byteChips;
+
+	enum {
+		LINK_START,	/* 送信機の応答を待っている */
+		LINK_RUNNING,	/* 送受信中 */
+		LINK_DRAIN,	/* 送信機が残りを送り終えるのを待っている */
+		LINK_DONE,	/* 終了した */
+	} state;
+
+	/*
+	 * 送信データ、送信済み文字数及び受信済み文字数
+	 * PRBS を使うときは tbuf を持たず、nByte が 0 なら終わりなく送る
+	 */
+	const uint8_t *tbuf;
+	size_t nByte, nWrite, nRead;
+	/* 送信データと受信データとの比較及びビット誤りの統計 */
+	struct aligner al;
+	struct stats st;
+
+	/* PRBS の名前（使わなければ NULL）、その生成器及び検査器 */
+	const char *prbs;
+	struct prbs gen, chk;
+	/* 生成したがまだ書き込めていない文字 */
+	uint8_t pending[PENDING];
+	size_t pendHead, pendLen;
+
+	/* 送信開始時刻、最終受信時刻及び最終報告時刻 */
+	struct timespec start, lastRecv, lastReport;
+	/* タイムアウトしたか */
+	int timedOut;
+
+	/*
+	 * 送信機が前の送信データを送っている途中か、チップレートを送ったか、
+	 * 及び前の送信データを送り終えるまでの見積もり時間（s）
+	 */
+	int busy, requested;
+	double drain;
+
+	/*
+	 * 打ち切る誤り率及び信頼区間の相対的な幅（いずれも 0 なら打ち切らない）、
+	 * 信頼水準及び Clopper-Pearson の信頼区間を使うか
+	 */
+	double target, width, confidence;
+	int exact;
+	/*
+	 * 信頼区間を調べた回数及び次に調べる比べたビット数、
+	 * 誤り率が目標を下回るか（1）上回るか（-1）、打ち切ることにしたか
+	 */
+	size_t looks, nextLook;
+	int verdict, settled;
+};
+
+/*
+ * 送受信機を開く
+ */
+void openLink(struct link *lk, const char *rname, const char *tname,
+		size_t lead);
+
+/*
+ * 送信データの代わりに PRBS（prbs7, prbs15, prbs23, prbs31）を使う
+ * 名前が PRBS でなければ -1 を返す
+ */
+int usePrbs(struct link *lk, const char *name);
+
+/*
+ * 送信方式（mode.h）をチップレートの後ろに付けて送信機に送る
+ * 知らない送信方式か、受信機の出力を比べられない送信方式（枠）なら -1 を返す
+ */
+int setMode(struct link *lk, const char *modes);
+
+/*
+ * 信頼区間の信頼水準及び種類（exact なら Clopper-Pearson、さもなくば Wilson）
+ */
+void setInterval(struct link *lk, double confidence, int exact);
+
+/*
+ * 誤り率が target を上回るか下回るかが決まるか、
+ * 信頼区間の幅が誤り率の width 倍以下になったら測定を打ち切るようにする
+ */
+void setTarget(struct link *lk, double target, double width);
+
+/*
+ * チップレート及び送信データを与えて送信を要求する
+ * PRBS を使うときは tbuf を NULL にする
+ * 送信機が前の送信データを送っている途中なら、送り終えるのを待ってから要求する
+ */
+void startLink(struct link *lk, unsigned long chipRate, const uint8_t *tbuf,
+		size_t nByte, const struct timespec *now);
+
+/*
+ * 送信機からの応答を処理する
+ */
+void readTransmitter(struct link *lk, const struct timespec *now);
+
+/*
+ * 受信機からの文字を受け取って比べる
+ */
+void readReceiver(struct link *lk, const struct timespec *now);
+
+/*
+ * 時間の経過を処理する（送信データを送り、タイムアウトを調べる）
+ */
+void tickLink(struct link *lk, const struct timespec *now);
+
+/*
+ * 送信機が残りを送り終えて '?' を返すのを待ち始める（送り終えていれば何もしない）
+ * 待たずに終えると、次に送るチップレートを送信機がデータとして送ってしまう
+ */
+void drainLink(struct link *lk, const struct timespec *now);
+
+/*
+ * 測定を終え、保留中の受信データを確定させる
+ */
+void stopLink(struct link *lk);
+
+/*
+ * 誤り率が目標を下回ると決まれば 1、上回ると決まれば -1、まだなら 0
+ */
+int linkVerdict(const struct link *lk);
+
+/*
+ * 誤り率の信頼区間
+ */
+void linkInterval(const struct link *lk, double *lo, double *hi);
+
+/*
+ * ビット誤りの数及び比べたビット数
+ */
+size_t linkErrors(const struct link *lk);
+size_t linkBits(const struct link *lk);
+
+/*
+ * 受け取れなかった文字数
+ */
+size_t lostBytes(const struct link *lk);
+
+/*
+ * 送受信機を閉じる
+ */
+void closeLink(struct link *lk);
+
+#endif	/* !LINK_H */
@@ -1,155 +1,483 @@
 #include <sys/types.h>
+#include <sys/epoll.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 
 #include <err.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <termios.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "link.h"
+
 #define MIN(a, b)	((a) < (b) ? (a) : (b))
+#define MAX(a, b)	((a) > (b) ? (a) : (b))
+
+/* 時間の経過を処理する間隔（ns） */
+#define TICK	10000000
+/* チップレートの探索を終える間隔（見つかったチップレートに対する割合の逆数） */
+#define RESOLUTION	32
+/* 探索中に先行して詰めておく時間（s の逆数）及び最小の文字数 */
+#define PROBE_LEAD	2
+#define PROBE_LEAD_MIN	64
+/* epoll で周期タイマを表す値（送受信機は対の番号の 2 倍に送信機なら 1 を足す） */
+#define EV_TIMER	UINT64_MAX
+/* 1 組の送受信機に与える引数の数 */
+#define LINK_ARGS	5
 
-static const size_t popTab[] = {
-	0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
-	1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-	1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-	2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-	1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-	2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-	2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-	3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-	1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-	2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-	2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-	3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-	2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-	3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-	3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-	4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8,
+/*
+ * 送受信機の対ごとの測定
+ */
+struct job {
+	struct link lk;
+	/* チップレート（探索するならその範囲）及びサンプルバイト数 */
+	unsigned long chipRate, maxRate;
+	size_t nByte;
+	/* 送信データ（PRBS なら NULL） */
+	uint8_t *tbuf;
 };
 
+/* 割り込まれたか */
+static volatile sig_atomic_t interrupted;
+/* epoll 及び周期タイマの記述子 */
+static int efd, tmfd;
+/* 打ち切る誤り率及び信頼区間の相対的な幅、信頼水準、Clopper-Pearson の信頼区間を使うか */
+static double target, width, confidence;
+static int exact;
+/* 送信方式 */
+static const char *modes = "";
+
+static void
+onSignal(int sig)
+{
+	(void)sig;
+	interrupted = 1;
+}
+
 static void
 usage(void)
 {
-	fprintf(stderr, "usage: driver receiver transmitter "
-			"random chip-rate nByte\n");
+	fprintf(stderr, "usage: driver [-v] [-c confidence] [-i cp|wilson] "
+			"[-m modes] [-t target-ber] [-w width]\n"
+			"              receiver transmitter "
+			"random|prbs7|prbs15|prbs23|prbs31\n"
+			"              chip-rate|min:max nByte ...\n");
 	exit(EXIT_FAILURE);
 }
 
-int
-main(int argc, char *argv[])
+/*
+ * 全ての送受信機と周期タイマとを監視し、全ての対が終わるまで処理する
+ */
+static void
+loop(struct job *jobs, size_t nJob)
 {
-	struct termios tos;
-	unsigned long chipRate;
-	ssize_t cnt, nByte, nRead, nWrite, tmp;
-	int rfd, tfd, xfd;
-	char *rbuf, *tbuf;
+	struct epoll_event evs[16];
+	struct timespec now;
+	struct link *lk;
+	uint64_t expirations;
+	size_t active;
+	int n;
 
-	/* 引数の数が合わなければ死ぬ */
-	if (argc != 6)
-		usage();
+	while (!interrupted) {
+		active = 0;
+		for (size_t j = 0; j < nJob; j++)
+			active += jobs[j].lk.state != LINK_DONE;
+		if (active == 0)
+			break;
 
-	/* 受信機側を開く */
-	rfd = open(argv[1], O_RDONLY | O_NOCTTY);
-	if (rfd == -1)
-		err(1, "%s", argv[1]);
-	/* 端末属性を取得する */
-	if (tcgetattr(rfd, &tos) == -1)
-		err(1, "%s", argv[1]);
-	/* RAW モードにする（XXX: 本来であれば復旧用を用意する） */
-	cfmakeraw(&tos);
-	/* 適用する（XXX: エラーチェックが雑） */
-	if (tcsetattr(rfd, TCSANOW, &tos) == -1)
-		err(1, "%s", argv[1]);
-
-	/* 送信機側を開く */
-	tfd = open(argv[2], O_WRONLY | O_NOCTTY);
-	if (tfd == -1)
-		err(1, "%s", argv[2]);
-	/* 端末属性を取得する */
-	if (tcgetattr(tfd, &tos) == -1)
-		err(1, "%s", argv[2]);
-	/* RAW モードにする（XXX: 本来であれば復旧用を用意する） */
-	cfmakeraw(&tos);
-	/* 適用する（XXX: エラーチェックが雑） */
-	if (tcsetattr(tfd, TCSANOW, &tos) == -1)
-		err(1, "%s", argv[2]);
+		n = epoll_wait(efd, evs, sizeof(evs) / sizeof(evs[0]), -1);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			err(1, "epoll_wait");
+		}
+		(void)clock_gettime(CLOCK_MONOTONIC, &now);
+		for (int i = 0; i < n; i++) {
+			if (evs[i].data.u64 == EV_TIMER) {
+				if (read(tmfd, &expirations,
+						sizeof(expirations)) == -1)
+					continue;
+				for (size_t j = 0; j < nJob; j++)
+					tickLink(&jobs[j].lk, &now);
+				continue;
+			}
+			lk = &jobs[evs[i].data.u64 >> 1].lk;
+			if (evs[i].data.u64 & 1)
+				readTransmitter(lk, &now);
+			else
+				readReceiver(lk, &now);
+		}
+	}
+}
 
-	/* 乱数デバイスを開く */
-	xfd = open(argv[3], O_RDONLY | O_NOCTTY);
-	if (xfd == -1)
-		err(1, "%s", argv[3]);
+/*
+ * 全ての測定が終わるまで送りながら受け取る
+ */
+static void
+run(struct job *jobs, size_t nJob)
+{
+	struct link *lk;
+
+	loop(jobs, nJob);
+	for (size_t j = 0; j < nJob; j++) {
+		lk = &jobs[j].lk;
+		stopLink(lk);
+		if (lk->timedOut)
+			warnx("%s: timed out, %zu bytes lost", lk->rname,
+					lostBytes(lk));
+	}
+}
+
+/*
+ * 打ち切った測定の残りを各送信機が送り終える（'?' を返す）のを待つ
+ * 次の実行が送るチップレートを、送信機がデータとして送らないようにする
+ * 待っている間にもう一度割り込まれたら、そのまま終わる
+ */
+static void
+settle(struct job *jobs, size_t nJob)
+{
+	struct timespec now;
+
+	(void)signal(SIGINT, SIG_DFL);
+	(void)signal(SIGTERM, SIG_DFL);
+	interrupted = 0;
+	(void)clock_gettime(CLOCK_MONOTONIC, &now);
+	for (size_t j = 0; j < nJob; j++)
+		drainLink(&jobs[j].lk, &now);
+	loop(jobs, nJob);
+}
+
+/*
+ * チップレート chipRate で測定し、誤り率が目標を下回ったか
+ * 目標の上か下かが決まらないまま終わったときや、
+ * 途中で受信が途切れたときは下回らなかったものとする
+ */
+static int
+probe(struct job *job, unsigned long chipRate)
+{
+	struct link *lk = &job->lk;
+	struct timespec now;
+	double lo, hi;
+	const char *result;
+	int verdict;
+
+	/* 探索中は送信機に残る文字が少なくなるように先行分を減らす */
+	lk->lead = MAX(PROBE_LEAD_MIN,
+			MIN(LEAD, chipRate / BYTE_CHIPS / PROBE_LEAD));
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &now);
+	startLink(lk, chipRate, job->tbuf, job->nByte, &now);
+	run(job, 1);
+
+	verdict = linkVerdict(lk);
+	if (linkBits(lk) == 0 || (lk->timedOut && lostBytes(lk) > 0))
+		result = "lost", verdict = -1;
+	else if (verdict > 0)
+		result = "pass";
+	else if (verdict < 0)
+		result = "fail";
+	else
+		result = "unsure";
+
+	/* チップレート、比べたビット数、誤りの数、誤り率及びその信頼区間、実効速度 */
+	const double ber = linkBits(lk) > 0
+			? (double)linkErrors(lk) / linkBits(lk) : 0.0;
+	linkInterval(lk, &lo, &hi);
+	(void)printf("%lu %zu %zu %g %g %g %g %s\n", chipRate, linkBits(lk),
+			linkErrors(lk), ber, lo, hi,
+			(double)chipRate * 8 / lk->byteChips * (1 - ber), result);
+	(void)fflush(stdout);
+
+	return verdict > 0;
+}
+
+/*
+ * 誤り率が目標を下回る最大のチップレートを探す
+ * 下限から倍々に上げて最初に下回らなくなるところを探し、その間を二分する
+ */
+static void
+search(struct job *job)
+{
+	unsigned long best, bad, rate;
 
-	/* チップレートを受けとる */
-	chipRate = strtoul(argv[4], NULL, 0);
-	if (chipRate < 1)
+	(void)printf("# chip-rate bits errors BER lower upper goodput result\n");
+
+	/* 大まかに探す */
+	best = 0;
+	bad = job->maxRate + 1;
+	for (rate = job->chipRate; !interrupted;
+			rate = MIN(2 * rate, job->maxRate)) {
+		if (!probe(job, rate)) {
+			bad = rate;
+			break;
+		}
+		best = rate;
+		if (rate == job->maxRate)
+			break;
+	}
+
+	/* 二分して詰める */
+	while (best > 0 && bad <= job->maxRate && !interrupted
+			&& bad - best > MAX(1, best / RESOLUTION)) {
+		rate = best + (bad - best) / 2;
+		if (probe(job, rate))
+			best = rate;
+		else
+			bad = rate;
+	}
+
+	if (best == 0)
+		(void)printf("# no chip-rate meets BER %g\n", job->lk.target);
+	else
+		(void)printf("# best %lu %g\n", best,
+				(double)best * 8 / job->lk.byteChips);
+}
+
+/*
+ * 1 組の送受信機の引数を受け取り、送信データを用意する
+ */
+static void
+prepare(struct job *job, char *argv[])
+{
+	ssize_t nRead, tmp;
+	int xfd;
+	char *endp;
+
+	/* チップレート（min:max なら探索する範囲）を受けとる */
+	job->chipRate = job->maxRate = strtoul(argv[3], &endp, 0);
+	if (*endp == ':')
+		job->maxRate = strtoul(endp + 1, NULL, 0);
+	if (job->chipRate < 1 || job->maxRate < job->chipRate)
 		errx(1, "chip-rate must be >0");
+	if (job->maxRate != job->chipRate && target == 0)
+		errx(1, "searching chip-rate requires -t");
+
+	/* 受信機側及び送信機側を開く */
+	openLink(&job->lk, argv[0], argv[1], LEAD);
+	setInterval(&job->lk, confidence, exact);
+	setTarget(&job->lk, target, width);
+	if (setMode(&job->lk, modes) == -1)
+		errx(1, "invalid modes");
 
-	/* サンプルバイト数を受け取るl */
-	nByte = strtoul(argv[5], NULL, 0);
-	if (nByte < 1)
+	/* サンプルバイト数を受け取る（PRBS なら 0 で終わりなく送る） */
+	job->nByte = strtoul(argv[4], NULL, 0);
+	job->tbuf = NULL;
+	if (usePrbs(&job->lk, argv[2]) == 0) {
+		if (job->nByte == 0 && job->maxRate != job->chipRate)
+			errx(1, "nByte must be >0");
+		return;
+	}
+	if (job->nByte < 1)
 		errx(1, "nByte must be >0");
 
-	/* 受信用バッファを確保する */
-	rbuf = malloc(nByte);
-	if (rbuf == NULL)
-		err(1, "malloc");
+	/* 乱数デバイスを開く */
+	xfd = open(argv[2], O_RDONLY | O_NOCTTY);
+	if (xfd == -1)
+		err(1, "%s", argv[2]);
 
 	/* 送信用バッファを確保する */
-	tbuf = malloc(nByte);
-	if (tbuf == NULL)
+	job->tbuf = malloc(job->nByte);
+	if (job->tbuf == NULL)
 		err(1, "malloc");
 
 	/* 送信用バッファに乱数を用意する */
 	nRead = 0;
 	do {
-		tmp = read(xfd, tbuf+nRead, nByte-nRead);
+		tmp = read(xfd, job->tbuf+nRead, job->nByte-nRead);
 		if (tmp == -1)
-			err(1, "read: %s", argv[3]);
+			err(1, "read: %s", argv[2]);
 		nRead += tmp;
-	} while (nRead != nByte);
+	} while ((size_t)nRead != job->nByte);
+	(void)close(xfd);
+}
 
-	/* 送信機にチップレートを送り付ける */
-	if (dprintf(tfd, "\r%lu\r", chipRate) < 0)
-		err(1, "dprintf: %s", argv[2]);
-	/* データを少しずつ送り付ける */
-	nWrite = 0;
-	do {
-		tmp = write(tfd, tbuf+nWrite, MIN(16, nByte-nWrite));
-		if (tmp == -1)
-			err(1, "write: %s:", argv[2]);
-		/* デバッグ用に表示しておく */
-		for (ssize_t i = nWrite; i < nWrite+tmp; i++) {
-			if ((i & 0xF) == 0)
-				(void)fprintf(stderr, "\n%06zX:", i);
-			(void)fprintf(stderr, " %02x", tbuf[i] & 0xFF);
+/*
+ * 1 組の送受信機の結果を表示する
+ * 誤り率は位置を合わせて（PRBS なら同期して）比べたビットの中でのもので、
+ * 挿入及び欠落（ニブル単位）や受け取れなかった文字は含めない
+ * 誤り率にはその信頼区間を添える
+ * 途中で打ち切ったときのサンプルバイト数は受け取った文字数とする
+ * PRBS では挿入及び欠落の代わりに同期外れの回数を表示する
+ */
+static void
+report(const struct job *job)
+{
+	const struct link *lk = &job->lk;
+	double lo, hi;
+
+	linkInterval(lk, &lo, &hi);
+	(void)printf("%lu %zu %zu %g %g %g %zu", job->chipRate,
+			lk->settled ? lk->nRead
+			: job->nByte > 0 ? job->nByte : lk->nWrite,
+			linkErrors(lk), linkBits(lk) > 0
+			? (double)linkErrors(lk) / linkBits(lk) : 0.0, lo, hi,
+			lostBytes(lk));
+	if (lk->prbs != NULL)
+		(void)printf(" %zu\n", lk->chk.losses);
+	else
+		(void)printf(" %zu %zu\n", lk->al.insertions,
+				lk->al.deletions);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct epoll_event ev;
+	struct itimerspec it;
+	struct job *jobs;
+	struct sigaction sa;
+	struct timespec now;
+	double lo, hi;
+	size_t bits, errors, lost, nJob;
+	int ch, verbose;
+
+	verbose = 0;
+	confidence = 0.95;
+	while ((ch = getopt(argc, argv, "c:i:m:t:vw:")) != -1) {
+		switch (ch) {
+		case 'c':
+			confidence = strtod(optarg, NULL);
+			if (confidence <= 0 || confidence >= 1)
+				errx(1, "confidence must be in (0, 1)");
+			break;
+		case 'i':
+			if (strcmp(optarg, "cp") == 0)
+				exact = 1;
+			else if (strcmp(optarg, "wilson") == 0)
+				exact = 0;
+			else
+				errx(1, "interval must be cp or wilson");
+			break;
+		case 'm':
+			modes = optarg;
+			break;
+		case 't':
+			target = strtod(optarg, NULL);
+			if (target <= 0 || target >= 0.5)
+				errx(1, "target-ber must be in (0, 0.5)");
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'w':
+			width = strtod(optarg, NULL);
+			if (width <= 0)
+				errx(1, "width must be >0");
+			break;
+		default:
+			usage();
 		}
-		nWrite += tmp;
-	} while (nWrite != nByte);
-	(void)fprintf(stderr, "\n%06zX\n", nWrite);
+	}
+	argc -= optind;
+	argv += optind;
 
-	/* 受信機からデータを受け取る */
-	nRead = 0;
-	do {
-		tmp = read(rfd, rbuf+nRead, nByte-nRead);
-		if (tmp == -1)
-			err(1, "read: %s", argv[1]);
-		/* デバッグ用の表示しておく */
-		for (ssize_t i = nRead; i < nRead+tmp; i++) {
-			if ((i & 0xF) == 0)
-				(void)fprintf(stderr, "\n%06zX:", i);
-			(void)fprintf(stderr, " %02x", rbuf[i] & 0xFF);
+	/* 引数の数が合わなければ死ぬ */
+	if (argc == 0 || argc % LINK_ARGS != 0)
+		usage();
+
+	/* 送受信機の対ごとに開き、送信データを用意する */
+	nJob = argc / LINK_ARGS;
+	jobs = calloc(nJob, sizeof(*jobs));
+	if (jobs == NULL)
+		err(1, "calloc");
+	for (size_t j = 0; j < nJob; j++) {
+		prepare(&jobs[j], argv + j * LINK_ARGS);
+		/* チップレートの範囲はどの対に与えられても探索になる */
+		if (nJob > 1 && jobs[j].maxRate != jobs[j].chipRate)
+			errx(1, "searching chip-rate requires a single link");
+	}
+
+	/* 割り込まれたら、そこまでの結果を表示して終わる */
+	sa.sa_handler = onSignal;
+	sa.sa_flags = 0;
+	(void)sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGINT, &sa, NULL) == -1
+			|| sigaction(SIGTERM, &sa, NULL) == -1)
+		err(1, "sigaction");
+
+	/* 全ての送受信機と周期タイマとを同時に監視する */
+	efd = epoll_create1(0);
+	if (efd == -1)
+		err(1, "epoll_create1");
+	tmfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (tmfd == -1)
+		err(1, "timerfd_create");
+	it.it_interval.tv_sec = it.it_value.tv_sec = 0;
+	it.it_interval.tv_nsec = it.it_value.tv_nsec = TICK;
+	if (timerfd_settime(tmfd, 0, &it, NULL) == -1)
+		err(1, "timerfd_settime");
+	ev.events = EPOLLIN;
+	for (size_t j = 0; j < nJob; j++) {
+		ev.data.u64 = j << 1;
+		if (epoll_ctl(efd, EPOLL_CTL_ADD, jobs[j].lk.rfd, &ev) == -1)
+			err(1, "epoll_ctl: %s", jobs[j].lk.rname);
+		ev.data.u64 = j << 1 | 1;
+		if (epoll_ctl(efd, EPOLL_CTL_ADD, jobs[j].lk.tfd, &ev) == -1)
+			err(1, "epoll_ctl: %s", jobs[j].lk.tname);
+	}
+	ev.data.u64 = EV_TIMER;
+	if (epoll_ctl(efd, EPOLL_CTL_ADD, tmfd, &ev) == -1)
+		err(1, "epoll_ctl: timerfd");
+
+	if (nJob == 1 && jobs[0].maxRate != jobs[0].chipRate) {
+		/* チップレートの範囲が与えられたら、誤り率が目標を下回る最大のものを探す */
+		search(&jobs[0]);
+	}
+	else {
+		/* 各送信機にチップレートを送り、全ての対で同時に送りながら受け取る */
+		(void)clock_gettime(CLOCK_MONOTONIC, &now);
+		for (size_t j = 0; j < nJob; j++)
+			startLink(&jobs[j].lk, jobs[j].chipRate, jobs[j].tbuf,
+					jobs[j].nByte, &now);
+		run(jobs, nJob);
+
+		/*
+		 * 結果を表示する
+		 * 複数の対を測ったときは、各行の先頭に対の番号を付け、
+		 * 最後に全体の比べたビット数、誤りの数、誤り率及びその信頼区間、
+		 * 失った文字数を付ける
+		 */
+		bits = errors = lost = 0;
+		for (size_t j = 0; j < nJob; j++) {
+			if (nJob > 1)
+				(void)printf("%zu ", j);
+			report(&jobs[j]);
+			bits += linkBits(&jobs[j].lk);
+			errors += linkErrors(&jobs[j].lk);
+			lost += lostBytes(&jobs[j].lk);
 		}
-		nRead += tmp;
-	} while (nRead != nByte);
-	(void)fprintf(stderr, "\n%06zX\n", nWrite);
-
-	/* ビット誤りを数えて結果を表示する */
-	cnt = 0;
-	for (ssize_t i = 0; i < nByte; i++)
-		cnt += popTab[(tbuf[i] ^ rbuf[i]) & 0xFF];
-	(void)printf("%lu %zd %zd %f\n", chipRate, nByte, cnt, cnt/8.0/nByte);
+		interval(errors, bits, confidence, exact, &lo, &hi);
+		if (nJob > 1)
+			(void)printf("total %zu %zu %g %g %g %zu\n", bits,
+					errors, bits > 0
+					? (double)errors / bits : 0.0, lo, hi,
+					lost);
+	}
+
+	/* 層、符号及びビット位置ごとの誤りや誤りの塊の分布を書き出す */
+	for (size_t j = 0; j < nJob && verbose; j++) {
+		if (nJob > 1)
+			(void)fprintf(stderr, "# %zu: %s\n", j,
+					jobs[j].lk.rname);
+		printStats(&jobs[j].lk.st, stderr);
+	}
+
+	/* 結果を書き出してから、送信機が空くのを待って閉じる */
+	(void)fflush(stdout);
+	settle(jobs, nJob);
+	for (size_t j = 0; j < nJob; j++) {
+		closeLink(&jobs[j].lk);
+		free(jobs[j].tbuf);
+	}
+	free(jobs);
+	(void)close(tmfd);
+	(void)close(efd);
 
 	return 0;
 }
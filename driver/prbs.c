@@ -0,0 +1,145 @@
+#include <string.h>
+
+#include "prbs.h"
+
+/* 同期したとみなすまでに連続して予測が当たるべきビット数（p に足す） */
+#define LOCK_MARGIN	64
+/* 同期外れを判定するブロックの長さ及び誤りの数（ランダムなら半分が誤る） */
+#define BLOCK_BITS	256
+#define BLOCK_ERRORS	(BLOCK_BITS / 4)
+
+/*
+ * 各系列の遅延（ITU-T O.150 の多項式 x^p + x^q + 1）
+ */
+static const struct {
+	const char *name;
+	unsigned p, q;
+} polys[] = {
+	{ "prbs7",  7,  6 },
+	{ "prbs15", 15, 14 },
+	{ "prbs23", 23, 18 },
+	{ "prbs31", 31, 28 },
+};
+
+/*
+ * 名前で生成器または検査器を初期化する
+ */
+int
+initPrbs(struct prbs *g, const char *name)
+{
+	for (size_t i = 0; i < sizeof(polys) / sizeof(polys[0]); i++) {
+		if (strcmp(name, polys[i].name) != 0)
+			continue;
+		memset(g, 0, sizeof(*g));
+		g->p = polys[i].p;
+		g->q = polys[i].q;
+		g->reg = ~(uint64_t)0;
+		return 0;
+	}
+
+	return -1;
+}
+
+/*
+ * 直近の系列から次の c bit（c <= q）を予測する
+ * c <= q なので、予測する各ビットは既知のビットだけから決まる
+ */
+static uint64_t
+predict(const struct prbs *g, unsigned c)
+{
+	return ((g->reg >> (64 - g->p)) ^ (g->reg >> (64 - g->q)))
+			& (((uint64_t)1 << c) - 1);
+}
+
+/*
+ * 系列に c bit を追加する
+ */
+static void
+shiftIn(struct prbs *g, uint64_t b, unsigned c)
+{
+	g->reg = g->reg >> c | b << (64 - c);
+}
+
+/*
+ * 系列を n 文字生成する
+ */
+void
+generatePrbs(struct prbs *g, uint8_t *buf, size_t n)
+{
+	while (n > 0) {
+		/* 最大 64 bit ずつ、q bit ごとに生成する */
+		const unsigned nbits = n >= 8 ? 64 : n * 8;
+		uint64_t w = 0;
+		for (unsigned i = 0; i < nbits; ) {
+			const unsigned c = nbits - i < g->q ? nbits - i : g->q;
+			const uint64_t b = predict(g, c);
+			shiftIn(g, b, c);
+			w |= b << i;
+			i += c;
+		}
+		for (unsigned j = 0; j < nbits / 8; j++)
+			*buf++ = w >> 8 * j;
+		n -= nbits / 8;
+	}
+}
+
+/*
+ * 受信した n 文字を検査する
+ */
+void
+checkPrbs(struct prbs *g, const uint8_t *buf, size_t n)
+{
+	while (n > 0) {
+		/* 最大 64 bit ずつ読み込む */
+		const unsigned nbits = n >= 8 ? 64 : n * 8;
+		uint64_t w = 0;
+		for (unsigned j = 0; j < nbits / 8; j++)
+			w |= (uint64_t)*buf++ << 8 * j;
+		n -= nbits / 8;
+
+		/* 同期して比べたビット及びその誤りを統計に渡す */
+		uint64_t diff = 0, valid = 0;
+		for (unsigned i = 0; i < nbits; ) {
+			const unsigned c = nbits - i < g->q ? nbits - i : g->q;
+			const uint64_t m = ((uint64_t)1 << c) - 1;
+			const uint64_t r = w >> i & m;
+			const uint64_t b = predict(g, c);
+			const unsigned at = i;
+			i += c;
+
+			if (!g->locked) {
+				/* 受信した系列を読み込み、予測が当たり続けたら同期する */
+				shiftIn(g, r, c);
+				g->skipped += c;
+				g->run = b == r ? g->run + c : 0;
+				if (g->run >= g->p + LOCK_MARGIN) {
+					g->locked = 1;
+					g->blockBits = g->blockErrors = 0;
+				}
+				continue;
+			}
+
+			/* 自分で生成した系列と比べる */
+			const size_t e = __builtin_popcountll(b ^ r);
+			shiftIn(g, b, c);
+			g->bits += c;
+			g->errors += e;
+			diff |= (b ^ r) << at;
+			valid |= m << at;
+
+			/* 誤りが多すぎれば同期を外す */
+			g->blockBits += c;
+			g->blockErrors += e;
+			if (g->blockBits < BLOCK_BITS)
+				continue;
+			if (g->blockErrors > BLOCK_ERRORS) {
+				g->locked = 0;
+				g->run = 0;
+				g->losses++;
+			}
+			g->blockBits = g->blockErrors = 0;
+		}
+		if (g->st != NULL && valid != 0)
+			addErrors(g->st, diff, valid);
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef PRBS_H
+#define PRBS_H	1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stats.h"
+
+/*
+ * 擬似ランダム・ビット系列（PRBS）の生成器及び検査器
+ *
+ * 系列は s[k] = s[k-p] ^ s[k-q] で、各文字の LSB から順に詰める。
+ * 検査器は受信した系列から状態を読み込んで同期し、以降は自分で生成した
+ * 系列と比べるので、ビット誤りを 1 対 1 に数えられる。
+ * 誤りが多すぎれば同期を外して読み込み直す。
+ */
+struct prbs {
+	/* 直近 64 bit の系列（最新が MSB） */
+	uint64_t reg;
+	/* 系列の遅延 p, q（p > q） */
+	unsigned p, q;
+
+	/* 同期しているか、同期していないときに連続して予測が当たったビット数 */
+	int locked;
+	size_t run;
+	/* 同期外れを判定するためのブロック内のビット数及び誤りの数 */
+	size_t blockBits, blockErrors;
+
+	/* 比べたビット数、ビット誤りの数、同期外れの回数及び同期待ちのビット数 */
+	size_t bits, errors, losses, skipped;
+	/* ビット誤りの統計（NULL なら取らない） */
+	struct stats *st;
+};
+
+/*
+ * 名前（prbs7, prbs15, prbs23, prbs31）で生成器または検査器を初期化する
+ * 名前が PRBS でなければ -1 を返す
+ */
+int initPrbs(struct prbs *g, const char *name);
+
+/*
+ * 系列を n 文字生成する
+ */
+void generatePrbs(struct prbs *g, uint8_t *buf, size_t n);
+
+/*
+ * 受信した n 文字を検査する
+ */
+void checkPrbs(struct prbs *g, const uint8_t *buf, size_t n);
+
+#endif	/* !PRBS_H */
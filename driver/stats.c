@@ -0,0 +1,196 @@
+#include <string.h>
+
+#include "stats.h"
+
+/* 各文字の LSB */
+#define LANES	0x0101010101010101ULL
+
+/*
+ * n を含む階級（[2^c, 2^(c+1)) の c、ただし n == 0 は 0 に含める）
+ */
+static unsigned
+classOf(size_t n)
+{
+	unsigned c;
+
+	for (c = 0; n > 1 && c < CLASSES - 1; c++)
+		n >>= 1;
+	return c;
+}
+
+/*
+ * 今の塊を閉じる
+ */
+static void
+closeBurst(struct stats *st)
+{
+	st->bursts[classOf(st->lastError - st->burstStart + 1)]++;
+	st->inBurst = 0;
+}
+
+/*
+ * 今のブロックを閉じる（誤りの無いブロックを 0 番目の階級にする）
+ */
+static void
+closeBlock(struct stats *st)
+{
+	const size_t e = st->blockErrors;
+
+	st->blocks[e > 0 ? 1 + classOf(e) - (classOf(e) == CLASSES - 1) : 0]++;
+	st->blockSum += e;
+	st->blockSumSq += (double)e * e;
+	st->nBlocks++;
+	st->blockErrors = 0;
+	st->blockEnd += BLOCK_LEN;
+}
+
+/*
+ * 統計を初期化する
+ */
+void
+initStats(struct stats *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->blockEnd = BLOCK_LEN;
+}
+
+/*
+ * 比べたビットを加える
+ */
+void
+addErrors(struct stats *st, uint64_t diff, uint64_t valid)
+{
+	/* 文字のビット位置ごとに数える（8 文字を一度に） */
+	for (unsigned k = 0; k < 8; k++) {
+		st->posBits[k] += valid == ~(uint64_t)0 ? 8
+				: __builtin_popcountll(valid & LANES << k);
+		if (diff != 0)
+			st->posErrors[k] += __builtin_popcountll(diff
+					& valid & LANES << k);
+	}
+
+	/* 誤りを 1 つずつ塊及びブロックに振り分ける */
+	diff &= valid;
+	while (diff != 0) {
+		const unsigned i = __builtin_ctzll(diff);
+		const size_t pos = st->bits + __builtin_popcountll(valid
+				& (((uint64_t)1 << i) - 1));
+		diff &= diff - 1;
+
+		while (pos >= st->blockEnd)
+			closeBlock(st);
+		st->blockErrors++;
+		st->errors++;
+
+		if (st->inBurst && pos - st->lastError > BURST_GAP)
+			closeBurst(st);
+		if (!st->inBurst) {
+			st->inBurst = 1;
+			st->burstStart = pos;
+		}
+		st->lastError = pos;
+	}
+
+	st->bits += __builtin_popcountll(valid);
+	while (st->bits >= st->blockEnd)
+		closeBlock(st);
+}
+
+/*
+ * 途中の塊を閉じる
+ */
+void
+finishStats(struct stats *st)
+{
+	if (st->inBurst)
+		closeBurst(st);
+}
+
+/*
+ * 誤り率
+ */
+static double
+rate(size_t errors, size_t bits)
+{
+	return bits > 0 ? (double)errors / bits : 0.0;
+}
+
+/*
+ * 分布を書き出す（zero なら 0 番目の階級を 0 だけのものとする）
+ */
+static void
+printClasses(FILE *fp, const char *name, const size_t *n, int zero)
+{
+	unsigned last;
+
+	for (last = CLASSES; last > 1 && n[last - 1] == 0; last--)
+		;
+	(void)fprintf(fp, "%s", name);
+	for (unsigned c = 0; c < last; c++) {
+		const unsigned e = zero ? c - 1 : c;
+		if (zero && c == 0)
+			(void)fprintf(fp, " 0:%zu", n[c]);
+		else if (c == CLASSES - 1)
+			(void)fprintf(fp, " %zu-:%zu", (size_t)1 << e, n[c]);
+		else if (e == 0)
+			(void)fprintf(fp, " 1:%zu", n[c]);
+		else
+			(void)fprintf(fp, " %zu-%zu:%zu", (size_t)1 << e,
+					((size_t)2 << e) - 1, n[c]);
+	}
+	(void)fprintf(fp, "\n");
+}
+
+/*
+ * 統計を書き出す
+ */
+void
+printStats(const struct stats *st, FILE *fp)
+{
+	(void)fprintf(fp, "total: bits %zu errors %zu BER %g\n",
+			st->bits, st->errors, rate(st->errors, st->bits));
+
+	/* 層及び符号ごと（ビット位置 k と k + 4 とを合わせる） */
+	for (unsigned k = 0; k < 4; k++) {
+		const size_t b = st->posBits[k] + st->posBits[k + 4];
+		const size_t e = st->posErrors[k] + st->posErrors[k + 4];
+		(void)fprintf(fp, "layer %u code %u: bits %zu errors %zu"
+				" BER %g\n", (k >> 1) + 1, (k & 1) + 1, b, e,
+				rate(e, b));
+	}
+
+	/* 層ごと */
+	for (unsigned l = 0; l < 2; l++) {
+		size_t b = 0, e = 0;
+		for (unsigned k = 0; k < 8; k++)
+			if ((k >> 1 & 1) == l) {
+				b += st->posBits[k];
+				e += st->posErrors[k];
+			}
+		(void)fprintf(fp, "layer %u: bits %zu errors %zu BER %g\n",
+				l + 1, b, e, rate(e, b));
+	}
+
+	/* 文字のビット位置ごと */
+	(void)fprintf(fp, "bit errors:");
+	for (unsigned k = 0; k < 8; k++)
+		(void)fprintf(fp, " %zu", st->posErrors[k]);
+	(void)fprintf(fp, "\n");
+
+	/* 塊の長さ及びブロック内の誤りの数の分布 */
+	printClasses(fp, "burst lengths:", st->bursts, 0);
+	printClasses(fp, "block errors:", st->blocks, 1);
+
+	/*
+	 * 誤りの集まり具合
+	 * 誤りが独立なら、ブロック内の誤りの数の分散と平均との比はおよそ 1 で、
+	 * 時間的に集まっているほど大きくなる
+	 */
+	if (st->nBlocks > 0 && st->blockSum > 0) {
+		const double mean = st->blockSum / st->nBlocks;
+		const double var = st->blockSumSq / st->nBlocks - mean * mean;
+		(void)fprintf(fp, "blocks: %zu of %d bits, %zu errored,"
+				" dispersion %g\n", st->nBlocks, BLOCK_LEN,
+				st->nBlocks - st->blocks[0], var / mean);
+	}
+}
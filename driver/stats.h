@@ -0,0 +1,59 @@
+#ifndef STATS_H
+#define STATS_H	1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* 塊とみなすビット誤りの間隔（これだけ誤りが無ければ塊が終わる） */
+#define BURST_GAP	16
+/* 誤りの集まり具合を調べるブロックの長さ（bit） */
+#define BLOCK_LEN	8192
+/* 塊の長さ及びブロック内の誤りの数の分布の階級数（2 の冪ごと） */
+#define CLASSES		16
+
+/*
+ * ビット誤りの統計
+ *
+ * 受信機は 1 フレームを i22 i12 i21 i11 の 4 bit（ニブル）に復号するので、
+ * 文字のビット位置 k は第 (k & 2 ? 2 : 1) 層の第 (k & 1 ? 2 : 1) 符号に当たる。
+ * 比べたビットは、誤ったビットを 1 とした 64 bit の語で受け取る。
+ */
+struct stats {
+	/* 比べたビット数及びビット誤りの数（文字のビット位置ごとも） */
+	size_t bits, errors;
+	size_t posBits[8], posErrors[8];
+
+	/* 塊の長さ（bit）の分布、今の塊の始まり及び最後の誤りの位置 */
+	size_t bursts[CLASSES];
+	size_t burstStart, lastError;
+	int inBurst;
+
+	/* ブロック内の誤りの数の分布、その和及び二乗和、今のブロック */
+	size_t blocks[CLASSES];
+	double blockSum, blockSumSq;
+	size_t nBlocks, blockEnd, blockErrors;
+};
+
+/*
+ * 統計を初期化する
+ */
+void initStats(struct stats *st);
+
+/*
+ * 比べたビットを加える
+ * diff は誤ったビット、valid は比べたビット（いずれも文字の LSB から順に詰める）
+ */
+void addErrors(struct stats *st, uint64_t diff, uint64_t valid);
+
+/*
+ * 途中の塊を閉じる（途中のブロックは捨てる）
+ */
+void finishStats(struct stats *st);
+
+/*
+ * 統計を書き出す
+ */
+void printStats(const struct stats *st, FILE *fp);
+
+#endif	/* !STATS_H */
@@ -1,15 +1,108 @@
-#define _XOPEN_SOURCE	600
+#define _GNU_SOURCE
+#include <sys/types.h>
+
 #include <err.h>
+#include <errno.h>
 #include <fcntl.h>
-#include <pthread.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "chips.h"
+#include "lz.h"
+#include "mode.h"
+
+/*
+ * An event-driven emulator of a pair of transmitter and receiver.
+ *
+ * The emulator runs on a virtual clock.  The transmitter side speaks the
+ * real transmitter protocol (prompt '?', a chip rate terminated by '\r',
+ * optionally followed by mode letters, echo "<rate><modes>!", then data
+ * until its buffer drains) and models its buffer depth and the preamble
+ * overhead.  The modes only change how many words each byte takes, except
+ * that the receiver side inflates compressed blocks ('z') and that
+ * pre-encoded words ('r') are decoded back to bytes on arrival.  Each byte
+ * reaches the receiver side when the transmitter would have finished
+ * sending it, optionally with injected errors.
+ *
+ * The virtual clock runs at `scale' times the wall clock.  With a scale
+ * of 0, it jumps to the next event whenever the driver is quiet, i.e., as
+ * fast as the driver can keep up.  The driver is given IDLE_NS of wall
+ * time to respond to what the emulator has written to it, and STARVE_NS
+ * to refill the transmitter's buffer before it drains and ends a burst.
+ */
+
+typedef uint64_t vtime_t;
+
+#define GIGA		1000000000ULL
+#define IDLE_NS		100000ULL
+#define STARVE_NS	50000000ULL
+#define NEVER		UINT64_MAX
+
+/* the transmitter's buffer (in words) and its framing */
+#define BUFLEN		3600
+#define WORD_CHIPS	16
+/* preamble (8 words), level check (16 words) and mode (6 words) */
+#define OVERHEAD	30
+/* the fewest words per byte, which sizes the byte ring */
+#define BYTE_WORDS	1
+
+#define LINELEN		16
+#define OUTLEN		4096
+
+struct transmitter {
+	enum { TX_PROMPT, TX_RATE, TX_SENDING } state;
+	char line[LINELEN];
+	size_t lineLen;
+	unsigned long chipRate;
+	uint8_t mode;
+	/* the words in the buffer: overhead words, then byteWords per byte */
+	size_t overhead, byteWords;
+	uint8_t bytes[BUFLEN / BYTE_WORDS];
+	size_t head, nBytes;
+	/* the pre-encoded words of the byte being received from the driver */
+	uint8_t raw[RAW_FRAME * FEC_FRAMES];
+	size_t rawLen;
+	/* how many words of the head byte have been sent */
+	size_t halves;
+	/* when the word being sent finishes */
+	vtime_t wordEnd;
+};
+
+struct receiver {
+	/* whether the receiver failed to acquire this burst */
+	int missed;
+	/* the nibble waiting for its pair, or -1 */
+	int half;
+	/* whether to inflate what is received, and the inflater */
+	int inflate;
+	struct lz lz;
+	/* the bytes waiting to be written to the pseudo-terminal */
+	uint8_t out[OUTLEN];
+	size_t outHead, outLen;
+};
+
+struct stats {
+	vtime_t start;
+	size_t sent, overflows, errors, dropped, slips;
+};
+
+/* the emulation parameters */
+static double ber = 0, missRate = 0, slipRate = 0;
+static double scale = 1;
+
+static vtime_t vnow = 0;
+/* whether the driver has something new to respond to */
+static int written = 0;
+
 static int
-openPseudoTerminal(int flags, FILE *fpv[2])
+openPseudoTerminal(int flags)
 {
-	FILE *rfp, *wfp;
 	int ptm;
 
 	/* open a pseudo-terminal */
@@ -25,74 +118,301 @@ openPseudoTerminal(int flags, FILE *fpv[2])
 	if (unlockpt(ptm) == -1)
 		return -1;
 
-	/* associate a readable stream with the pseudo-terminal */
-	rfp = fdopen(ptm, "r");
-	if (rfp == NULL)
-		return -1;
-	setbuf(rfp, NULL);
+	return ptm;
+}
 
-	/* associate a writable stream with the pseudo-terminal */
-	wfp = fdopen(ptm, "w");
-	if (wfp == NULL)
-		return -1;
-	setbuf(wfp, NULL);
+static vtime_t
+wallClock(void)
+{
+	struct timespec ts;
 
-	/* set FILE pointers */
-	fpv[0] = rfp;
-	fpv[1] = wfp;
-	return ptm;
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (vtime_t)ts.tv_sec * GIGA + ts.tv_nsec;
 }
 
-static char *
-getLine(char *buf, size_t len, FILE *fp)
+static double
+uniform(void)
 {
-	size_t i;
-	int c;
+	return (random() + 0.5) / ((double)RAND_MAX + 1);
+}
 
-	for (i = 0; i < len-1; i++) {
-		c = getc(fp);
-		if (c == EOF && i == 0)
-			return NULL;
-		buf[i] = c;
-		if (c == EOF || c == '\r' || c == '\n')
-			break;
+/* the duration of a word at the given chip rate */
+static vtime_t
+wordTime(unsigned long chipRate)
+{
+	return WORD_CHIPS * GIGA / chipRate;
+}
+
+static size_t
+bufferedWords(const struct transmitter *tx)
+{
+	return tx->overhead + tx->nBytes * tx->byteWords - tx->halves;
+}
+
+static void
+writeTo(int fd, const char *s)
+{
+	if (write(fd, s, strlen(s)) == -1 && errno != EAGAIN && errno != EIO)
+		err(1, "write");
+	written = 1;
+}
+
+/* queue a decoded byte, inflating it if asked to */
+static void
+queue(struct receiver *rx, struct stats *st, uint8_t c)
+{
+	uint8_t buf[LZ_MATCH_MAX];
+	size_t i, n;
+
+	n = 1;
+	buf[0] = c;
+	if (rx->inflate)
+		n = feedLz(&rx->lz, c, buf);
+	for (i = 0; i < n; i++)
+		if (rx->outLen == OUTLEN)
+			st->dropped++;
+		else
+			rx->out[(rx->outHead + rx->outLen++) % OUTLEN] =
+					buf[i];
+}
+
+/* queue a nibble, pairing them into bytes as the receiver does */
+static void
+receiveNibble(struct receiver *rx, struct stats *st, int nibble)
+{
+	if (rx->half < 0) {
+		rx->half = nibble;
+		return;
 	}
-	buf[i] = 0;
 
-	return buf;
+	queue(rx, st, rx->half | nibble << 4);
+	rx->half = -1;
+	written = 1;
 }
 
-struct context {
-	FILE *fp;
-	volatile size_t bufTail;
-	char *buf;
-};
+/* queue a byte to the receiver's pseudo-terminal */
+static void
+receive(struct receiver *rx, struct stats *st, uint8_t c)
+{
+	if (rx->missed) {
+		st->dropped++;
+		return;
+	}
+
+	/* flip each bit with probability ber */
+	if (ber > 0)
+		for (int i = 0; i < 8; i++)
+			if (uniform() < ber) {
+				c ^= 1 << i;
+				st->errors++;
+			}
+
+	/* lose or add a nibble with probability slipRate each */
+	for (int i = 0; i < 2; i++) {
+		const int nibble = c >> 4 * i & 0x0F;
+		if (slipRate > 0 && uniform() < slipRate) {
+			st->slips++;
+			if (random() & 1)
+				continue;
+			receiveNibble(rx, st, random() & 0x0F);
+		}
+		receiveNibble(rx, st, nibble);
+	}
+}
+
+static void
+startBurst(struct transmitter *tx, struct receiver *rx, struct stats *st)
+{
+	tx->state = TX_SENDING;
+	tx->overhead = OVERHEAD;
+	tx->byteWords = modeByteFrames(tx->mode);
+	tx->head = tx->nBytes = tx->halves = tx->rawLen = 0;
+	tx->wordEnd = vnow + wordTime(tx->chipRate);
+	rx->missed = missRate > 0 && uniform() < missRate;
+	rx->half = -1;
+	rx->inflate = (tx->mode & MODE_COMPRESS) && !(tx->mode & MODE_FRAMED);
+	initLz(&rx->lz);
+	memset(st, 0, sizeof(*st));
+	st->start = vnow;
+}
+
+static void
+endBurst(struct transmitter *tx, struct stats *st)
+{
+	(void)fprintf(stderr, "burst: rate=%lu bytes=%zu time=%.3f"
+			" overflows=%zu errors=%zu slips=%zu dropped=%zu\n",
+			tx->chipRate, st->sent, (double)(vnow - st->start) / GIGA,
+			st->overflows, st->errors, st->slips, st->dropped);
+	tx->state = TX_PROMPT;
+}
 
-static void *
-getter(void *arg)
+/* decode the pre-encoded words of a byte as the receiver would */
+static uint8_t
+decodeRaw(const uint8_t *raw, uint8_t mode)
 {
-	struct context *ctx = (struct context *)arg;
-	int c;
+	uint8_t b[FEC_FRAMES];
+	uint32_t corrected, failed, w[2];
+	uint16_t p[2];
+	int best, d, dist, nb;
 
-	while ((c = getc(ctx->fp)) != EOF)
-		ctx->buf[ctx->bufTail++] = c;
+	for (size_t k = 0; k < modeByteFrames(mode); k++) {
+		for (size_t j = 0; j < 2; j++) {
+			w[j] = 0;
+			for (size_t i = 0; i < 4; i++)
+				w[j] |= (uint32_t)raw[RAW_FRAME * k + 4 * j + i]
+						<< 8 * i;
+		}
+		/* the nearest pattern wins, like the correlator */
+		best = 0;
+		dist = INT_MAX;
+		nb = mode & MODE_WALSH ? 256 : 16;
+		for (int v = 0; v < nb; v++) {
+			frameToChips(v, mode, p);
+			d = __builtin_popcount(w[0] ^ chipsToPattern(p[0]))
+				+ __builtin_popcount(w[1] ^ chipsToPattern(p[1]));
+			if (d < dist) {
+				best = v;
+				dist = d;
+			}
+		}
+		b[k] = best;
+	}
+	if (mode & MODE_WALSH)
+		return mode & MODE_FEC
+			? fecDecodeWalsh(b, &corrected, &failed) : b[0];
+	if (mode & MODE_FEC)
+		return fecDecode(b, &corrected, &failed);
+
+	return b[0] | b[1] << 4;
+}
+
+/* handle a byte from the driver to the transmitter */
+static void
+transmit(struct transmitter *tx, struct receiver *rx, struct stats *st,
+		int txptm, uint8_t c)
+{
+	char *endp, buf[32];
+
+	switch (tx->state) {
+	case TX_PROMPT:
+	case TX_RATE:
+		/* same as getLine() and strtoul() of the transmitter */
+		if (c != '\r' && tx->lineLen < LINELEN - 1) {
+			tx->line[tx->lineLen++] = c;
+			break;
+		}
+		tx->line[tx->lineLen] = '\0';
+		tx->lineLen = 0;
+		tx->chipRate = strtoul(tx->line, &endp, 0);
+		if (parseMode(endp, &tx->mode) == -1 || tx->chipRate == 0) {
+			tx->state = TX_PROMPT;
+			break;
+		}
+		(void)snprintf(buf, sizeof(buf), "%lu%s!", tx->chipRate, endp);
+		writeTo(txptm, buf);
+		startBurst(tx, rx, st);
+		break;
+	case TX_SENDING:
+		/* pre-encoded words make a byte once all of its frames arrive */
+		if (tx->mode & MODE_RAW) {
+			tx->raw[tx->rawLen++] = c;
+			if (tx->rawLen < RAW_FRAME * tx->byteWords)
+				break;
+			tx->rawLen = 0;
+			c = decodeRaw(tx->raw, tx->mode);
+		}
+		/* the transmitter does not check for overflow */
+		if (bufferedWords(tx) + tx->byteWords > BUFLEN - 1) {
+			st->overflows++;
+			break;
+		}
+		tx->bytes[(tx->head + tx->nBytes++) % (BUFLEN / BYTE_WORDS)] = c;
+		break;
+	}
+}
+
+/* send words up to the virtual time */
+static void
+advance(struct transmitter *tx, struct receiver *rx, struct stats *st)
+{
+	while (tx->state == TX_SENDING && tx->wordEnd <= vnow) {
+		/* the transmitter stops when its buffer drains */
+		if (bufferedWords(tx) == 0) {
+			endBurst(tx, st);
+			break;
+		}
+
+		if (tx->overhead > 0) {
+			tx->overhead--;
+		} else if (++tx->halves == tx->byteWords) {
+			receive(rx, st, tx->bytes[tx->head]);
+			tx->head = (tx->head + 1) % (BUFLEN / BYTE_WORDS);
+			tx->nBytes--;
+			tx->halves = 0;
+			st->sent++;
+		}
+		tx->wordEnd += wordTime(tx->chipRate);
+	}
+}
 
-	return NULL;
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: stub [-e ber] [-m miss] [-r seed] [-s slip]"
+			" [-x scale]\n");
+	exit(1);
 }
 
 int
-main(void)
+main(int argc, char *argv[])
 {
-	struct context ctx;
-	pthread_t thread;
-	FILE *rxfpv[2], *txfpv[2];
-	useconds_t period;
-	unsigned long chipRate;
-	int rxptm, txptm;
-	char *tmp, buf[1024];
+	struct pollfd fds[2];
+	struct timespec ts;
+	struct receiver rx;
+	struct stats st;
+	struct transmitter tx;
+	vtime_t next, wall0, v0;
+	ssize_t n;
+	vtime_t timeout;
+	int c, rxptm, txptm;
+	char *endp, *tmp, buf[1024];
+
+	while ((c = getopt(argc, argv, "e:m:r:s:x:")) != -1)
+		switch (c) {
+		case 'e':
+			ber = strtod(optarg, &endp);
+			if (ber < 0 || ber > 1 || *endp != '\0')
+				errx(1, "invalid bit error rate");
+			break;
+		case 'm':
+			missRate = strtod(optarg, &endp);
+			if (missRate < 0 || missRate > 1 || *endp != '\0')
+				errx(1, "invalid miss rate");
+			break;
+		case 'r':
+			srandom(strtoul(optarg, &endp, 0));
+			if (*endp != '\0')
+				errx(1, "invalid seed");
+			break;
+		case 's':
+			slipRate = strtod(optarg, &endp);
+			if (slipRate < 0 || slipRate > 1 || *endp != '\0')
+				errx(1, "invalid slip rate");
+			break;
+		case 'x':
+			scale = strtod(optarg, &endp);
+			if (scale < 0 || *endp != '\0')
+				errx(1, "invalid scale");
+			break;
+		case '?':
+		default:
+			usage();
+		}
+	if (optind != argc)
+		usage();
 
 	/* open a pseudo-terminal that acts as a receiver */
-	rxptm = openPseudoTerminal(O_RDWR | O_NOCTTY, rxfpv);
+	rxptm = openPseudoTerminal(O_RDWR | O_NOCTTY | O_NONBLOCK);
 	if (rxptm == -1)
 		err(1, "openPseudoTerminal: (receiver)");
 
@@ -103,7 +423,7 @@ main(void)
 	fprintf(stderr, "receiver: %s\n", tmp);
 
 	/* open a pseudo-terminal that acts as a transmitter */
-	txptm = openPseudoTerminal(O_RDWR | O_NOCTTY, txfpv);
+	txptm = openPseudoTerminal(O_RDWR | O_NOCTTY | O_NONBLOCK);
 	if (txptm == -1)
 		err(1, "openPseudoTerminal: (transmitter)");
 
@@ -113,28 +433,93 @@ main(void)
 		err(1, "ptsname: (transmitter)");
 	fprintf(stderr, "transmitter: %s\n", tmp);
 
+	memset(&tx, 0, sizeof(tx));
+	memset(&rx, 0, sizeof(rx));
+	memset(&st, 0, sizeof(st));
+	tx.state = TX_PROMPT;
+	wall0 = wallClock();
+	v0 = 0;
+
 	/* emulate the behaviour of a pair of receiver and transmitter */
 	for (;;) {
-		do {
-			(void)fprintf(txfpv[1], "?");
-			if (getLine(buf, sizeof(buf), txfpv[0]) == NULL)
-				err(1, "getLine: (transmitter)");
-			chipRate = strtoul(buf, &tmp, 0);
-		} while (*tmp != '\0' || chipRate == 0);
-		(void)fprintf(txfpv[1], "%lu!", chipRate);
-
-		ctx.fp = txfpv[0];
-		ctx.buf = buf;
-		ctx.bufTail = 0;
-		(void)pthread_create(&thread, NULL, getter, &ctx);
-
-		period = 1000000. / chipRate;
-		usleep(period * 52);	/* delay due to the preamble */
-		for (size_t i = 0; i < ctx.bufTail; i++) {
-			(void)putc(buf[i], rxfpv[1]);
-			usleep(period * 4);
-		}
-		(void)pthread_cancel(thread);
+		/* the transmitter prompts when it is idle */
+		if (tx.state == TX_PROMPT) {
+			writeTo(txptm, "?");
+			tx.state = TX_RATE;
+		}
+
+		/* wait for the driver or the next event */
+		next = tx.state == TX_SENDING ? tx.wordEnd : NEVER;
+		if (next == NEVER)
+			timeout = NEVER;
+		else if (scale == 0 && bufferedWords(&tx) == 0)
+			timeout = STARVE_NS;
+		else if (scale == 0)
+			timeout = written ? IDLE_NS : 0;
+		else if (next <= vnow)
+			timeout = 0;
+		else
+			timeout = (next - vnow) / scale;
+		written = 0;
+		ts.tv_sec = timeout / GIGA;
+		ts.tv_nsec = timeout % GIGA;
+		fds[0].fd = txptm;
+		fds[0].events = POLLIN;
+		fds[1].fd = rxptm;
+		fds[1].events = POLLIN | (rx.outLen > 0 ? POLLOUT : 0);
+		if (ppoll(fds, 2, timeout != NEVER ? &ts : NULL, NULL) == -1) {
+			if (errno == EINTR)
+				continue;
+			err(1, "poll");
+		}
+
+		/* bring the virtual clock forward */
+		if (scale > 0) {
+			vnow = v0 + (wallClock() - wall0) * scale;
+		} else if (((fds[0].revents | fds[1].revents) & POLLIN) == 0) {
+			vnow = next != NEVER ? next : vnow;
+		}
+		if (scale == 0) {
+			/* keep the wall clock origin for a later scale */
+			wall0 = wallClock();
+			v0 = vnow;
+		}
+		advance(&tx, &rx, &st);
+
+		/* take what the driver has written to the transmitter */
+		if (fds[0].revents & POLLIN) {
+			n = read(txptm, buf, sizeof(buf));
+			if (n == -1 && errno != EAGAIN && errno != EIO)
+				err(1, "read: (transmitter)");
+			for (ssize_t i = 0; i < n; i++)
+				transmit(&tx, &rx, &st, txptm, buf[i]);
+		}
+
+		/* discard commands to the receiver */
+		if (fds[1].revents & POLLIN) {
+			n = read(rxptm, buf, sizeof(buf));
+			if (n == -1 && errno != EAGAIN && errno != EIO)
+				err(1, "read: (receiver)");
+		}
+
+		/* hand the received bytes to the driver */
+		while (rx.outLen > 0) {
+			const size_t len = rx.outHead + rx.outLen > OUTLEN
+					? OUTLEN - rx.outHead : rx.outLen;
+			n = write(rxptm, rx.out + rx.outHead, len);
+			if (n == -1) {
+				if (errno == EAGAIN || errno == EIO)
+					break;
+				err(1, "write: (receiver)");
+			}
+			rx.outHead = (rx.outHead + n) % OUTLEN;
+			rx.outLen -= n;
+		}
+
+		/* a hang-up leaves POLLHUP set; do not spin on it */
+		if ((fds[0].revents | fds[1].revents) & POLLHUP
+				&& next == NEVER)
+			(void)usleep(10000);
 	}
 	/* NOTREACHED */
 
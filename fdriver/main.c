@@ -0,0 +1,497 @@
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/select.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "fountain.h"
+#include "packet.h"
+
+/* シンボルの最大の長さ */
+#define SYMBOL_MAX	(FOUNTAIN_HEADER + 65535 + FOUNTAIN_TRAILER)
+
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+#define MAX(a, b)	((a) > (b) ? (a) : (b))
+
+/*
+ * 受信機
+ */
+struct rx {
+	const char *name;
+	int fd;			/* 読み終えたら -1 */
+	uint8_t *buf;		/* 読み込んだがまだシンボルにしていない文字 */
+	size_t len;
+	struct packet pk;	/* 枠を切り分ける状態 */
+	size_t packets, badPackets;	/* 受け取った枠及び CRC の合わなかった枠の数 */
+	/* 受け取ったシンボル、CRC の合わなかったシンボル、別のファイルのシンボル及び読み飛ばした文字の数 */
+	size_t symbols, bad, foreign, skipped;
+};
+
+/*
+ * まだ解けていないシンボル
+ */
+struct symbol {
+	uint8_t *data;		/* 既知のブロックを除いた中身 */
+	uint32_t *nb;		/* 未知のブロックの番号 */
+	uint32_t nNb;
+};
+
+/*
+ * ブロックを含むまだ解けていないシンボルの番号の並び
+ */
+struct refs {
+	uint32_t *v;
+	size_t n, cap;
+};
+
+/* 受け取っているファイル（locked が立つまでは決まっていない） */
+static int locked;
+static struct fountain fs;
+/* 解けたブロック、解けたかどうか及び解けた数 */
+static uint8_t *blocks, *known;
+static uint32_t nKnown;
+/* まだ解けていないシンボル及びブロックごとのその番号 */
+static struct symbol *syms;
+static size_t nSyms, capSyms;
+static struct refs *refs;
+/* 近傍及び解けたブロックの待ち行列の作業用 */
+static uint32_t *idx, *queue;
+/* 受け取ったシンボル及び何も増やさなかったシンボルの数 */
+static size_t received, redundant;
+
+/* 受信機が枠（送信方式 'p'）で出力する */
+static int framed;
+
+static volatile sig_atomic_t interrupted;
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: fdriver [-p] receiver ...\n");
+	exit(EXIT_FAILURE);
+}
+
+static void
+handler(int sig)
+{
+	(void)sig;
+	interrupted = 1;
+}
+
+/*
+ * 書き出す
+ */
+static void
+output(const uint8_t *p, size_t n)
+{
+	ssize_t bytes;
+
+	while (n > 0) {
+		bytes = write(STDOUT_FILENO, p, n);
+		if (bytes == -1) {
+			if (errno == EINTR)
+				continue;
+			err(EXIT_FAILURE, "stdout");
+		}
+		p += bytes;
+		n -= bytes;
+	}
+}
+
+/*
+ * 最初に受け取ったシンボルのファイルを受け取る準備をする
+ */
+static void
+lock(uint32_t id, uint32_t length, uint16_t symlen)
+{
+	if (initFountain(&fs, length, symlen, id) == -1)
+		err(EXIT_FAILURE, "initFountain");
+	blocks = calloc(fs.k, symlen);
+	known = calloc(fs.k, 1);
+	refs = calloc(fs.k, sizeof(*refs));
+	idx = malloc(fs.k * sizeof(*idx));
+	queue = malloc(fs.k * sizeof(*queue));
+	if (blocks == NULL || known == NULL || refs == NULL || idx == NULL
+			|| queue == NULL)
+		err(EXIT_FAILURE, "malloc");
+	locked = 1;
+}
+
+/*
+ * a に b を排他的論理和する
+ */
+static void
+xor(uint8_t *a, const uint8_t *b, size_t n)
+{
+	while (n-- > 0)
+		*a++ ^= *b++;
+}
+
+/*
+ * ブロック b が解けたら、それを含むシンボルから取り除き、
+ * 未知のブロックが 1 つだけになったシンボルを解いていく（ピーリング）
+ */
+static void
+solve(uint32_t b, const uint8_t *data)
+{
+	struct symbol *s;
+	struct refs *r;
+	size_t i, nq;
+	uint32_t j;
+
+	if (known[b])
+		return;
+	memcpy(blocks + (size_t)b * fs.symlen, data, fs.symlen);
+	known[b] = 1;
+	nKnown++;
+	queue[0] = b;
+	nq = 1;
+
+	while (nq > 0) {
+		b = queue[--nq];
+		r = &refs[b];
+		for (i = 0; i < r->n; i++) {
+			s = &syms[r->v[i]];
+			if (s->nNb == 0)
+				continue;
+			xor(s->data, blocks + (size_t)b * fs.symlen, fs.symlen);
+			for (j = 0; j < s->nNb; j++)
+				if (s->nb[j] == b) {
+					s->nb[j] = s->nb[--s->nNb];
+					break;
+				}
+			if (s->nNb != 1)
+				continue;
+
+			/* 残りの 1 つが解けた */
+			j = s->nb[0];
+			s->nNb = 0;
+			if (!known[j]) {
+				memcpy(blocks + (size_t)j * fs.symlen, s->data,
+						fs.symlen);
+				known[j] = 1;
+				nKnown++;
+				queue[nq++] = j;
+			}
+			free(s->data);
+			free(s->nb);
+		}
+		free(r->v);
+		r->v = NULL;
+		r->n = r->cap = 0;
+	}
+}
+
+/*
+ * 受け取ったシンボルを加える
+ */
+static void
+deliver(uint32_t esi, const uint8_t *payload)
+{
+	struct symbol *s;
+	struct refs *r;
+	uint8_t *data;
+	size_t d, i, n;
+
+	received++;
+	data = malloc(fs.symlen);
+	if (data == NULL)
+		err(EXIT_FAILURE, "malloc");
+	memcpy(data, payload, fs.symlen);
+
+	/* 既知のブロックを取り除く */
+	d = fountainNeighbours(&fs, esi, idx);
+	for (n = i = 0; i < d; i++)
+		if (known[idx[i]])
+			xor(data, blocks + (size_t)idx[i] * fs.symlen,
+					fs.symlen);
+		else
+			idx[n++] = idx[i];
+
+	if (n == 0) {
+		redundant++;
+		free(data);
+		return;
+	}
+	if (n == 1) {
+		solve(idx[0], data);
+		free(data);
+		return;
+	}
+
+	/* 解けるまで取っておく */
+	if (nSyms == capSyms) {
+		capSyms = MAX(2 * capSyms, 64);
+		syms = realloc(syms, capSyms * sizeof(*syms));
+		if (syms == NULL)
+			err(EXIT_FAILURE, "realloc");
+	}
+	s = &syms[nSyms];
+	s->data = data;
+	s->nNb = n;
+	s->nb = malloc(n * sizeof(*s->nb));
+	if (s->nb == NULL)
+		err(EXIT_FAILURE, "malloc");
+	memcpy(s->nb, idx, n * sizeof(*s->nb));
+	for (i = 0; i < n; i++) {
+		r = &refs[idx[i]];
+		if (r->n == r->cap) {
+			r->cap = MAX(2 * r->cap, 4);
+			r->v = realloc(r->v, r->cap * sizeof(*r->v));
+			if (r->v == NULL)
+				err(EXIT_FAILURE, "realloc");
+		}
+		r->v[r->n++] = nSyms;
+	}
+	nSyms++;
+}
+
+/*
+ * 受信機から読み込んだ文字をシンボルに切り分ける
+ * ヘッダか中身が壊れていれば 1 文字ずつ読み飛ばして印を探し直す
+ */
+static void
+parse(struct rx *r)
+{
+	uint32_t esi, id, length;
+	uint16_t symlen;
+	size_t off, size;
+
+	off = 0;
+	while (r->len - off >= FOUNTAIN_HEADER
+			&& !(locked && nKnown == fs.k)) {
+		if (getFountainHeader(r->buf + off, &id, &length, &symlen,
+				&esi) == -1 || length == 0 || symlen == 0) {
+			off++;
+			r->skipped++;
+			continue;
+		}
+		if (locked && (id != fs.id || length != fs.length
+				|| symlen != fs.symlen)) {
+			off++;
+			r->foreign++;
+			r->skipped++;
+			continue;
+		}
+		size = FOUNTAIN_HEADER + (size_t)symlen + FOUNTAIN_TRAILER;
+		if (r->len - off < size)
+			break;
+		if (checkFountain(r->buf + off, symlen) == -1) {
+			off++;
+			r->bad++;
+			r->skipped++;
+			continue;
+		}
+		if (!locked)
+			lock(id, length, symlen);
+		deliver(esi, r->buf + off + FOUNTAIN_HEADER);
+		r->symbols++;
+		off += size;
+	}
+	memmove(r->buf, r->buf + off, r->len - off);
+	r->len -= off;
+}
+
+/*
+ * 受信機から最大 n 文字を読み込んで buf に付け足す（read(2) の結果を返す）
+ * 枠にしているなら、CRC の合った枠の中身だけを付け足す
+ */
+static ssize_t
+readReceiver(struct rx *r, size_t n)
+{
+	uint8_t raw[BUFSIZ];
+	ssize_t bytes, i;
+
+	if (!framed) {
+		bytes = read(r->fd, r->buf + r->len, n);
+		if (bytes > 0)
+			r->len += bytes;
+		return bytes;
+	}
+
+	bytes = read(r->fd, raw, MIN(n, sizeof(raw)));
+	for (i = 0; i < bytes; i++)
+		switch (feedPacket(&r->pk, raw[i])) {
+		case PACKET_GOOD:
+			memcpy(r->buf + r->len, r->pk.data, r->pk.len);
+			r->len += r->pk.len;
+			r->packets++;
+			break;
+		case PACKET_BAD:
+			r->badPackets++;
+			break;
+		}
+
+	return bytes;
+}
+
+/*
+ * 受信機を開く
+ */
+static void
+openReceiver(struct rx *r)
+{
+	struct termios tos;
+
+	if (strcmp(r->name, "-") == 0) {
+		r->name = "stdin";
+		r->fd = STDIN_FILENO;
+	} else {
+		r->fd = open(r->name, O_RDONLY | O_NOCTTY);
+		if (r->fd == -1)
+			err(EXIT_FAILURE, "%s", r->name);
+	}
+	/* 端末なら RAW モードにする（XXX） */
+	if (isatty(r->fd)) {
+		if (tcgetattr(r->fd, &tos) == -1)
+			err(EXIT_FAILURE, "%s", r->name);
+		cfmakeraw(&tos);
+		if (tcsetattr(r->fd, TCSANOW, &tos) == -1)
+			err(EXIT_FAILURE, "%s", r->name);
+	}
+	/* 枠にしているなら、読み込みの途中の枠の分を余分に確保する */
+	r->buf = malloc(SYMBOL_MAX + (framed ? PACKET_MAX : 0));
+	huntPacket(&r->pk);
+	if (r->buf == NULL)
+		err(EXIT_FAILURE, "malloc");
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sigaction sa;
+	struct rx *r, *rx;
+	fd_set rfds;
+	size_t i, n;
+	ssize_t bytes;
+	int c, done, live, nfds;
+
+	while ((c = getopt(argc, argv, "p")) != -1)
+		switch (c) {
+		case 'p':
+			framed = 1;
+			break;
+		case '?':
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc == 0)
+		usage();
+	n = argc;
+
+	/* 受信機を開く */
+	rx = calloc(n, sizeof(*rx));
+	if (rx == NULL)
+		err(EXIT_FAILURE, "calloc");
+	for (i = 0; i < n; i++) {
+		rx[i].name = argv[i];
+		openReceiver(&rx[i]);
+	}
+
+	/* 割り込まれたらそこまでの結果を書き出して終わる */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handler;
+	(void)sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGINT, &sa, NULL) == -1
+			|| sigaction(SIGTERM, &sa, NULL) == -1)
+		err(EXIT_FAILURE, "sigaction");
+
+	/* 全てのブロックが解けるまで受け取る */
+	while (!interrupted && !(locked && nKnown == fs.k)) {
+		/* 全ての受信機を同時に監視する */
+		FD_ZERO(&rfds);
+		nfds = 0;
+		for (live = 0, i = 0; i < n; i++)
+			if (rx[i].fd != -1) {
+				FD_SET(rx[i].fd, &rfds);
+				nfds = MAX(nfds, rx[i].fd + 1);
+				live++;
+			}
+		if (live == 0)
+			break;
+		if (select(nfds, &rfds, NULL, NULL, NULL) == -1) {
+			if (errno == EINTR)
+				continue;
+			err(EXIT_FAILURE, "select");
+		}
+
+		/* 受信機から読み込んでシンボルに切り分ける */
+		for (i = 0; i < n; i++) {
+			r = &rx[i];
+			if (r->fd == -1 || !FD_ISSET(r->fd, &rfds))
+				continue;
+			bytes = readReceiver(r, SYMBOL_MAX - r->len);
+			if (bytes <= 0) {
+				if (bytes == -1)
+					warn("%s", r->name);
+				if (r->fd != STDIN_FILENO)
+					(void)close(r->fd);
+				r->fd = -1;
+				continue;
+			}
+			parse(r);
+		}
+	}
+
+	/* 解けたら元のファイルを確かめて書き出す */
+	done = locked && nKnown == fs.k;
+	if (done) {
+		if (fountainCrc(0, blocks, fs.length) != fs.id) {
+			warnx("CRC mismatch");
+			done = 0;
+		} else {
+			output(blocks, fs.length);
+		}
+	}
+
+	/* 結果を書き出す */
+	for (i = 0; i < n; i++) {
+		fprintf(stderr, "%s: symbols %zu bad %zu foreign %zu"
+				" skipped %zu", rx[i].name, rx[i].symbols,
+				rx[i].bad, rx[i].foreign, rx[i].skipped);
+		if (framed)
+			fprintf(stderr, " packets %zu bad %zu",
+					rx[i].packets, rx[i].badPackets);
+		fputc('\n', stderr);
+	}
+	fprintf(stderr, "total: blocks %lu/%lu symbols %zu redundant %zu"
+			" overhead %.3f\n", (unsigned long)nKnown,
+			(unsigned long)fs.k, received, redundant,
+			fs.k > 0 ? (double)received / fs.k : 0.0);
+
+	for (i = 0; i < n; i++) {
+		if (rx[i].fd != -1 && rx[i].fd != STDIN_FILENO)
+			(void)close(rx[i].fd);
+		free(rx[i].buf);
+	}
+	free(rx);
+	for (i = 0; i < nSyms; i++)
+		if (syms[i].nNb > 0) {
+			free(syms[i].data);
+			free(syms[i].nb);
+		}
+	free(syms);
+	if (locked) {
+		for (i = 0; i < fs.k; i++)
+			free(refs[i].v);
+		freeFountain(&fs);
+	}
+	free(refs);
+	free(blocks);
+	free(known);
+	free(idx);
+	free(queue);
+
+	return done ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,497 @@
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/select.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "packet.h"
+#include "stripe.h"
+
+#define GIGA	1000000000
+/* 並べ替えのために保持する塊の数 */
+#define WINDOW	1024
+/*
+ * これだけ受け取らなければ、その受信機は途切れたとみなす（秒）
+ * tdriver は 5 秒応答しない送信機を外して送りかけの塊を他の送信機で送り直すが、
+ * 送り直す塊（バッファ 1 つ分まで）はその送信機のバッファの後に届くので、
+ * 5 秒とバッファ 2 つ分を送り出す時間（既定の 1024 文字を 9600 チップ/秒で約 6.8 秒）より
+ * 長く待たなければ送り直された塊を欠けたものとしてしまう
+ */
+#define TIMEOUT	15
+
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+#define MAX(a, b)	((a) > (b) ? (a) : (b))
+
+/*
+ * 受信機
+ */
+struct rx {
+	const char *name;
+	int fd;			/* 読み終えたら -1 */
+	uint8_t *buf;		/* 読み込んだがまだ塊にしていない文字 */
+	size_t len;
+	struct packet pk;	/* 枠を切り分ける状態 */
+	size_t packets, badPackets;	/* 受け取った枠及び CRC の合わなかった枠の数 */
+	int seen;		/* 塊を受け取ったことがある */
+	uint32_t last;		/* 受け取った最も大きな通し番号 */
+	struct timespec heard;	/* 最後に読み込んだ時刻 */
+	size_t chunks, skipped;	/* 受け取った塊の数及び読み飛ばした文字数 */
+};
+
+/*
+ * 並べ替え中の塊
+ */
+struct slot {
+	int present;
+	uint32_t seq;
+	size_t len;
+	uint8_t *data;
+	uint32_t gone;		/* 最後に書き出したか欠けたものとした通し番号 */
+	int missed;		/* それを欠けたものとした */
+};
+
+/* 保持している塊、次に書き出す通し番号及び保持している塊の数 */
+static struct slot *slots;
+static size_t window, chunklen, held;
+static uint32_t next;
+/* 書き出した塊、欠けた塊、欠けたものとした後に届いた塊及び重複した塊の数 */
+static size_t written, lost, late, duplicates;
+
+/* 受信機が枠（送信方式 'p'）で出力する */
+static int framed;
+
+static volatile sig_atomic_t interrupted;
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: rdriver [-p] [-c chunklen] [-t timeout]"
+			" [-w window] receiver ...\n");
+	exit(EXIT_FAILURE);
+}
+
+static void
+handler(int sig)
+{
+	(void)sig;
+	interrupted = 1;
+}
+
+/*
+ * 時刻の差（秒）
+ */
+static double
+elapsed(const struct timespec *from, const struct timespec *to)
+{
+	return (double)(to->tv_sec - from->tv_sec)
+			+ (double)(to->tv_nsec - from->tv_nsec) / GIGA;
+}
+
+/*
+ * 通し番号の差（一周しても比べられるように）
+ */
+static int32_t
+distance(uint32_t from, uint32_t to)
+{
+	return (int32_t)(to - from);
+}
+
+/*
+ * 書き出す
+ */
+static void
+output(const uint8_t *p, size_t n)
+{
+	ssize_t bytes;
+
+	while (n > 0) {
+		bytes = write(STDOUT_FILENO, p, n);
+		if (bytes == -1) {
+			if (errno == EINTR)
+				continue;
+			err(EXIT_FAILURE, "stdout");
+		}
+		p += bytes;
+		n -= bytes;
+	}
+}
+
+/*
+ * 次の通し番号の塊を書き出して（無ければ欠けたものとして）進む
+ */
+static void
+step(void)
+{
+	struct slot *s = &slots[next % window];
+
+	if (s->present && s->seq == next) {
+		output(s->data, s->len);
+		s->present = 0;
+		held--;
+		written++;
+		s->missed = 0;
+	} else {
+		lost++;
+		s->missed = 1;
+	}
+	s->gone = next;
+	next++;
+}
+
+/*
+ * 続いている塊を書き出す
+ */
+static void
+flush(void)
+{
+	struct slot *s;
+
+	for (;;) {
+		s = &slots[next % window];
+		if (!s->present || s->seq != next)
+			break;
+		step();
+	}
+}
+
+/*
+ * 受け取った塊を並べ替えに加える
+ */
+static void
+deliver(uint32_t seq, const uint8_t *data, size_t len)
+{
+	struct slot *s;
+	size_t i, n;
+
+	/* 既に書き出したか欠けたものとしたなら捨てる */
+	if (distance(next, seq) < 0) {
+		s = &slots[seq % window];
+		if (s->gone == seq && s->missed)
+			late++;
+		else
+			duplicates++;
+		return;
+	}
+
+	/* 保持しきれなければ、欠けたものとして先に進む */
+	for (i = 0; i < window && (size_t)distance(next, seq) >= window; i++)
+		step();
+	if ((size_t)distance(next, seq) >= window) {
+		n = distance(next, seq) - window + 1;
+		lost += n;
+		for (i = 0; i < MIN(n, window); i++) {
+			s = &slots[(seq - window - i) % window];
+			s->gone = seq - window - i;
+			s->missed = 1;
+		}
+		next = seq - window + 1;
+	}
+
+	s = &slots[seq % window];
+	if (s->present && s->seq == seq) {
+		duplicates++;
+		return;
+	}
+	s->present = 1;
+	s->seq = seq;
+	s->len = len;
+	memcpy(s->data, data, len);
+	held++;
+	flush();
+}
+
+/*
+ * 受信機から読み込んだ文字を塊に切り分ける
+ * ヘッダが壊れていれば 1 文字ずつ読み飛ばして印を探し直す
+ */
+static void
+parse(struct rx *r)
+{
+	uint32_t seq;
+	uint16_t len;
+	size_t off;
+
+	off = 0;
+	while (r->len - off >= STRIPE_HEADER) {
+		if (getStripeHeader(r->buf + off, &seq, &len) == -1
+				|| len > chunklen) {
+			off++;
+			r->skipped++;
+			continue;
+		}
+		if (r->len - off < STRIPE_HEADER + (size_t)len)
+			break;
+		deliver(seq, r->buf + off + STRIPE_HEADER, len);
+		if (!r->seen || distance(r->last, seq) > 0)
+			r->last = seq;
+		r->seen = 1;
+		r->chunks++;
+		off += STRIPE_HEADER + len;
+	}
+	memmove(r->buf, r->buf + off, r->len - off);
+	r->len -= off;
+}
+
+/*
+ * 受信機がもう次の通し番号の塊を送ってこないか
+ * 各受信機は通し番号の順に受け取るので、それより先の塊を受け取っていれば来ない
+ */
+static int
+passed(const struct rx *r, const struct timespec *now, double timeout)
+{
+	return r->fd == -1 || elapsed(&r->heard, now) >= timeout
+			|| (r->seen && distance(next, r->last) > 0);
+}
+
+/*
+ * どの受信機からも来ない塊を欠けたものとして先に進む
+ */
+static void
+skip(struct rx *rx, size_t n, const struct timespec *now, double timeout)
+{
+	size_t i;
+
+	while (held > 0) {
+		for (i = 0; i < n; i++)
+			if (!passed(&rx[i], now, timeout))
+				return;
+		step();
+		flush();
+	}
+}
+
+/*
+ * 受信機から最大 n 文字を読み込んで buf に付け足す（read(2) の結果を返す）
+ * 枠にしているなら、CRC の合った枠の中身だけを付け足す
+ */
+static ssize_t
+readReceiver(struct rx *r, size_t n)
+{
+	uint8_t raw[BUFSIZ];
+	ssize_t bytes, i;
+
+	if (!framed) {
+		bytes = read(r->fd, r->buf + r->len, n);
+		if (bytes > 0)
+			r->len += bytes;
+		return bytes;
+	}
+
+	bytes = read(r->fd, raw, MIN(n, sizeof(raw)));
+	for (i = 0; i < bytes; i++)
+		switch (feedPacket(&r->pk, raw[i])) {
+		case PACKET_GOOD:
+			memcpy(r->buf + r->len, r->pk.data, r->pk.len);
+			r->len += r->pk.len;
+			r->packets++;
+			break;
+		case PACKET_BAD:
+			r->badPackets++;
+			break;
+		}
+
+	return bytes;
+}
+
+/*
+ * 受信機を開く
+ */
+static void
+openReceiver(struct rx *r)
+{
+	struct termios tos;
+
+	if (strcmp(r->name, "-") == 0) {
+		r->name = "stdin";
+		r->fd = STDIN_FILENO;
+	} else {
+		r->fd = open(r->name, O_RDONLY | O_NOCTTY);
+		if (r->fd == -1)
+			err(EXIT_FAILURE, "%s", r->name);
+	}
+	/* 端末なら RAW モードにする（XXX） */
+	if (isatty(r->fd)) {
+		if (tcgetattr(r->fd, &tos) == -1)
+			err(EXIT_FAILURE, "%s", r->name);
+		cfmakeraw(&tos);
+		if (tcsetattr(r->fd, TCSANOW, &tos) == -1)
+			err(EXIT_FAILURE, "%s", r->name);
+	}
+	/* 枠にしているなら、読み込みの途中の枠の分を余分に確保する */
+	r->buf = malloc(STRIPE_HEADER + chunklen + (framed ? PACKET_MAX : 0));
+	huntPacket(&r->pk);
+	if (r->buf == NULL)
+		err(EXIT_FAILURE, "malloc");
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sigaction sa;
+	struct timespec now;
+	struct timeval tv, *tvp;
+	struct rx *r, *rx;
+	fd_set rfds;
+	size_t i, n;
+	ssize_t bytes;
+	double timeout, d;
+	int c, live, nfds;
+	char *endp;
+
+	chunklen = STRIPE_CHUNK;
+	timeout = TIMEOUT;
+	window = WINDOW;
+	while ((c = getopt(argc, argv, "c:pt:w:")) != -1)
+		switch (c) {
+		case 'c':
+			chunklen = strtoul(optarg, &endp, 0);
+			if (chunklen == 0 || chunklen > STRIPE_MAX
+					|| *endp != '\0')
+				errx(EXIT_FAILURE, "invalid chunk length");
+			break;
+		case 'p':
+			framed = 1;
+			break;
+		case 't':
+			timeout = strtod(optarg, &endp);
+			if (!(timeout > 0) || *endp != '\0')
+				errx(EXIT_FAILURE, "invalid timeout");
+			break;
+		case 'w':
+			window = strtoul(optarg, &endp, 0);
+			if (window == 0 || window > INT32_MAX || *endp != '\0')
+				errx(EXIT_FAILURE, "invalid window");
+			break;
+		case '?':
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc == 0)
+		usage();
+	n = argc;
+
+	/* 並べ替えの場所を確保する */
+	slots = calloc(window, sizeof(*slots));
+	if (slots == NULL)
+		err(EXIT_FAILURE, "calloc");
+	for (i = 0; i < window; i++) {
+		slots[i].data = malloc(chunklen);
+		if (slots[i].data == NULL)
+			err(EXIT_FAILURE, "malloc");
+	}
+
+	/* 受信機を開く */
+	rx = calloc(n, sizeof(*rx));
+	if (rx == NULL)
+		err(EXIT_FAILURE, "calloc");
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	for (i = 0; i < n; i++) {
+		rx[i].name = argv[i];
+		rx[i].heard = now;
+		openReceiver(&rx[i]);
+	}
+
+	/* 割り込まれたらそこまでを書き出して終わる */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handler;
+	(void)sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGINT, &sa, NULL) == -1
+			|| sigaction(SIGTERM, &sa, NULL) == -1)
+		err(EXIT_FAILURE, "sigaction");
+
+	while (!interrupted) {
+		/* 全ての受信機を同時に監視する */
+		FD_ZERO(&rfds);
+		nfds = 0;
+		for (live = 0, i = 0; i < n; i++)
+			if (rx[i].fd != -1) {
+				FD_SET(rx[i].fd, &rfds);
+				nfds = MAX(nfds, rx[i].fd + 1);
+				live++;
+			}
+		if (live == 0)
+			break;
+
+		/* 塊が欠けていれば、受信機が途切れたとみなす時刻に起きる */
+		tvp = NULL;
+		if (held > 0) {
+			d = timeout;
+			for (i = 0; i < n; i++)
+				if (!passed(&rx[i], &now, timeout))
+					d = MIN(d, elapsed(&now, &rx[i].heard)
+							+ timeout);
+			d = MAX(d, 0);
+			tv.tv_sec = (time_t)d;
+			tv.tv_usec = (suseconds_t)((d - (time_t)d) * 1000000) + 1;
+			tvp = &tv;
+		}
+		if (select(nfds, &rfds, NULL, NULL, tvp) == -1) {
+			if (errno == EINTR)
+				continue;
+			err(EXIT_FAILURE, "select");
+		}
+		if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+			err(EXIT_FAILURE, "clock_gettime");
+
+		/* 受信機から読み込んで塊に切り分ける */
+		for (i = 0; i < n; i++) {
+			r = &rx[i];
+			if (r->fd == -1 || !FD_ISSET(r->fd, &rfds))
+				continue;
+			bytes = readReceiver(r,
+					STRIPE_HEADER + chunklen - r->len);
+			if (bytes <= 0) {
+				if (bytes == -1)
+					warn("%s", r->name);
+				if (r->fd != STDIN_FILENO)
+					(void)close(r->fd);
+				r->fd = -1;
+				continue;
+			}
+			r->heard = now;
+			parse(r);
+		}
+
+		skip(rx, n, &now, timeout);
+	}
+
+	/* 残りを書き出す */
+	while (held > 0) {
+		step();
+		flush();
+	}
+
+	/* 結果を書き出す */
+	for (i = 0; i < n; i++) {
+		fprintf(stderr, "%s: chunks %zu skipped %zu",
+				rx[i].name, rx[i].chunks, rx[i].skipped);
+		if (framed)
+			fprintf(stderr, " packets %zu bad %zu",
+					rx[i].packets, rx[i].badPackets);
+		fputc('\n', stderr);
+	}
+	fprintf(stderr, "total: chunks %zu lost %zu late %zu duplicates %zu\n",
+			written, lost, late, duplicates);
+
+	for (i = 0; i < n; i++)
+		free(rx[i].buf);
+	free(rx);
+	for (i = 0; i < window; i++)
+		free(slots[i].data);
+	free(slots);
+
+	return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef CALIB_H
+#define CALIB_H	1
+
+#include <stdint.h>
+
+#include "context.h"
+
+/**
+ * 前回うまく受信できたときの較正情報
+ */
+struct Calibration {
+	/** 推定クロック周期（μs） */
+	uint32_t period;
+	/** 各層の推定強度 */
+	int32_t intensities[LEVELS];
+};
+
+/**
+ * フラッシュメモリから較正情報を読み込む
+ */
+void loadCalibration(void);
+
+/**
+ * 較正情報を得る（なければ NULL）
+ */
+const struct Calibration *getCalibration(void);
+
+/**
+ * 較正情報を更新する（フラッシュメモリにはまだ書き込まない）
+ */
+void updateCalibration(const struct Calibration *cal);
+
+/**
+ * 較正情報が大きく変わっていればフラッシュメモリに書き込む
+ * 書き込み中は CPU が止まるので、受信していないときに呼ぶこと
+ */
+void commitCalibration(void);
+
+#endif	// !CALIB_H
@@ -12,6 +12,7 @@ struct Context {
 	size_t size;
 	sysclock_t period;
 	sysclock_t lastCSClock;
+	sysclock_t nextSampleClock;
 #define LEVELS	2
 	int32_t intensities[LEVELS];
 };
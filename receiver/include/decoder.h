@@ -0,0 +1,47 @@
+#ifndef DECODER_H
+#define DECODER_H	1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "context.h"
+
+/** 1 フレームを構成するチップ数 */
+#define FRAME_CHIPS	16
+
+/**
+ * 逐次干渉除去による復号器の状態
+ */
+struct Decoder {
+	uint32_t intensities[LEVELS];
+	size_t nIntensities[LEVELS];
+};
+
+/**
+ * 復号器を初期化する
+ * intensities が NULL なら推定受信強度を忘れ、
+ * さもなくば重み weight 個分の観測があったものとして推定受信強度を与える
+ */
+void initDecoder(struct Decoder *dec, const int32_t *intensities,
+		size_t weight);
+
+/**
+ * 1 フレーム分のチップ輝度を復号して 4 bit の情報信号を得る
+ * frame は第 1 層の信号を差し引くために書き換えられる
+ * y が NULL でなければ y11, y21, y12, y22 の相関値を書き込む
+ */
+int decodeFrame(struct Decoder *dec, int32_t *frame, int32_t *y);
+
+/**
+ * 1 フレーム分のチップ輝度を復号して 8 bit の情報信号を得る（送信方式 'w'）
+ * 各層の各スロットの相関は高速ウォルシュ・アダマール変換でまとめて求める
+ * frame 及び y の扱いは decodeFrame() と同じ
+ */
+int decodeWalshFrame(struct Decoder *dec, int32_t *frame, int32_t *y);
+
+/**
+ * 層 level の推定受信強度を得る
+ */
+int32_t getIntensity(const struct Decoder *dec, int level);
+
+#endif	// !DECODER_H
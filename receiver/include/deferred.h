@@ -0,0 +1,24 @@
+#ifndef DEFERRED_H
+#define DEFERRED_H	1
+
+/**
+ * 遅延処理（最低優先度のソフトウェア割り込み）を初期化する
+ */
+void initDeferred(void);
+
+/**
+ * 遅延処理のハンドラを設定する（NULL で解除する）
+ */
+void setDeferredHandler(void (*handler)(void));
+
+/**
+ * 遅延処理を要求する（割り込みハンドラから呼んでよい）
+ */
+void pendDeferred(void);
+
+/**
+ * 何らかの割り込みが発生するまで眠る
+ */
+void waitForInterrupt(void);
+
+#endif	// !DEFERRED_H
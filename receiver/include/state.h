@@ -15,6 +15,21 @@ enum STATE {
 	STATE_MAX,
 };
 
+/**
+ * 状態遷移の理由
+ */
+enum REASON {
+	REASON_BOOT,		// 起動した
+	REASON_SECOND_CS,	// 2 回目のキャリア信号を検出した
+	REASON_CS_TIMEOUT,	// キャリア信号が途切れた（同期失敗）
+	REASON_SYNC_DONE,	// 所定回数のキャリア信号を記録した
+	REASON_SYNC_END,	// 同期信号が終端した
+	REASON_LEVEL_DONE,	// 強度推定のパターンの終端を復号した
+	REASON_CARRIER_LOST,	// 送信が終了した
+	REASON_HANDOVER,	// 遷移先へコンテキスト情報を引き継いだ
+	REASON_MAX,
+};
+
 /**
  * 現在の状態を取得する
  */
@@ -23,6 +38,6 @@ enum STATE getState(void);
 /**
  * 現在の状態を設定する
  */
-enum STATE setState(enum STATE state);
+enum STATE setState(enum STATE state, enum REASON reason);
 
 #endif	// !STATE_H
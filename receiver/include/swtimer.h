@@ -0,0 +1,61 @@
+#ifndef SWTIMER_H
+#define SWTIMER_H	1
+
+#include <stdint.h>
+
+/**
+ * ソフトウェアタイマ
+ */
+struct SwTimer {
+	/** 満了時刻（μs） */
+	uint64_t deadline;
+	/** 周期（μs、0 ならワンショット） */
+	uint32_t period;
+	/** 満了時のハンドラ（TC3 の割り込みから呼ばれる） */
+	void (*handler)(void);
+	/** 満了時刻順のリストの次の要素 */
+	struct SwTimer *next;
+	/** 満了待ちであるか */
+	bool armed;
+};
+
+/**
+ * タイマサービスを開始する（TC3 を専有する）
+ */
+void startTimerService(void);
+
+/**
+ * タイマサービスの時刻（μs）を得る
+ */
+uint64_t getTimerClock(void);
+
+/**
+ * 時刻 deadline に満了するようにタイマを設定する
+ * period が 0 でなければ、以降は満了時刻から period ごとに満了する
+ * deadline が過ぎていれば直ちに満了する
+ */
+void armTimerAt(struct SwTimer *t, uint64_t deadline, uint32_t period,
+		void (*handler)(void));
+
+/**
+ * 現在から delay 後に満了するようにタイマを設定する
+ */
+void armTimerIn(struct SwTimer *t, uint32_t delay, uint32_t period,
+		void (*handler)(void));
+
+/**
+ * 次の満了時刻を delta だけずらす（周期はそのまま）
+ */
+void shiftTimer(struct SwTimer *t, int32_t delta);
+
+/**
+ * タイマを解除する
+ */
+void cancelTimer(struct SwTimer *t);
+
+/**
+ * タイマの次の満了時刻を得る
+ */
+uint64_t getTimerDeadline(const struct SwTimer *t);
+
+#endif	// !SWTIMER_H
@@ -0,0 +1,63 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H	1
+
+#include <stdint.h>
+
+#include "context.h"
+#include "state.h"
+
+/**
+ * 受信機の動作統計
+ *
+ * 割り込みハンドラから単純なインクリメントで更新するため、
+ * 関数を介さずに直接書き換えてよい。
+ */
+struct Telemetry {
+	/** 各状態へ遷移した回数 */
+	uint32_t transitions[STATE_MAX];
+	/** 同期状態から待ち状態へ戻った（同期に失敗した）回数 */
+	uint32_t syncFailures;
+	/** 読み込んだチップの数 */
+	uint32_t chips;
+	/** 復号したフレームの数 */
+	uint32_t frames;
+	/** 復号した文字の数及び出力用バッファが溢れて捨てた文字の数 */
+	uint32_t bytes, drops;
+	/** 誤り訂正で訂正した符号語の数及び訂正できなかった符号語の数 */
+	uint32_t fecCorrected, fecFailed;
+	/** CRC の合った枠、壊れていた枠及び通し番号から失われたと分かった枠の数 */
+	uint32_t packets, packetErrors, packetsLost;
+	/** 周期誤差補正でタイマを遅らせた回数及び早めた回数 */
+	uint32_t delays, advances;
+	/** 同期状態で推定したクロック周期及び強度推定状態の推定強度 */
+	uint32_t period;
+	int32_t intensities[LEVELS];
+	/** 各層の相関値の絶対値の個数、総和及び二乗和（報告ごとに忘れる） */
+	uint32_t nY[LEVELS];
+	uint64_t sumY[LEVELS], sumY2[LEVELS];
+};
+
+extern struct Telemetry telemetry;
+
+/**
+ * 1 フレーム分の相関値 y11, y21, y12, y22 を記録する
+ */
+static inline void
+recordCorrelations(const int32_t *y)
+{
+	for (int l = 0; l < LEVELS; l++)
+		for (int k = 0; k < 2; k++) {
+			const uint32_t a = y[2*l + k] < 0 ? -y[2*l + k] : y[2*l + k];
+			telemetry.nY[l]++;
+			telemetry.sumY[l] += a;
+			telemetry.sumY2[l] += (uint64_t)a * a;
+		}
+	telemetry.frames++;
+}
+
+/**
+ * 動作統計をシリアル通信に一行で報告する
+ */
+void reportTelemetry(void);
+
+#endif	// !TELEMETRY_H
@@ -0,0 +1,41 @@
+#ifndef TRACE_H
+#define TRACE_H	1
+
+#include <stdint.h>
+
+#include "context.h"
+#include "state.h"
+
+/**
+ * 状態遷移の記録
+ */
+struct TraceEntry {
+	/** 通し番号（0 なら書き込み中か未使用） */
+	uint32_t seq;
+	/** 記録した時刻（システム時刻の下位 32 bit） */
+	uint32_t clock;
+	/** 遷移元の状態及び遷移先の状態 */
+	int8_t from, to;
+	/** 遷移の理由 */
+	uint8_t reason;
+	/** 引き継いだ推定クロック周期及び推定強度（REASON_HANDOVER のみ） */
+	uint32_t period;
+	int32_t intensities[LEVELS];
+};
+
+/**
+ * 状態遷移を記録する（割り込みハンドラから呼んでよい）
+ */
+void traceTransition(enum STATE from, enum STATE to, enum REASON reason);
+
+/**
+ * 遷移先へ引き継いだコンテキスト情報を記録する
+ */
+void traceHandover(enum STATE from, enum STATE to, const struct Context *ctx);
+
+/**
+ * 状態遷移の記録を古いものから順にシリアル通信にダンプする
+ */
+void dumpTrace(void);
+
+#endif	// !TRACE_H
@@ -0,0 +1,197 @@
+#include <Arduino.h>
+
+#include "context.h"
+
+#include "calib.h"
+
+/**
+ * フラッシュメモリに保存する較正情報
+ *
+ * SAMD21 には EEPROM がないので、フラッシュメモリの一部を
+ * 追記型の記録領域として使う（EEPROM のエミュレーション）。
+ * 記録は 1 ページ（64 byte）に一つずつ、領域の先頭から順に書き込み、
+ * 通し番号の最も大きな正しい記録を最新のものとする。
+ * 行（4 ページ）の先頭に書き込むときに限りその行を消去し、
+ * 領域の末尾まで書いたら先頭に戻るので、消去は全ての行に均される。
+ */
+
+#ifndef __SAMD21__
+#error Calibration storage supports SAMD21 only
+#endif
+
+/** ページ及び行の大きさ（byte） */
+#define PAGE_SIZE	64
+#define ROW_SIZE	(PAGE_SIZE * 4)
+/** 記録領域の行数 */
+#define NROWS	8
+/** 記録の数 */
+#define NRECORDS	(NROWS * ROW_SIZE / PAGE_SIZE)
+/** 記録の目印 */
+#define MAGIC	0x4C43414CUL	// "LACL"
+
+/**
+ * 記録（1 ページ）
+ */
+struct Record {
+	uint32_t magic;
+	uint32_t seq;
+	struct Calibration cal;
+	uint32_t sum;
+	uint32_t padding[(PAGE_SIZE - 12 - sizeof(struct Calibration)) / 4];
+};
+static_assert(sizeof(struct Record) == PAGE_SIZE, "Record must fill a page");
+
+/**
+ * 記録領域（プログラムと一緒に書き込まれ、初期値は全て 0）
+ * 中身はプログラムの実行中に書き換わるので、必ず volatile 経由で読むこと
+ */
+__attribute__((aligned(ROW_SIZE)))
+static const struct Record records[NRECORDS] = { };
+
+/** 最新の較正情報と、それを書き込んだ（書き込む）記録の位置及び通し番号 */
+static struct Calibration current;
+static bool valid = false, dirty = false;
+static size_t lastIndex = NRECORDS - 1;
+static uint32_t lastSeq = 0;
+
+/**
+ * 記録の検査和を求める
+ */
+static uint32_t
+checksum(const struct Record *r)
+{
+	const uint32_t *p = (const uint32_t *)r;
+	uint32_t sum = 0x12345678UL;
+
+	for (size_t i = 0; i < offsetof(struct Record, sum) / 4; i++)
+		sum = (sum << 5 | sum >> 27) ^ p[i];
+
+	return sum;
+}
+
+/**
+ * NVM コントローラの処理を待つ
+ */
+static void
+waitReady(void)
+{
+	while (NVMCTRL->INTFLAG.bit.READY == 0)
+		;
+}
+
+/**
+ * 行を消去する
+ */
+static void
+eraseRow(const void *addr)
+{
+	NVMCTRL->STATUS.reg |= NVMCTRL_STATUS_MASK;
+	NVMCTRL->ADDR.reg = (uint32_t)(uintptr_t)addr / 2;
+	NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | NVMCTRL_CTRLA_CMD_ER;
+	waitReady();
+}
+
+/**
+ * ページを書き込む
+ */
+static void
+writePage(const void *addr, const void *src)
+{
+	volatile uint32_t *dst = (volatile uint32_t *)addr;
+	const uint32_t *p = (const uint32_t *)src;
+
+	NVMCTRL->CTRLB.bit.MANW = 1;
+	NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | NVMCTRL_CTRLA_CMD_PBC;
+	waitReady();
+	for (size_t i = 0; i < PAGE_SIZE / 4; i++)
+		dst[i] = p[i];
+	NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | NVMCTRL_CTRLA_CMD_WP;
+	waitReady();
+}
+
+/**
+ * a が b から 1/den 以上ずれているか
+ */
+static bool
+differs(int32_t a, int32_t b, int32_t den)
+{
+	const int32_t d = a > b ? a - b : b - a;
+
+	return d * den > (b < 0 ? -b : b);
+}
+
+/**
+ * フラッシュメモリから較正情報を読み込む
+ */
+void
+loadCalibration(void)
+{
+	for (size_t i = 0; i < NRECORDS; i++) {
+		const volatile uint32_t *src = (const volatile uint32_t *)&records[i];
+		struct Record r;
+
+		for (size_t j = 0; j < PAGE_SIZE / 4; j++)
+			((uint32_t *)&r)[j] = src[j];
+		if (r.magic != MAGIC || r.sum != checksum(&r))
+			continue;
+		if (valid && r.seq <= lastSeq)
+			continue;
+
+		current = r.cal;
+		lastIndex = i;
+		lastSeq = r.seq;
+		valid = true;
+	}
+	dirty = false;
+}
+
+/**
+ * 較正情報を得る（なければ NULL）
+ */
+const struct Calibration *
+getCalibration(void)
+{
+	return valid ? &current : NULL;
+}
+
+/**
+ * 較正情報を更新する（フラッシュメモリにはまだ書き込まない）
+ */
+void
+updateCalibration(const struct Calibration *cal)
+{
+	// 大きく変わっていなければ書き込むまでもない
+	if (valid && !differs(cal->period, current.period, 64)
+			&& !differs(cal->intensities[0], current.intensities[0], 8)
+			&& !differs(cal->intensities[1], current.intensities[1], 8))
+		return;
+
+	current = *cal;
+	valid = dirty = true;
+}
+
+/**
+ * 較正情報が大きく変わっていればフラッシュメモリに書き込む
+ */
+void
+commitCalibration(void)
+{
+	struct Record r;
+
+	if (!dirty)
+		return;
+
+	memset(&r, 0xFF, sizeof(r));
+	r.magic = MAGIC;
+	r.seq = ++lastSeq;
+	r.cal = current;
+	r.sum = checksum(&r);
+
+	// 行の先頭に書き込むなら、先にその行を消去する
+	lastIndex = (lastIndex + 1) % NRECORDS;
+	if (lastIndex % (ROW_SIZE / PAGE_SIZE) == 0)
+		eraseRow(&records[lastIndex]);
+	writePage(&records[lastIndex], &r);
+
+	dirty = false;
+}
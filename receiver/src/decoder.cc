@@ -0,0 +1,192 @@
+#include <stdlib.h>
+
+#include "chips.h"
+#include "context.h"
+
+#include "decoder.h"
+
+/**
+ * 逐次干渉除去による復号器
+ *
+ * 強度推定状態と受信状態とで共有する。
+ * ハードウェアには一切触れないので、割り込みハンドラからも呼び出せる。
+ */
+
+/** 符号語テーブル w[k,l,0] - w[k,l,1] */
+static constexpr int32_t decodeTab[2][FRAME_CHIPS] = {
+	{ 1, 0,-1, 0, -1, 0, 1, 0,  0,-1, 0, 1,  0, 1, 0,-1 },
+	{ 0, 1, 0,-1,  0,-1, 0, 1, -1, 0, 1, 0,  1, 0,-1, 0 },
+};
+
+/**
+ * 長さ n の系列 a と b との相関 Γ(a, b) を求める
+ */
+static int32_t
+gamma(const int32_t *a, const int32_t *b, size_t n)
+{
+	int32_t s;
+
+	s = 0;
+	for (size_t i = 0; i < n; i++)
+		s += a[i] * b[i];
+
+	return s;
+}
+
+/**
+ * 復号器を初期化する
+ */
+void
+initDecoder(struct Decoder *dec, const int32_t *intensities, size_t weight)
+{
+	for (int l = 0; l < LEVELS; l++) {
+		if (intensities == NULL) {
+			dec->intensities[l] = 0;
+			dec->nIntensities[l] = 0;
+		} else {
+			dec->intensities[l] = intensities[l] * 4 * weight;
+			dec->nIntensities[l] = weight;
+		}
+	}
+}
+
+/**
+ * 1 フレーム分のチップ輝度を復号して 4 bit の情報信号を得る
+ */
+int
+decodeFrame(struct Decoder *dec, int32_t *frame, int32_t *y)
+{
+	// 第 1 層を復号する
+	const int32_t y11 = gamma(decodeTab[0], frame, FRAME_CHIPS);
+	const int32_t y21 = gamma(decodeTab[1], frame, FRAME_CHIPS);
+	const int i11 = y11 > 0 ? 0 : 1;
+	const int i21 = y21 > 0 ? 0 : 1;
+
+	// 第 1 層の推定強度を更新する
+	dec->intensities[0] += abs(y11) + abs(y21);
+	dec->nIntensities[0] += 2;
+
+	// 第 1 層の信号を差し引く
+	const int32_t l1 = getIntensity(dec, 0);
+	for (int i = 0; i < FRAME_CHIPS; i++) {
+		int32_t t = 0;
+		t += i11 == 0 ? (decodeTab[0][i] > 0) : (decodeTab[0][i] < 0);
+		t += i21 == 0 ? (decodeTab[1][i] > 0) : (decodeTab[1][i] < 0);
+		frame[i] -= l1 * t;
+	}
+
+	// 第 2 層を復号する
+	const int32_t y12 = gamma(decodeTab[0], frame, FRAME_CHIPS);
+	const int32_t y22 = gamma(decodeTab[1], frame, FRAME_CHIPS);
+	const int i12 = y12 < 0 ? 0 : 1;	// 第 2 層は符号が逆
+	const int i22 = y22 < 0 ? 0 : 1;	// 第 2 層は符号が逆
+
+	// 第 2 層の推定強度を更新する
+	dec->intensities[1] += abs(y12) + abs(y22);
+	dec->nIntensities[1] += 2;
+
+	if (y != NULL) {
+		y[0] = y11;
+		y[1] = y21;
+		y[2] = y12;
+		y[3] = y22;
+	}
+
+	// 情報信号を復号する（4 bit）
+	return i22 << 3 | i12 << 2 | i21 << 1 | i11 << 0;
+}
+
+/**
+ * 長さ WALSH_CHIPS の高速ウォルシュ・アダマール変換
+ * x[k] をアダマール行列の k 行との相関に置き換える
+ */
+static void
+fwht(int32_t *x)
+{
+	for (size_t h = 1; h < WALSH_CHIPS; h <<= 1)
+		for (size_t i = 0; i < WALSH_CHIPS; i += 2*h)
+			for (size_t j = i; j < i + h; j++) {
+				const int32_t a = x[j], b = x[j + h];
+				x[j] = a + b;
+				x[j + h] = a - b;
+			}
+}
+
+/**
+ * 1 層分の 2 スロットを復号して 4 bit を得る（送信方式 'w'）
+ * 各スロットで WALSH_ROW0 行と WALSH_ROW1 行とのうち相関の絶対値の大きい方を選ぶ
+ */
+static int
+decodeWalshLayer(const int32_t *frame, int32_t *y)
+{
+	int v = 0;
+
+	for (int s = 0; s < 2; s++) {
+		int32_t x[WALSH_CHIPS];
+		for (size_t i = 0; i < WALSH_CHIPS; i++)
+			x[i] = frame[walshSlots[s][i]];
+		fwht(x);
+
+		int b = 0;
+		y[s] = x[WALSH_ROW0];
+		if (abs(x[WALSH_ROW1]) > abs(y[s])) {
+			b = 2;
+			y[s] = x[WALSH_ROW1];
+		}
+		b |= y[s] > 0 ? 0 : 1;
+		v |= b << 2*s;
+	}
+
+	return v;
+}
+
+/**
+ * 1 フレーム分のチップ輝度を復号して 8 bit の情報信号を得る（送信方式 'w'）
+ */
+int
+decodeWalshFrame(struct Decoder *dec, int32_t *frame, int32_t *y)
+{
+	int32_t y1[2], y2[2];
+
+	// 第 1 層を復号する
+	const int v1 = decodeWalshLayer(frame, y1);
+
+	// 第 1 層の推定強度を更新する
+	dec->intensities[0] += abs(y1[0]) + abs(y1[1]);
+	dec->nIntensities[0] += 2;
+
+	// 第 1 層の信号を差し引く
+	const int32_t l1 = getIntensity(dec, 0);
+	const uint16_t p = walshToChips(v1);
+	for (int i = 0; i < FRAME_CHIPS; i++)
+		frame[i] -= l1 * (p >> i & 1);
+
+	// 第 2 層を復号する
+	const int v2 = ~decodeWalshLayer(frame, y2) & 0x0F;	// 第 2 層は反転
+
+	// 第 2 層の推定強度を更新する
+	dec->intensities[1] += abs(y2[0]) + abs(y2[1]);
+	dec->nIntensities[1] += 2;
+
+	if (y != NULL) {
+		y[0] = y1[0];
+		y[1] = y1[1];
+		y[2] = y2[0];
+		y[3] = y2[1];
+	}
+
+	// 情報信号を復号する（8 bit）
+	return v2 << 4 | v1;
+}
+
+/**
+ * 層 level の推定受信強度を得る
+ */
+int32_t
+getIntensity(const struct Decoder *dec, int level)
+{
+	if (dec->nIntensities[level] == 0)
+		return 0;
+
+	return dec->intensities[level] / dec->nIntensities[level] / 4;
+}
@@ -0,0 +1,63 @@
+#include <Arduino.h>
+
+#include "deferred.h"
+
+/**
+ * 遅延処理
+ *
+ * サンプリングの割り込みハンドラはフレームが揃うと PendSV を保留にする。
+ * PendSV は最も低い優先度に設定してあるため、
+ * タイマやキャリア検出の割り込みを妨げずに、
+ * かつ loop() や USB の処理よりも先に復号処理を行うことができる。
+ */
+
+/** 遅延処理のハンドラ */
+static void (* volatile deferredHandler)(void) = NULL;
+
+/**
+ * PendSV のハンドラ
+ */
+extern "C" void
+PendSV_Handler(void)
+{
+	void (* const handler)(void) = deferredHandler;
+
+	if (handler != NULL)
+		handler();
+}
+
+/**
+ * 遅延処理（最低優先度のソフトウェア割り込み）を初期化する
+ */
+void
+initDeferred(void)
+{
+	NVIC_SetPriority(PendSV_IRQn, (1 << __NVIC_PRIO_BITS) - 1);
+}
+
+/**
+ * 遅延処理のハンドラを設定する（NULL で解除する）
+ */
+void
+setDeferredHandler(void (*handler)(void))
+{
+	deferredHandler = handler;
+}
+
+/**
+ * 遅延処理を要求する（割り込みハンドラから呼んでよい）
+ */
+void
+pendDeferred(void)
+{
+	SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+}
+
+/**
+ * 何らかの割り込みが発生するまで眠る
+ */
+void
+waitForInterrupt(void)
+{
+	__WFI();
+}
@@ -1,10 +1,14 @@
 #include <Arduino.h>
-#include <TimerTC3.h>
 
+#include "calib.h"
 #include "context.h"
+#include "decoder.h"
+#include "deferred.h"
 #include "inputs.h"
 #include "state.h"
+#include "swtimer.h"
 #include "sysclock.h"
+#include "telemetry.h"
 
 #include "leveling.h"
 
@@ -25,7 +29,9 @@
  * 開始時の処理
  * 	チップ輝度バッファを巻き戻す。
  * 	推定受信強度をすべて忘れる。
- * 	チップ読み込みタイマの割り込みを設定する。
+ * 		較正情報があれば、それを少しの重みで推定受信強度の初期値とする。
+ * 	遅延処理のハンドラを設定する。
+ * 	チップ読み込みタイマを設定する。
  * 	キャリア信号検出時の割り込みを設定する。
  *
  * 動作中の処理
@@ -36,32 +42,38 @@
  * 		送信が終了しているか調べ、
  * 			そのようであれば待ち状態へ遷移する。
  * 		周期誤差を補正できそうなら、
- * 			信号が思ったよりも早いなら次のタイマを遅らせ、
- * 			信号が思ったよりも遅いなら次のタイマを早める。
- * 	フレームを構成する全てのチップが記録されていれば、
+ * 			信号が思ったよりも早いなら次のタイマの満了時刻を遅らせ、
+ * 			信号が思ったよりも遅いなら次のタイマの満了時刻を早める。
+ * 		フレームを構成する全てのチップが記録されていれば、
+ * 			バッファの面を切り替えて、遅延処理を要求する。
+ * 	遅延処理では、
  * 		復号処理を行い、
  * 		各層の推定強度を更新する。
  * 		強度推定のパターンの終端を復号したら、
  * 			受信状態へ遷移する。
  *
  * 終了時の処理
- * 	チップ読み込みタイマを停止し、割り込みを解除する。
+ * 	チップ読み込みタイマを解除する。
  * 	キャリア信号検出時の割り込みを解除する。
- * 	推定クロック周期及び推定信号強度を遷移先の状態へ引き継ぐ。
+ * 	遅延処理のハンドラを解除する。
+ * 	推定クロック周期、次のチップの読み込み時刻及び推定信号強度を
+ * 		遷移先の状態へ引き継ぐ。
+ * 	受信状態へ遷移するなら、推定クロック周期及び推定信号強度で
+ * 		較正情報を更新する。
  */
 
 /** タイマの周期 */
 static sysclock_t timerPeriod;
 /** 最終キャリア検出時刻 */
 static volatile sysclock_t lastCSClock;
+/** チップ読み込みタイマ */
+static struct SwTimer sampleTimer;
 
-/** チップ輝度用バッファ */
-#define INPUT_BUFLEN	16
-static volatile int32_t pdInputs[16];
-/** バッファの末尾位置 */
-static volatile size_t bufTail;
-
-static void dtcHandler(void);
+/** チップ輝度用バッファ（記録用と復号用との二面） */
+#define INPUT_BUFLEN	FRAME_CHIPS
+static volatile int32_t pdInputs[2][INPUT_BUFLEN];
+/** 記録中の面及びバッファの末尾位置 */
+static volatile size_t bufBank, bufTail;
 
 /**
  * チップ読み込みタイマのハンドラ
@@ -70,7 +82,15 @@ static void
 tcHandler(void)
 {
 	// 測定されたチップ輝度を記録する
-	pdInputs[bufTail++] = (int32_t)analogRead(PDINPUT);
+	telemetry.chips++;
+	pdInputs[bufBank][bufTail++] = (int32_t)analogRead(PDINPUT);
+
+	// フレームが揃ったら面を切り替えて復号してもらう
+	if (bufTail == INPUT_BUFLEN) {
+		bufBank ^= 1;
+		bufTail = 0;
+		pendDeferred();
+	}
 
 	// XXX: デバッグ用のクロック信号を出力する
 	static bool on = false;
@@ -79,31 +99,20 @@ tcHandler(void)
 	// 送信終了してそうならおしまい
 	sysclock_t diff = getSysClock() - lastCSClock;
 	if (lastCSClock > 0 && diff > 16*timerPeriod)
-		setState(STATE_WAITING);
+		setState(STATE_WAITING, REASON_CARRIER_LOST);
 
 	// 周期誤差を補正できないっぽい
 	if (diff > timerPeriod)
 		return;
 
-	// 周期誤差補正
+	// 周期誤差補正（次のチップの読み込みを 3/8 周期ずらす）
 	if (diff < timerPeriod * 1/4) {
-		TimerTc3.setPeriod(timerPeriod * 11/8);	// 1.375
+		telemetry.delays++;
+		shiftTimer(&sampleTimer, timerPeriod * 3/8);
 	} else if (diff > timerPeriod * 3/4) {
-		TimerTc3.setPeriod(timerPeriod * 5/8);	// 0.625
-	} else {
-		return;
+		telemetry.advances++;
+		shiftTimer(&sampleTimer, -(int32_t)(timerPeriod * 3/8));
 	}
-	TimerTc3.attachInterrupt(dtcHandler);
-	TimerTc3.restart();
-}
-
-static void
-dtcHandler(void)
-{
-	TimerTc3.setPeriod(timerPeriod);
-	TimerTc3.attachInterrupt(tcHandler);
-	TimerTc3.restart();
-	tcHandler();
 }
 
 static void
@@ -113,42 +122,56 @@ csHandler(void)
 	lastCSClock = getSysClock();
 }
 
+/** 復号器 */
+static struct Decoder decoder;
+/** 較正情報の推定強度の重み（観測数） */
+#define CALIB_WEIGHT	8
+
 /**
- * 長さ n の系列 a と b との相関 Γ(a, b) を求める
+ * 復号処理（遅延処理のハンドラ）
  */
-static int32_t
-gamma(const int32_t *a, const int32_t *b, size_t n)
+static void
+decodeHandler(void)
 {
-	int32_t s;
+	// 記録の終わった面を復号する
+	int32_t *frame = (int32_t *)pdInputs[bufBank ^ 1];
+	int32_t y[4];
+	const int d = decodeFrame(&decoder, frame, y);
+	recordCorrelations(y);
 
-	s = 0;
-	for (size_t i = 0; i < n; i++)
-		s += a[i] * b[i];
-
-	return s;
+	// 強度推定を終わっていいか確かめる（簡単のため最後三つだけ見る）
+	static int last[3];
+	last[0] = last[1];
+	last[1] = last[2];
+	last[2] = d;
+	if (last[0] == 0x0C && last[1] == 0x08 && last[2] == 0x00)
+		setState(STATE_RECEIVING, REASON_LEVEL_DONE);
 }
 
-/** 推定受信強度 */
-static uint32_t intensities[2];
-static size_t nIntensities[2];
-
 /**
  * 強度推定状態を初期化する
  */
 void
 initLeveling(enum STATE prevState, const struct Context *ctx)
 {
-	bufTail = 0;
+	bufBank = bufTail = 0;
 
-	// 推定強度を忘れる
-	intensities[0] = intensities[1] = 0;
-	nIntensities[0] = nIntensities[1] = 0;
+	// 推定強度を忘れる（較正情報があれば初期値とする）
+	const struct Calibration *cal = getCalibration();
+	if (cal != NULL && ctx->period > cal->period * 15/16
+			&& ctx->period < cal->period * 17/16)
+		initDecoder(&decoder, cal->intensities, CALIB_WEIGHT);
+	else
+		initDecoder(&decoder, NULL, 0);
+
+	// 復号処理を遅延処理として登録する
+	setDeferredHandler(decodeHandler);
 
 	// チップ読み込みタイマを設定する
+	// （引き継いだ時刻が最初のチップの開始時刻なので、その中央から）
 	timerPeriod = ctx->period;
-	TimerTc3.initialize(timerPeriod);
-	TimerTc3.attachInterrupt(tcHandler);
-	TimerTc3.start();
+	armTimerAt(&sampleTimer, ctx->lastCSClock + timerPeriod * 1/2,
+			timerPeriod, tcHandler);
 
 	// キャリア信号検出時の割り込みを設定する
 	lastCSClock = 0;
@@ -161,57 +184,8 @@ initLeveling(enum STATE prevState, const struct Context *ctx)
 void
 mainLeveling(void)
 {
-	// フレームが揃っていないなら何もしない
-	if (bufTail != INPUT_BUFLEN)
-		return;
-
-	/** 符号語テーブル w[k,l,0] - w[k,l,1] */
-	constexpr int32_t decodeTab[2][16] = {
-		{ 1, 0,-1, 0, -1, 0, 1, 0,  0,-1, 0, 1,  0, 1, 0,-1 },
-		{ 0, 1, 0,-1,  0,-1, 0, 1, -1, 0, 1, 0,  1, 0,-1, 0 },
-	};
-
-	// 第 1 層を復号する
-	const int32_t y11 = gamma(decodeTab[0], (int32_t *)pdInputs, 16);
-	const int32_t y21 = gamma(decodeTab[1], (int32_t *)pdInputs, 16);
-	const int i11 = y11 > 0 ? 0 : 1;
-	const int i21 = y21 > 0 ? 0 : 1;
-
-	// 第 1 層の推定強度を更新する
-	intensities[0] += abs(y11) + abs(y21);
-	nIntensities[0] += 2;
-
-	// 第 1 層の信号を差し引く
-	for (int i = 0; i < 16; i++) {
-		int32_t t = 0;
-		t += i11 == 0 ? (decodeTab[0][i] > 0) : (decodeTab[0][i] < 0);
-		t += i21 == 0 ? (decodeTab[1][i] > 0) : (decodeTab[1][i] < 0);
-		pdInputs[i] -= (intensities[0] / nIntensities[0] / 4) * t;
-	}
-
-	// 第 2 層を復号する
-	const int32_t y12 = gamma(decodeTab[0], (int32_t *)pdInputs, 16);
-	const int32_t y22 = gamma(decodeTab[1], (int32_t *)pdInputs, 16);
-	const int i12 = y12 < 0 ? 0 : 1;	// 第 2 層は符号が逆
-	const int i22 = y22 < 0 ? 0 : 1;	// 第 2 層は符号が逆
-
-	// 第 2 層の推定強度を更新する
-	intensities[1] += abs(y12) + abs(y22);
-	nIntensities[1] += 2;
-
-	// 情報信号を復号する（4 bit）
-	const int d = i22 << 3 | i12 << 2 | i21 << 1 | i11 << 0;
-
-	// 強度推定を終わっていいか確かめる（簡単のため最後三つだけ見る）
-	static int last[3];
-	last[0] = last[1];
-	last[1] = last[2];
-	last[2] = d;
-	if (last[0] == 0x0C && last[1] == 0x08 && last[2] == 0x00)
-		setState(STATE_RECEIVING);
-
-	// バッファを巻き戻す
-	bufTail = 0;
+	// なにもしない（復号は遅延処理で行う）
+	(void)0;
 }
 
 /**
@@ -222,17 +196,32 @@ exitLeveling(enum STATE nextState)
 {
 	static struct Context ctx;
 
-	// チップ読み込みタイマを停止し、割り込みを解除する
-	TimerTc3.stop();
-	TimerTc3.detachInterrupt();
+	// チップ読み込みタイマを解除する
+	cancelTimer(&sampleTimer);
 
 	// キャリア信号検出時の割り込みを解除する
 	detachInterrupt(CSINPUT);
 
-	// 推定クロック周期及び推定信号強度を書き込む
+	// 遅延処理のハンドラを解除する
+	setDeferredHandler(NULL);
+
+	// 推定クロック周期、次のチップの読み込み時刻及び推定信号強度を書き込む
 	ctx.period = timerPeriod;
-	ctx.intensities[0] = intensities[0] / nIntensities[0] / 4;
-	ctx.intensities[1] = intensities[1] / nIntensities[1] / 4;
+	ctx.nextSampleClock = getTimerDeadline(&sampleTimer);
+	ctx.intensities[0] = getIntensity(&decoder, 0);
+	ctx.intensities[1] = getIntensity(&decoder, 1);
+	telemetry.period = ctx.period;
+	telemetry.intensities[0] = ctx.intensities[0];
+	telemetry.intensities[1] = ctx.intensities[1];
+
+	// 受信に至ったなら較正情報を更新する
+	if (nextState == STATE_RECEIVING) {
+		struct Calibration cal;
+		cal.period = ctx.period;
+		cal.intensities[0] = ctx.intensities[0];
+		cal.intensities[1] = ctx.intensities[1];
+		updateCalibration(&cal);
+	}
 
 	ctx.size = sizeof(ctx);
 	return &ctx;
@@ -1,9 +1,13 @@
 #include <Arduino.h>
 
+#include "calib.h"
 #include "context.h"
+#include "deferred.h"
 #include "inputs.h"
 #include "state.h"
 #include "sysclock.h"
+#include "telemetry.h"
+#include "trace.h"
 
 #include "donothing.h"
 #include "waiting.h"
@@ -42,12 +46,48 @@ static struct Context *(* const exitState[])(enum STATE) = {
 	exitDoNothing,
 };
 
+/** 動作統計を定期的に報告する間隔（ms、0 なら報告しない） */
+#define TELEMETRY_INTERVAL	0
+
+/**
+ * シリアル通信から受け取ったコマンドを処理する
+ *
+ * 	t	動作統計を報告する
+ * 	r	状態遷移の記録をダンプする
+ */
+static void
+pollCommand(void)
+{
+	while (Serial.available())
+		switch (Serial.read()) {
+		case 't':
+			reportTelemetry();
+			break;
+		case 'r':
+			dumpTrace();
+			break;
+		default:
+			break;
+		}
+
+#if TELEMETRY_INTERVAL > 0
+	static unsigned long lastReport = 0;
+	if (millis() - lastReport >= TELEMETRY_INTERVAL) {
+		lastReport = millis();
+		reportTelemetry();
+	}
+#endif
+}
+
 void
 setup(void)
 {
 	// システム時刻のカウントを開始する
 	startSysClock();
 
+	// 復号処理のための遅延処理を初期化する
+	initDeferred();
+
 	// 入力ピンを設定する
 	pinMode(CSINPUT, INPUT);
 	pinMode(PDINPUT, INPUT);
@@ -60,10 +100,13 @@ setup(void)
 		;
 	Serial.begin(115200);
 
-	delay(1000);
+	// 較正情報がなければ落ち着くまで待つ（あればすぐに受信を始める）
+	loadCalibration();
+	if (getCalibration() == NULL)
+		delay(1000);
 
 	// 最初は待ち状態
-	setState(STATE_WAITING);
+	setState(STATE_WAITING, REASON_BOOT);
 }
 
 void
@@ -80,10 +123,18 @@ loop(void)
 		struct Context *ctx = NULL;
 		if (prevState != STATE_XXX)
 			ctx = exitState[prevState](lastState);
+		if (ctx != NULL)
+			traceHandover(prevState, lastState, ctx);
 		// 現在の状態の初期化を行う
 		initState[lastState](prevState, ctx);
 		prevState = lastState;
 	}
 	// 現在の状態の仕事をする
 	mainState[lastState]();
+
+	// 要求があれば動作統計を報告する
+	pollCommand();
+
+	// 割り込み（状態遷移や復号完了）があるまで眠る
+	waitForInterrupt();
 }
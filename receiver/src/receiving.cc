@@ -1,10 +1,18 @@
 #include <Arduino.h>
-#include <TimerTC3.h>
 
 #include "context.h"
+#include "decoder.h"
+#include "deferred.h"
+#include "fec.h"
 #include "inputs.h"
+#include "lz.h"
+#include "mode.h"
+#include "packet.h"
+#include "scramble.h"
 #include "state.h"
+#include "swtimer.h"
 #include "sysclock.h"
+#include "telemetry.h"
 
 #include "receiving.h"
 
@@ -20,7 +28,8 @@
  * 開始時の処理
  * 	チップ輝度バッファ及びデータバッファを巻き戻す。
  * 	推定受信強度を初期化する。
- * 	チップ読み込みタイマの割り込みを設定する。
+ * 	遅延処理のハンドラを設定する。
+ * 	チップ読み込みタイマを設定する。
  * 	キャリア信号検出時の割り込みを設定する。
  *
  * 動作中の処理
@@ -31,35 +40,54 @@
  * 		送信が終了しているか調べ、
  * 			そのようであれば待ち状態へ遷移する。
  * 		周期誤差を補正できそうなら、
- * 			信号が思ったよりも早いなら次のタイマを遅らせ、
- * 			信号が思ったよりも遅いなら次のタイマを早める。
- * 	フレームを構成する全てのチップが記録されていれば、
+ * 			信号が思ったよりも早いなら次のタイマの満了時刻を遅らせ、
+ * 			信号が思ったよりも遅いなら次のタイマの満了時刻を早める。
+ * 		フレームを構成する全てのチップが記録されていれば、
+ * 			バッファの面を切り替えて、遅延処理を要求する。
+ * 	遅延処理では、
  * 		復号処理を行い、
- * 		情報信号を復号し、シリアル通信に出力する。
+ * 		最初の 3 文字分は送信方式として受け取り、多数決で送信方式を決める。
+ * 		以降は送信方式に従って情報信号を復号し、出力用バッファに詰める。
+ * 		Walsh 系列を選ぶ送信方式なら、1 フレームから 8 bit を復号する。
+ * 		白色化する送信方式なら、復号した文字に同じ系列を重ねて元に戻す。
+ * 		圧縮する送信方式なら、伸長してから出力用バッファに詰める。
+ * 		枠にする送信方式なら、
+ * 			1 フレームずつずらしながら同期語を探して文字の区切りを合わせ、
+ * 			CRC の合った枠だけを出力用バッファに詰める。
+ * 	出力用バッファに文字があれば、シリアル通信に出力する。
  *
  * 終了時の処理
- * 	チップ読み込みタイマを停止し、割り込みを解除する。
+ * 	チップ読み込みタイマを解除する。
  * 	キャリア信号検出時の割り込みを解除する。
+ * 	遅延処理のハンドラを解除し、出力用バッファの残りを出力する。
  */
 
  /** タイマの周期 */
 static sysclock_t timerPeriod;
 /** 最終キャリア検出時刻 */
 static volatile sysclock_t lastCSClock;
+/** チップ読み込みタイマ */
+static struct SwTimer sampleTimer;
 
-/** チップ輝度用バッファ */
-#define INPUT_BUFLEN	16
-static volatile int32_t pdInputs[16];
-/** バッファの末尾位置 */
-static volatile size_t bufTail;
-
-static void dtcHandler(void);
+/** チップ輝度用バッファ（記録用と復号用との二面） */
+#define INPUT_BUFLEN	FRAME_CHIPS
+static volatile int32_t pdInputs[2][INPUT_BUFLEN];
+/** 記録中の面及びバッファの末尾位置 */
+static volatile size_t bufBank, bufTail;
 
 static void
 tcHandler(void)
 {
 	// 測定されたチップ輝度を記録する
-	pdInputs[bufTail++] = analogRead(PDINPUT);
+	telemetry.chips++;
+	pdInputs[bufBank][bufTail++] = analogRead(PDINPUT);
+
+	// フレームが揃ったら面を切り替えて復号してもらう
+	if (bufTail == INPUT_BUFLEN) {
+		bufBank ^= 1;
+		bufTail = 0;
+		pendDeferred();
+	}
 
 	// XXX: デバッグ用のクロック信号を出力する
 	static bool on = false;
@@ -68,31 +96,20 @@ tcHandler(void)
 	// 送信終了してそうならおしまい
 	sysclock_t diff = getSysClock() - lastCSClock;
 	if (lastCSClock > 0 && diff > 16*timerPeriod)
-		setState(STATE_WAITING);
+		setState(STATE_WAITING, REASON_CARRIER_LOST);
 
 	// 周期誤差を補正できないっぽい
 	if (diff > timerPeriod)
 		return;
 
-	// 周期誤差補正
+	// 周期誤差補正（次のチップの読み込みを 3/8 周期ずらす）
 	if (diff < timerPeriod * 1/4) {
-		TimerTc3.setPeriod(timerPeriod * 11/8);
+		telemetry.delays++;
+		shiftTimer(&sampleTimer, timerPeriod * 3/8);
 	} else if (diff > timerPeriod * 3/4) {
-		// 0.675
-		TimerTc3.setPeriod(timerPeriod * 5/8);
-	} else {
-		return;
+		telemetry.advances++;
+		shiftTimer(&sampleTimer, -(int32_t)(timerPeriod * 3/8));
 	}
-	TimerTc3.attachInterrupt(dtcHandler);
-	TimerTc3.restart();
-}
-static void
-dtcHandler(void)
-{
-	TimerTc3.setPeriod(timerPeriod);
-	TimerTc3.attachInterrupt(tcHandler);
-	TimerTc3.restart();
-	tcHandler();
 }
 
 static void
@@ -102,27 +119,210 @@ csHandler(void)
 	lastCSClock = getSysClock();
 }
 
+/** 復号器 */
+static struct Decoder decoder;
+
+/** 復号済みの情報信号（4 bit あるいは 8 bit）用バッファ */
+static uint8_t chbuf[FEC_FRAMES];
+static size_t chTail = 0;
+
+/** 受け取った送信方式及びその数、決まった送信方式 */
+static uint8_t modes[MODE_HEADER];
+static size_t nModes;
+static uint8_t mode;
+/** 白色化の系列の状態 */
+static uint16_t scrambler;
+/** 伸長する状態 */
+static struct lz lz;
+
+/** 枠の同期語を探すための直近の情報信号（2 文字分）及びその数 */
+static uint8_t history[2 * FEC_FRAMES];
+static size_t nHistory;
+/** 枠を切り分ける状態及び同期語を探しているか */
+static struct packet packet;
+static bool hunting;
+/** 次に来るはずの枠の通し番号及びそれが分かっているか */
+static uint8_t nextSeq;
+static bool seqKnown;
+
+/** 出力用バッファ（枠を丸ごと入れられる大きさ） */
+#define OUTPUT_BUFLEN	256
+static volatile uint8_t outputs[OUTPUT_BUFLEN];
+/** 出力用バッファの先頭位置及び末尾位置 */
+static volatile size_t outHead, outTail;
+
 /**
- * 長さ n の系列 a と b との相関 Γ(a, b) を求める
+ * 1 文字分のフレームの情報信号を送信方式に従って文字にする
  */
-static int32_t
-gamma(const int32_t *a, const int32_t *b, size_t n)
+static uint8_t
+decodeByte(const uint8_t *b, uint32_t *corrected, uint32_t *failed)
 {
-	int32_t s;
+	if (mode & MODE_WALSH)
+		return mode & MODE_FEC
+			? fecDecodeWalsh(b, corrected, failed) : b[0];
+	if (mode & MODE_FEC)
+		return fecDecode(b, corrected, failed);
+
+	return b[0] | b[1] << 4;
+}
 
-	s = 0;
-	for (size_t i = 0; i < n; i++)
-		s += a[i] * b[i];
+/**
+ * 出力用バッファに n 文字詰める（入りきらなければ全て捨てる）
+ */
+static void
+pushOutputs(const uint8_t *p, size_t n)
+{
+	const size_t used = (outTail + OUTPUT_BUFLEN - outHead) % OUTPUT_BUFLEN;
+	if (used + n > OUTPUT_BUFLEN - 1) {
+		telemetry.drops += n;
+		return;
+	}
+	for (size_t i = 0; i < n; i++) {
+		outputs[outTail] = p[i];
+		outTail = (outTail + 1) % OUTPUT_BUFLEN;
+	}
+}
 
-	return s;
+/**
+ * CRC の合った枠を同じ形式のまま出力用バッファに詰める
+ */
+static void
+forwardPacket(void)
+{
+	uint8_t buf[PACKET_MAX + PACKET_OVERHEAD];
+	size_t n = 0;
+
+	// 通し番号が飛んでいれば、その間の枠は失われた
+	if (seqKnown && packet.seq != nextSeq)
+		telemetry.packetsLost += (uint8_t)(packet.seq - nextSeq);
+	nextSeq = packet.seq + 1;
+	seqKnown = true;
+	telemetry.packets++;
+
+	buf[n++] = PACKET_SYNC0;
+	buf[n++] = PACKET_SYNC1;
+	buf[n++] = packet.len;
+	buf[n++] = packet.seq;
+	for (size_t i = 0; i < packet.len; i++)
+		buf[n++] = packet.data[i];
+	buf[n++] = packet.got & 0xFF;
+	buf[n++] = packet.got >> 8;
+	pushOutputs(buf, n);
 }
 
-/** 推定受信強度 */
-static uint32_t intensities[2];
-static size_t nIntensities[2];
+/**
+ * 同期語を探す（1 フレームずつずらしながら、直近の 2 文字分を同期語と比べる）
+ * 見つかればそこに文字の区切りを合わせて枠を受け取り始める
+ */
+static void
+huntSync(uint8_t b)
+{
+	const size_t n = modeByteFrames(mode);
+	if (nHistory == 2 * n) {
+		memmove(history, history + 1, 2 * n - 1);
+		nHistory--;
+	}
+	history[nHistory++] = b;
+	if (nHistory < 2 * n)
+		return;
 
-static uint8_t chbuf[2];
-static size_t chTail = 0;
+	uint32_t ignored = 0;
+	if (decodeByte(history, &ignored, &ignored) != PACKET_SYNC0
+			|| decodeByte(history + n, &ignored, &ignored)
+			!= PACKET_SYNC1)
+		return;
+	hunting = false;
+	nHistory = 0;
+	chTail = 0;
+	scrambler = SCRAMBLE_SEED;
+	syncPacket(&packet);
+}
+
+/**
+ * 復号処理（遅延処理のハンドラ）
+ */
+static void
+decodeHandler(void)
+{
+	// 記録の終わった面を復号する（送信方式が決まるまでは 4 bit ずつ）
+	int32_t *frame = (int32_t *)pdInputs[bufBank ^ 1];
+	int32_t y[4];
+	const uint8_t b = nModes == MODE_HEADER && (mode & MODE_WALSH)
+		? decodeWalshFrame(&decoder, frame, y)
+		: decodeFrame(&decoder, frame, y);
+	recordCorrelations(y);
+
+	// 送信方式が決まるまでは 2 フレームで 1 文字
+	if (nModes < MODE_HEADER) {
+		chbuf[chTail++] = b;
+		if (chTail != 2)
+			return;
+		chTail = 0;
+		modes[nModes++] = chbuf[0] | chbuf[1] << 4;
+		if (nModes == MODE_HEADER) {
+			mode = voteMode(modes);
+			hunting = true;
+			scrambler = SCRAMBLE_SEED;
+		}
+		return;
+	}
+
+	// 枠にするなら、まず同期語を探す
+	if ((mode & MODE_FRAMED) && hunting) {
+		huntSync(b);
+		return;
+	}
+
+	// 送信方式に従って 1 文字分のフレームを揃えて復号する
+	chbuf[chTail++] = b;
+	if (chTail != modeByteFrames(mode))
+		return;
+	chTail = 0;
+	uint8_t c = decodeByte(chbuf, &telemetry.fecCorrected,
+			&telemetry.fecFailed);
+	if (mode & MODE_SCRAMBLE)
+		c ^= scrambleNext(&scrambler);
+	telemetry.bytes++;
+
+	// 出力用バッファに詰める（溢れたら捨てる）
+	if (!(mode & MODE_FRAMED)) {
+		if (mode & MODE_COMPRESS) {
+			uint8_t buf[LZ_MATCH_MAX];
+			const size_t n = feedLz(&lz, c, buf);
+			if (n > 0)
+				pushOutputs(buf, n);
+			return;
+		}
+		pushOutputs(&c, 1);
+		return;
+	}
+
+	// 枠が揃うか壊れていたら、次の同期語を探す
+	switch (feedPacket(&packet, c)) {
+	case PACKET_GOOD:
+		forwardPacket();
+		hunting = true;
+		break;
+	case PACKET_BAD:
+		telemetry.packetErrors++;
+		hunting = true;
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * 出力用バッファの中身をシリアル通信に出力する
+ */
+static void
+flushOutputs(void)
+{
+	while (outHead != outTail) {
+		Serial.print((char)outputs[outHead]);
+		outHead = (outHead + 1) % OUTPUT_BUFLEN;
+	}
+}
 
 /**
  * 強度推定状態を初期化する
@@ -131,19 +331,26 @@ void
 initReceiving(enum STATE precState, const struct Context *ctx)
 {
 	// バッファを巻き戻す
-	bufTail = 0;
+	bufBank = bufTail = 0;
 	chTail = 0;
+	outHead = outTail = 0;
+	nModes = 0;
+	mode = 0;
+	nHistory = 0;
+	hunting = false;
+	seqKnown = false;
+	initLz(&lz);
 
 	// 推定受信強度を格納する
-	intensities[0] = ctx->intensities[0] << 7;
-	intensities[1] = ctx->intensities[1] << 7;
-	nIntensities[0] = nIntensities[1] = 32;
+	initDecoder(&decoder, ctx->intensities, 32);
+
+	// 復号処理を遅延処理として登録する
+	setDeferredHandler(decodeHandler);
 
 	// チップ読み込みタイマを設定する
+	// （強度推定状態のチップ読み込み時刻をそのまま引き継ぐ）
 	timerPeriod = ctx->period;
-	TimerTc3.initialize(timerPeriod);
-	TimerTc3.attachInterrupt(tcHandler);
-	TimerTc3.start();
+	armTimerAt(&sampleTimer, ctx->nextSampleClock, timerPeriod, tcHandler);
 
 	// キャリア信号検出時の割り込みを設定する
 	lastCSClock = 0;
@@ -157,53 +364,8 @@ initReceiving(enum STATE precState, const struct Context *ctx)
 void
 mainReceiving(void)
 {
-	// フレームが揃っていないなら何もしない
-	if (bufTail != INPUT_BUFLEN)
-		return;
-
-	/** 符号語テーブル w[k,l,0] - w[k,l,1] */
-	constexpr int32_t decodeTab[2][16] = {
-		{ 1, 0,-1, 0, -1, 0, 1, 0,  0,-1, 0, 1,  0, 1, 0,-1 },
-		{ 0, 1, 0,-1,  0,-1, 0, 1, -1, 0, 1, 0,  1, 0,-1, 0 },
-	};
-
-	// 第 1 層を復号する
-	const int32_t y11 = gamma(decodeTab[0], (int32_t *)pdInputs, 16);
-	const int32_t y21 = gamma(decodeTab[1], (int32_t *)pdInputs, 16);
-	const int i11 = y11 > 0 ? 0 : 1;
-	const int i21 = y21 > 0 ? 0 : 1;
-
-	// 第 1 層の推定強度を更新する
-	intensities[0] += abs(y11) + abs(y21);
-	nIntensities[0] += 2;
-
-	// 第 1 層の信号を差し引く
-	for (int i = 0; i < 16; i++) {
-		int32_t t = 0;
-		t += i11 == 0 ? (decodeTab[0][i] > 0) : (decodeTab[0][i] < 0);
-		t += i21 == 0 ? (decodeTab[1][i] > 0) : (decodeTab[1][i] < 0);
-		pdInputs[i] -= (intensities[0] / nIntensities[0] / 4) * t;
-	}
-
-	// 第 2 層を復号する
-	const int32_t y12 = gamma(decodeTab[0], (int32_t *)pdInputs, 16);
-	const int32_t y22 = gamma(decodeTab[1], (int32_t *)pdInputs, 16);
-	const int i12 = y12 < 0 ? 0 : 1;	// 第 2 層は符号が逆
-	const int i22 = y22 < 0 ? 0 : 1;	// 第 2 層は符号が逆
-
-	// 第 2 層の推定強度を更新する
-	intensities[1] += abs(y12) + abs(y22);
-	nIntensities[1] += 2;
-
-	// 情報信号を復号する
-	chbuf[chTail++] = i22 << 3 | i12 << 2 | i21 << 1 | i11 << 0;
-	if (chTail == 2) {
-		Serial.print((char)(chbuf[0] | chbuf[1] << 4));
-		chTail=0;
-	}
-
-	// バッファを巻き戻す
-	bufTail = 0;
+	// 復号済みの文字を出力する
+	flushOutputs();
 }
 
 /**
@@ -214,13 +376,16 @@ exitReceiving(enum STATE nextState)
 {
 	static struct Context ctx;
 
-	// チップ読み込みタイマを停止し、割り込みを解除する
-	TimerTc3.stop();
-	TimerTc3.detachInterrupt();
+	// チップ読み込みタイマを解除する
+	cancelTimer(&sampleTimer);
 
 	// キャリア信号検出時の割り込みを解除する
 	detachInterrupt(CSINPUT);
 
+	// 遅延処理のハンドラを解除し、出力しそびれた文字を出力する
+	setDeferredHandler(NULL);
+	flushOutputs();
+
 	ctx.size = sizeof(ctx);
 	return &ctx;
 }
@@ -1,4 +1,6 @@
 #include "state.h"
+#include "telemetry.h"
+#include "trace.h"
 
 /**
  * 現在の状態
@@ -18,7 +20,15 @@ getState(void)
  * 現在の状態を設定する
  */
 enum STATE
-setState(enum STATE state)
+setState(enum STATE state, enum REASON reason)
 {
+	// 状態遷移を数えて記録する
+	if (state != currentState && state > STATE_XXX && state < STATE_MAX) {
+		traceTransition(currentState, state, reason);
+		telemetry.transitions[state]++;
+		if (currentState == STATE_SYNCING && state == STATE_WAITING)
+			telemetry.syncFailures++;
+	}
+
 	return currentState = state;
 }
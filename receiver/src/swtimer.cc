@@ -0,0 +1,293 @@
+#include <Arduino.h>
+
+#include "swtimer.h"
+
+/**
+ * TC3 を専有するタイマサービス
+ *
+ * TC3 を 1 MHz で回る 16 bit のフリーランカウンタとし、
+ * オーバーフローの回数と合わせて 64 bit の時刻（μs）を作る。
+ * 満了待ちのタイマは満了時刻順のリストで管理し、
+ * 先頭のタイマの満了時刻を比較レジスタ CC0 に設定する。
+ * 先頭のタイマの満了時刻が現在のカウンタの一周より先であれば、
+ * オーバーフローの割り込みで設定し直す。
+ *
+ * 各状態はタイマの再初期化や周期の変更を行わずに、
+ * 絶対時刻でタイマを設定したり、次の満了時刻をずらしたりできる。
+ * 周期タイマは満了時刻に周期を足していくので、割り込みの遅延が積もらない。
+ */
+
+#ifndef __SAMD21__
+#error This timer service supports SAMD21 only
+#endif
+
+/** TC3 に 1 MHz を供給するクロックジェネレータ（コアが使っていないもの） */
+#define TIMER_GCLK	4
+/** この時間以内に満了するタイマは比較レジスタを使わずに満了させる（μs） */
+#define MIN_LEAD	8
+
+/** 満了時刻順のタイマのリスト */
+static struct SwTimer * volatile timers = NULL;
+/** カウンタのオーバーフローの回数 */
+static volatile uint32_t overflows;
+
+static inline TcCount16 *
+tc(void)
+{
+	return (TcCount16 *)TC3;
+}
+
+/**
+ * 64 bit の時刻を読む（割り込み禁止で呼ぶ）
+ */
+static uint64_t
+readClock(void)
+{
+	uint32_t hi = overflows;
+	uint16_t lo = tc()->COUNT.reg;
+
+	// 未処理のオーバーフローがあれば数に入れる
+	if (tc()->INTFLAG.bit.OVF) {
+		lo = tc()->COUNT.reg;
+		if (lo < 0x8000)
+			hi++;
+	}
+
+	return (uint64_t)hi << 16 | lo;
+}
+
+/**
+ * 満了時刻順のリストにタイマを挿入する（割り込み禁止で呼ぶ）
+ */
+static void
+insertTimer(struct SwTimer *t)
+{
+	struct SwTimer * volatile *pp = &timers;
+
+	while (*pp != NULL && (*pp)->deadline <= t->deadline)
+		pp = &(*pp)->next;
+	t->next = *pp;
+	*pp = t;
+	t->armed = true;
+}
+
+/**
+ * 満了時刻順のリストからタイマを取り除く（割り込み禁止で呼ぶ）
+ */
+static void
+removeTimer(struct SwTimer *t)
+{
+	struct SwTimer * volatile *pp = &timers;
+
+	if (!t->armed)
+		return;
+	while (*pp != NULL && *pp != t)
+		pp = &(*pp)->next;
+	if (*pp != NULL)
+		*pp = t->next;
+	t->next = NULL;
+	t->armed = false;
+}
+
+/**
+ * 先頭のタイマの満了時刻を比較レジスタに設定する（割り込み禁止で呼ぶ）
+ */
+static void
+program(void)
+{
+	TcCount16 *TC = tc();
+	struct SwTimer *head = timers;
+
+	if (head == NULL) {
+		TC->INTENCLR.reg = TC_INTENCLR_MC0;
+		return;
+	}
+
+	// すぐに満了するなら割り込みを保留にして任せる
+	uint64_t now = readClock();
+	if (head->deadline <= now + MIN_LEAD) {
+		NVIC_SetPendingIRQ(TC3_IRQn);
+		return;
+	}
+
+	// カウンタの一周より先ならオーバーフローの割り込みに任せる
+	if (head->deadline >> 16 != now >> 16) {
+		TC->INTENCLR.reg = TC_INTENCLR_MC0;
+		return;
+	}
+
+	TC->CC[0].reg = (uint16_t)head->deadline;
+	while (TC->STATUS.bit.SYNCBUSY == 1)
+		;
+	TC->INTFLAG.reg = TC_INTFLAG_MC0;
+	TC->INTENSET.reg = TC_INTENSET_MC0;
+
+	// 設定している間に過ぎてしまったかもしれない
+	if (head->deadline <= readClock() + MIN_LEAD)
+		NVIC_SetPendingIRQ(TC3_IRQn);
+}
+
+/**
+ * TC3 の割り込みハンドラ
+ */
+void
+TC3_Handler(void)
+{
+	TcCount16 *TC = tc();
+
+	if (TC->INTFLAG.bit.OVF) {
+		TC->INTFLAG.reg = TC_INTFLAG_OVF;
+		overflows++;
+	}
+	if (TC->INTFLAG.bit.MC0)
+		TC->INTFLAG.reg = TC_INTFLAG_MC0;
+
+	// 満了したタイマのハンドラを呼ぶ
+	for (;;) {
+		struct SwTimer *t = timers;
+		if (t == NULL || t->deadline > readClock() + MIN_LEAD)
+			break;
+
+		removeTimer(t);
+		if (t->period != 0) {
+			t->deadline += t->period;
+			insertTimer(t);
+		}
+		t->handler();
+	}
+
+	program();
+}
+
+/**
+ * タイマサービスを開始する（TC3 を専有する）
+ */
+void
+startTimerService(void)
+{
+	TcCount16 *TC = tc();
+
+	// DFLL48M を 48 分周して 1 MHz を作り、TC3 に供給する
+	PM->APBCMASK.reg |= PM_APBCMASK_TC3;
+	GCLK->GENDIV.reg = GCLK_GENDIV_ID(TIMER_GCLK) | GCLK_GENDIV_DIV(48);
+	while (GCLK->STATUS.bit.SYNCBUSY == 1)
+		;
+	GCLK->GENCTRL.reg = GCLK_GENCTRL_ID(TIMER_GCLK)
+			| GCLK_GENCTRL_SRC_DFLL48M | GCLK_GENCTRL_GENEN;
+	while (GCLK->STATUS.bit.SYNCBUSY == 1)
+		;
+	GCLK->CLKCTRL.reg = (uint16_t)(GCLK_CLKCTRL_CLKEN
+			| GCLK_CLKCTRL_GEN(TIMER_GCLK)
+			| GCLK_CLKCTRL_ID(GCM_TCC2_TC3));
+	while (GCLK->STATUS.bit.SYNCBUSY == 1)
+		;
+
+	// 16 bit のフリーランカウンタにする
+	TC->CTRLA.reg &= ~TC_CTRLA_ENABLE;
+	while (TC->STATUS.bit.SYNCBUSY == 1)
+		;
+	TC->CTRLA.reg = TC_CTRLA_MODE_COUNT16 | TC_CTRLA_WAVEGEN_NFRQ
+			| TC_CTRLA_PRESCALER_DIV1;
+	while (TC->STATUS.bit.SYNCBUSY == 1)
+		;
+
+	// カウンタの値を常に読めるようにする
+	TC->READREQ.reg = TC_READREQ_RCONT
+			| TC_READREQ_ADDR(TC_COUNT16_COUNT_OFFSET);
+
+	// オーバーフローの割り込みを有効にして開始する
+	overflows = 0;
+	TC->INTENCLR.reg = TC_INTENCLR_MASK;
+	TC->INTFLAG.reg = TC_INTFLAG_MASK;
+	TC->INTENSET.reg = TC_INTENSET_OVF;
+	NVIC_EnableIRQ(TC3_IRQn);
+	TC->CTRLA.reg |= TC_CTRLA_ENABLE;
+	while (TC->STATUS.bit.SYNCBUSY == 1)
+		;
+}
+
+/**
+ * タイマサービスの時刻（μs）を得る
+ */
+uint64_t
+getTimerClock(void)
+{
+	const uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	const uint64_t now = readClock();
+	__set_PRIMASK(primask);
+
+	return now;
+}
+
+/**
+ * 時刻 deadline に満了するようにタイマを設定する
+ */
+void
+armTimerAt(struct SwTimer *t, uint64_t deadline, uint32_t period,
+		void (*handler)(void))
+{
+	const uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	removeTimer(t);
+	t->deadline = deadline;
+	t->period = period;
+	t->handler = handler;
+	insertTimer(t);
+	program();
+	__set_PRIMASK(primask);
+}
+
+/**
+ * 現在から delay 後に満了するようにタイマを設定する
+ */
+void
+armTimerIn(struct SwTimer *t, uint32_t delay, uint32_t period,
+		void (*handler)(void))
+{
+	armTimerAt(t, getTimerClock() + delay, period, handler);
+}
+
+/**
+ * 次の満了時刻を delta だけずらす（周期はそのまま）
+ */
+void
+shiftTimer(struct SwTimer *t, int32_t delta)
+{
+	const uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if (t->armed) {
+		removeTimer(t);
+		t->deadline += delta;
+		insertTimer(t);
+		program();
+	}
+	__set_PRIMASK(primask);
+}
+
+/**
+ * タイマを解除する
+ */
+void
+cancelTimer(struct SwTimer *t)
+{
+	const uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	removeTimer(t);
+	program();
+	__set_PRIMASK(primask);
+}
+
+/**
+ * タイマの次の満了時刻を得る
+ */
+uint64_t
+getTimerDeadline(const struct SwTimer *t)
+{
+	const uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	const uint64_t deadline = t->deadline;
+	__set_PRIMASK(primask);
+
+	return deadline;
+}
@@ -1,9 +1,9 @@
 #include <Arduino.h>
-#include <TimerTC3.h>
 
 #include "context.h"
 #include "inputs.h"
 #include "state.h"
+#include "swtimer.h"
 
 #include "synced.h"
 
@@ -17,19 +17,19 @@
  * 	強度推定状態
  *
  * 開始時の処理
- * 	同期信号の終端検知タイマの割り込みを設定し、開始する。
+ * 	同期信号の終端検知タイマを設定する。
  * 	キャリア信号検出時の割り込みを設定する。
  *
  * 動作中の処理
  * 	キャリア信号を検出すると、
  * 		現在のシステム時刻を記録し、
- * 		タイマをキャリア信号に同期させる（再開する）。
+ * 		終端検知タイマをキャリア信号に同期させる（設定し直す）。
  * 	終端検知タイマが満了すると、強度推定状態に遷移する。
  * 		→ 直前のスロットにキャリア信号がなかった（立ち下がらなかった）
  *
  * 終了時の処理
  * 	キャリア信号検出時の割り込みを解除する。
- * 	終端検知タイマの割り込みを停止し、解除する。
+ * 	終端検知タイマを解除する。
  * 	推定クロック周期及び最終スロットにキャリア信号があった場合の時刻を
  * 		遷移先の状態に引き継ぐ。
  */
@@ -38,6 +38,8 @@
 static sysclock_t timerPeriod;
 /** 最終キャリア検出時刻 */
 static volatile sysclock_t lastCSClock;
+/** 終端検知タイマ */
+static struct SwTimer endTimer;
 
 /**
  * 終端検知タイマのハンドラ
@@ -47,7 +49,7 @@ tcHandler(void)
 {
 	// 直前のスロットにキャリア検出信号がなければ強度推定状態に遷移する
 	if (getSysClock() - lastCSClock > timerPeriod)
-		setState(STATE_LEVELING);
+		setState(STATE_LEVELING, REASON_SYNC_END);
 }
 
 /**
@@ -60,7 +62,8 @@ csHandler(void)
 	lastCSClock = getSysClock();
 
 	// タイマを同期する
-	TimerTc3.restart();
+	armTimerAt(&endTimer, lastCSClock + timerPeriod * 9/8,
+			timerPeriod * 9/8, tcHandler);
 }
 
 /**
@@ -72,9 +75,7 @@ initSynced(enum STATE prevState, const struct Context *ctx)
 	// 同期信号の終端検知タイマ（やや長めに）を設定する
 	timerPeriod = ctx->period;
 	lastCSClock = ctx->lastCSClock;
-	TimerTc3.initialize(timerPeriod * 9/8);
-	TimerTc3.attachInterrupt(tcHandler);
-	//TimerTc3.start();	// ← 本当に必要か？
+	armTimerIn(&endTimer, timerPeriod * 9/8, timerPeriod * 9/8, tcHandler);
 
 	// キャリア信号検出時の割り込みを設定する
 	attachInterrupt(CSINPUT, csHandler, RISING);
@@ -101,9 +102,8 @@ exitSynced(enum STATE nextState)
 	// キャリア信号検出時の割り込みを解除する
 	detachInterrupt(CSINPUT);
 
-	// 終端検知タイマを停止し、割り込みを解除する
-	TimerTc3.stop();
-	TimerTc3.detachInterrupt();
+	// 終端検知タイマを解除する
+	cancelTimer(&endTimer);
 
 	// 推定クロック周期及びキャリア信号があった場合の時刻を書き込む
 	ctx.period = timerPeriod;
@@ -1,9 +1,10 @@
 #include <Arduino.h>
-#include <TimerTC3.h>
 
+#include "calib.h"
 #include "context.h"
 #include "inputs.h"
 #include "state.h"
+#include "swtimer.h"
 
 #include "syncing.h"
 
@@ -18,7 +19,7 @@
  * 	待ち状態（同期失敗時）
  *
  * 開始時の処理
- * 	同期信号の時間切れタイマ割り込みを設定し、開始する。
+ * 	同期信号の時間切れタイマを設定する。
  * 	キャリア信号検出時刻バッファを巻き戻す。
  * 	キャリア信号検出時の割り込みを設定する。
  *
@@ -27,15 +28,22 @@
  * 		時間切れタイマを延命し、
  * 		キャリア検出時刻を記録する。
  * 		所定回数だけ記録したら同期完了状態に遷移する。
+ * 		較正情報があれば、より少ない回数で推定したクロック周期が
+ * 			較正情報と合っている時点で同期完了状態に遷移する。
  * 	時間切れタイマが満了すると、
  * 		待ち状態に遷移する。
  *
  * 終了時の処理
  * 	キャリア信号検出時の割り込みを解除する。
- * 	時間切れタイマを停止し、割り込みを解除する。
+ * 	時間切れタイマを解除する。
  * 	推定クロック周期及び最終キャリア検出時刻を遷移先の状態に引き継ぐ。
  */
 
+/** 時間切れタイマ */
+static struct SwTimer timeoutTimer;
+/** 時間切れまでの時間（μs） */
+static uint32_t timeout;
+
 /**
  * 時間切れタイマのハンドラ
  */
@@ -43,10 +51,7 @@ static void
 tcHandler(void)
 {
 	// 時間切れなので待ち状態に遷移する
-	setState(STATE_WAITING);
-
-	// 時間切れタイマを停止する
-	TimerTc3.stop();
+	setState(STATE_WAITING, REASON_CS_TIMEOUT);
 }
 
 /** キャリア信号検出時刻用バッファ */
@@ -55,6 +60,11 @@ static volatile sysclock_t csClocks[CLOCK_BUFLEN];
 /** バッファの末尾位置 */
 static volatile size_t bufTail;
 
+/** 較正情報があるときに同期完了とみなすキャリア信号の検出回数 */
+#define WARM_CLOCKS	16
+/** 較正情報のクロック周期（較正情報がないか、合わないなら 0） */
+static sysclock_t warmPeriod;
+
 /**
  * キャリア信号検出時のハンドラ
  */
@@ -62,15 +72,25 @@ static void
 csHandler(void)
 {
 	// 時間切れタイマを延命する
-	TimerTc3.restart();
+	armTimerIn(&timeoutTimer, timeout, 0, tcHandler);
 
 	// キャリア信号検出時刻を記録する
 	if (bufTail < CLOCK_BUFLEN)
 		csClocks[bufTail++] = getSysClock();
 
+	// 較正情報と合うクロック周期を推定できたら同期完了待ち状態に遷移する
+	if (warmPeriod != 0 && bufTail == WARM_CLOCKS) {
+		const sysclock_t period = (csClocks[WARM_CLOCKS-1] - csClocks[0])
+				/ (WARM_CLOCKS - 1);
+		const sysclock_t diff = period > warmPeriod
+				? period - warmPeriod : warmPeriod - period;
+		if (diff < warmPeriod / 32)
+			setState(STATE_SYNCED, REASON_SYNC_DONE);
+	}
+
 	// バッファの末尾まで記録したら同期完了待ち状態に遷移する
 	if (bufTail == CLOCK_BUFLEN)
-		setState(STATE_SYNCED);
+		setState(STATE_SYNCED, REASON_SYNC_DONE);
 }
 
 /**
@@ -79,14 +99,20 @@ csHandler(void)
 void
 initSyncing(enum STATE precState, const struct Context *ctx)
 {
-	// キャリア信号検出の時間切れタイマを設定する
-	TimerTc3.setPeriod(ctx->period * 3/2);
-	TimerTc3.attachInterrupt(tcHandler);
-	//TimerTc3.start();	// ← 本当に必要か？
-
 	// バッファの末尾位置を先頭まで巻き戻す
 	bufTail = 0;
 
+	// 較正情報のクロック周期が 2 回のキャリア信号から推定したものと合えば使う
+	const struct Calibration *cal = getCalibration();
+	warmPeriod = 0;
+	if (cal != NULL && ctx->period > cal->period * 7/8
+			&& ctx->period < cal->period * 9/8)
+		warmPeriod = cal->period;
+
+	// キャリア信号検出の時間切れタイマを設定する
+	timeout = (warmPeriod != 0 ? warmPeriod : ctx->period) * 3/2;
+	armTimerIn(&timeoutTimer, timeout, 0, tcHandler);
+
 	// キャリア信号検出時の割り込みを設定する
 	attachInterrupt(CSINPUT, csHandler, RISING);
 }
@@ -112,9 +138,8 @@ exitSyncing(enum STATE nextState)
 	// キャリア信号検出時の割り込みを解除する
 	detachInterrupt(CSINPUT);
 
-	// 時間切れタイマを停止し、割り込みを解除する
-	TimerTc3.stop();
-	TimerTc3.detachInterrupt();
+	// 時間切れタイマを解除する
+	cancelTimer(&timeoutTimer);
 
 	// 待ち状態に移行するなら何も書き込まずに終了する
 	if (nextState == STATE_WAITING) {
@@ -123,13 +148,14 @@ exitSyncing(enum STATE nextState)
 	}
 
 	// キャリア信号検出時刻から計算される推定クロック周期を書き込む
+	const size_t n = bufTail;
 	ctx.period = 0;
-	for (size_t i = 1; i < CLOCK_BUFLEN; i++)
+	for (size_t i = 1; i < n; i++)
 		ctx.period += csClocks[i-0] - csClocks[i-1];
-	ctx.period /= CLOCK_BUFLEN - 1;
+	ctx.period /= n - 1;
 
 	// 最終キャリア信号検出時刻を書き込む
-	ctx.lastCSClock = csClocks[CLOCK_BUFLEN-1];
+	ctx.lastCSClock = csClocks[n-1];
 
 	ctx.size = sizeof(ctx);
 	return &ctx;
@@ -1,22 +1,14 @@
-#include <TimerTCC0.h>
+#include "swtimer.h"
 
 #include "sysclock.h"
 
-/** 実際にカウントアップするタイマの時間（μs）*/
-#define DURATION	57
-
-/** システム時刻の実体（μs）*/
-static volatile uint64_t sysClock;
-
 /**
- * タイマのハンドラ
- * システム時刻をカウントアップする
+ * システム時刻（μs）
+ *
+ * タイマサービスの時刻をそのまま使う。
+ * キャリア信号の検出時刻とタイマの満了時刻とが同じ時間軸に載るので、
+ * 各状態はキャリア信号の検出時刻を基準にタイマを設定できる。
  */
-static void
-tccHandler(void)
-{
-	sysClock += DURATION;
-}
 
 /**
  * システム時刻のカウントを開始する
@@ -24,8 +16,7 @@ tccHandler(void)
 void
 startSysClock(void)
 {
-	TimerTcc0.initialize(DURATION);
-	TimerTcc0.attachInterrupt(tccHandler);
+	startTimerService();
 }
 
 /**
@@ -34,5 +25,5 @@ startSysClock(void)
 sysclock_t
 getSysClock(void)
 {
-	return sysClock;
+	return getTimerClock();
 }
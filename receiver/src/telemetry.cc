@@ -0,0 +1,94 @@
+#include <Arduino.h>
+#include <math.h>
+
+#include "context.h"
+#include "state.h"
+
+#include "telemetry.h"
+
+/**
+ * 受信機の動作統計
+ *
+ * 各状態の割り込みハンドラや遅延処理が直接カウントアップする。
+ * 報告は 1 行の key=value 形式で、次の項目を含む。
+ *
+ * 	tr	各状態へ遷移した回数（状態識別子の順）
+ * 	sf	同期に失敗した回数
+ * 	ch	読み込んだチップの数
+ * 	fr	復号したフレームの数
+ * 	by	復号した文字の数
+ * 	dr	出力用バッファが溢れて捨てた文字の数
+ * 	fc	誤り訂正で訂正した符号語の数
+ * 	fu	誤り訂正で訂正できなかった符号語の数
+ * 	pk	CRC の合った枠の数
+ * 	pe	壊れていた枠の数
+ * 	pl	通し番号から失われたと分かった枠の数
+ * 	dl	周期誤差補正でタイマを遅らせた回数
+ * 	ad	周期誤差補正でタイマを早めた回数
+ * 	pd	推定クロック周期（μs）
+ * 	dt	補正回数から推定した周期のずれ（ppm、正なら送信機が速い）
+ * 	in	各層の推定強度
+ * 	sn	各層の相関値から推定した SN 比（0.1 dB 単位、前回の報告以降）
+ */
+
+struct Telemetry telemetry;
+
+/**
+ * 層 level の相関値の広がりから SN 比を推定する（0.1 dB 単位）
+ */
+static long
+estimateSNR(const struct Telemetry *t, int level)
+{
+	const uint32_t n = t->nY[level];
+	if (n < 2)
+		return 0;
+
+	const float mean = (float)t->sumY[level] / n;
+	const float var = (float)t->sumY2[level] / n - mean * mean;
+	if (var <= 0)
+		return 999;
+
+	return lroundf(100 * log10f(mean * mean / var));
+}
+
+/**
+ * 動作統計をシリアル通信に一行で報告する
+ */
+void
+reportTelemetry(void)
+{
+	// 割り込みで書き換わらないうちに写しておく
+	noInterrupts();
+	const struct Telemetry t = telemetry;
+	for (int l = 0; l < LEVELS; l++) {
+		telemetry.nY[l] = 0;
+		telemetry.sumY[l] = telemetry.sumY2[l] = 0;
+	}
+	interrupts();
+
+	// 補正 1 回あたり 3/8 周期ずれる
+	long drift = 0;
+	if (t.chips > 0)
+		drift = (long)((int64_t)((int32_t)t.advances - (int32_t)t.delays)
+				* 375000 / t.chips);
+
+	Serial.print("#T tr=");
+	for (int s = 0; s < STATE_MAX; s++)
+		Serial.printf("%s%lu", s == 0 ? "" : ",",
+				(unsigned long)t.transitions[s]);
+	Serial.printf(" sf=%lu ch=%lu fr=%lu by=%lu dr=%lu",
+			(unsigned long)t.syncFailures, (unsigned long)t.chips,
+			(unsigned long)t.frames, (unsigned long)t.bytes,
+			(unsigned long)t.drops);
+	Serial.printf(" fc=%lu fu=%lu", (unsigned long)t.fecCorrected,
+			(unsigned long)t.fecFailed);
+	Serial.printf(" pk=%lu pe=%lu pl=%lu", (unsigned long)t.packets,
+			(unsigned long)t.packetErrors,
+			(unsigned long)t.packetsLost);
+	Serial.printf(" dl=%lu ad=%lu pd=%lu dt=%ld",
+			(unsigned long)t.delays, (unsigned long)t.advances,
+			(unsigned long)t.period, drift);
+	Serial.printf(" in=%ld,%ld sn=%ld,%ld\r\n",
+			(long)t.intensities[0], (long)t.intensities[1],
+			estimateSNR(&t, 0), estimateSNR(&t, 1));
+}
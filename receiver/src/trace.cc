@@ -0,0 +1,99 @@
+#include <Arduino.h>
+
+#include "context.h"
+#include "state.h"
+#include "sysclock.h"
+
+#include "trace.h"
+
+/**
+ * 状態遷移の記録用リングバッファ
+ *
+ * 書き込み側（setState() を呼ぶ割り込みハンドラや loop()）は、
+ * 通し番号を払い出す一瞬だけ割り込みを禁止し、
+ * 記録の通し番号を 0 にしてから中身を書き、最後に通し番号を書く。
+ * 読み出し側は中身を写す前後で通し番号が変わっていないことを確かめる。
+ * そのため、受信を止めずに、いつでもダンプできる。
+ */
+
+/** 記録の数（2 の冪） */
+#define TRACE_LEN	32
+static volatile struct TraceEntry traces[TRACE_LEN];
+/** 次に払い出す通し番号 */
+static volatile uint32_t nextSeq = 1;
+
+/**
+ * 記録を一つ書き込む
+ */
+static void
+putTrace(enum STATE from, enum STATE to, enum REASON reason,
+		const struct Context *ctx)
+{
+	// 通し番号を払い出す
+	const uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	const uint32_t seq = nextSeq++;
+	__set_PRIMASK(primask);
+
+	volatile struct TraceEntry *e = &traces[seq % TRACE_LEN];
+	e->seq = 0;
+	e->clock = (uint32_t)getSysClock();
+	e->from = from;
+	e->to = to;
+	e->reason = reason;
+	e->period = ctx == NULL ? 0 : (uint32_t)ctx->period;
+	for (int l = 0; l < LEVELS; l++)
+		e->intensities[l] = ctx == NULL ? 0 : ctx->intensities[l];
+	e->seq = seq;
+}
+
+/**
+ * 状態遷移を記録する（割り込みハンドラから呼んでよい）
+ */
+void
+traceTransition(enum STATE from, enum STATE to, enum REASON reason)
+{
+	putTrace(from, to, reason, NULL);
+}
+
+/**
+ * 遷移先へ引き継いだコンテキスト情報を記録する
+ */
+void
+traceHandover(enum STATE from, enum STATE to, const struct Context *ctx)
+{
+	putTrace(from, to, REASON_HANDOVER, ctx);
+}
+
+/**
+ * 状態遷移の記録を古いものから順にシリアル通信にダンプする
+ */
+void
+dumpTrace(void)
+{
+	const uint32_t last = nextSeq;
+	const uint32_t first = last > TRACE_LEN ? last - TRACE_LEN : 1;
+
+	for (uint32_t seq = first; seq < last; seq++) {
+		volatile struct TraceEntry *e = &traces[seq % TRACE_LEN];
+		struct TraceEntry t;
+
+		// 写している間に上書きされたものは飛ばす
+		if (e->seq != seq)
+			continue;
+		t.clock = e->clock;
+		t.from = e->from;
+		t.to = e->to;
+		t.reason = e->reason;
+		t.period = e->period;
+		for (int l = 0; l < LEVELS; l++)
+			t.intensities[l] = e->intensities[l];
+		if (e->seq != seq)
+			continue;
+
+		Serial.printf("#R %lu %lu %d>%d %u %lu %ld,%ld\r\n",
+				(unsigned long)seq, (unsigned long)t.clock,
+				t.from, t.to, t.reason, (unsigned long)t.period,
+				(long)t.intensities[0], (long)t.intensities[1]);
+	}
+}
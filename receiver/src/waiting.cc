@@ -1,9 +1,10 @@
 #include <Arduino.h>
-#include <TimerTC3.h>
 
+#include "calib.h"
 #include "context.h"
 #include "inputs.h"
 #include "state.h"
+#include "swtimer.h"
 
 #include "waiting.h"
 
@@ -17,12 +18,14 @@
  * 	クロック同期状態
  *
  * 開始時の処理
+ * 	較正情報が更新されていればフラッシュメモリに書き込む。
+ * 		→ 書き込み中は CPU が止まるので、受信していないこの時点で行う。
  * 	キャリア信号検出時の割り込みを設定する。
- * 	同期開始中断のための時間切れタイマ割り込みを設定する（開始しない）。
+ * 	（同期開始中断のための時間切れタイマは、まだ設定しない）
  *
  * 動作中の処理
  * 	キャリア信号を検出すると、
- * 		同期開始中断のためのタイマを開始する。
+ * 		同期開始中断のための時間切れタイマを設定する。
  * 	時間切れタイマが満了すると、
  * 		キャリア信号検出時刻を忘れる。
  * 		→ ノイズを検出しただけだったと思う。
@@ -31,12 +34,16 @@
  *
  * 終了時の処理
  * 	キャリア信号検出時の割り込みを解除する。
- * 	時間切れタイマを停止し、割り込みを解除する。
+ * 	時間切れタイマを解除する。
  * 	推定クロック周期と最終キャリア検出時刻を遷移先の状態に引き継ぐ。
  */
 
 /** 1 回目及び 2 回目のキャリアセンス時刻 */
 static volatile sysclock_t lastCSClock, exitCSClock;
+/** 時間切れタイマ */
+static struct SwTimer timeoutTimer;
+/** 時間切れまでの時間（μs） */
+#define TIMEOUT	1000000L
 
 /**
  * 時間切れタイマのハンドラ
@@ -46,9 +53,6 @@ tcHandler(void)
 {
 	// 1 回目のキャリア信号検出時刻を忘れる
 	lastCSClock = -1;
-
-	// 時間切れタイマを停止する
-	TimerTc3.stop();
 }
 
 /**
@@ -63,15 +67,15 @@ csHandler(void)
 		exitCSClock = getSysClock();
 
 		// 同期状態へ移行する
-		setState(STATE_SYNCING);
+		setState(STATE_SYNCING, REASON_SECOND_CS);
 		return;
 	}
 
 	// 1 回目のキャリア信号検出時刻を記憶する
 	lastCSClock = getSysClock();
 
-	// 時間切れタイマを開始する
-	TimerTc3.restart();
+	// 時間切れタイマを設定する
+	armTimerIn(&timeoutTimer, TIMEOUT, 0, tcHandler);
 }
 
 /**
@@ -80,16 +84,14 @@ csHandler(void)
 void
 initWaiting(enum STATE prevState, const struct Context *ctx)
 {
+	// 較正情報が更新されていれば保存する
+	commitCalibration();
+
 	// 1 回目のキャリア信号検出時刻を忘れる
 	lastCSClock = -1;
 
 	// キャリア信号検出時の割り込みを設定する
 	attachInterrupt(CSINPUT, csHandler, RISING);
-
-	// 時間切れタイマの割り込みを設定する
-	TimerTc3.initialize(1000000L);
-	TimerTc3.attachInterrupt(tcHandler);
-	TimerTc3.stop();	// まだ開始しない
 }
 
 /**
@@ -113,9 +115,8 @@ exitWaiting(enum STATE nextState)
 	// キャリア信号検出の割り込みを解除する
 	detachInterrupt(CSINPUT);
 
-	// 時間切れタイマを停止し、割り込みを解除する
-	TimerTc3.stop();
-	TimerTc3.detachInterrupt();
+	// 時間切れタイマを解除する
+	cancelTimer(&timeoutTimer);
 
 	// 推定クロック周期と最終キャリア信号検出時刻を書き込む
 	ctx.period = exitCSClock - lastCSClock;
@@ -0,0 +1,38 @@
+#include <stddef.h>
+
+#include "calib.h"
+
+/**
+ * 較正情報（receiver/src/calib.cc の代用品）
+ * フラッシュメモリの代わりにメモリに保存する
+ */
+
+static struct Calibration current, stored;
+static bool valid = false, storedValid = false;
+
+void
+loadCalibration(void)
+{
+	current = stored;
+	valid = storedValid;
+}
+
+const struct Calibration *
+getCalibration(void)
+{
+	return valid ? &current : NULL;
+}
+
+void
+updateCalibration(const struct Calibration *cal)
+{
+	current = *cal;
+	valid = true;
+}
+
+void
+commitCalibration(void)
+{
+	stored = current;
+	storedValid = valid;
+}
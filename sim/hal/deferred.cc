@@ -0,0 +1,32 @@
+#include "world.h"
+
+#include "deferred.h"
+
+/**
+ * 遅延処理（receiver/src/deferred.cc の代用品）
+ * 割り込みハンドラの処理が終わった直後に続けて処理する
+ */
+
+void
+initDeferred(void)
+{
+	(void)0;
+}
+
+void
+setDeferredHandler(void (*handler)(void))
+{
+	simSetDeferredHandler(handler);
+}
+
+void
+pendDeferred(void)
+{
+	simPendDeferred();
+}
+
+void
+waitForInterrupt(void)
+{
+	simIdle();
+}
@@ -0,0 +1,122 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "world.h"
+
+#include "swtimer.h"
+
+/**
+ * タイマサービス（receiver/src/swtimer.cc の代用品）
+ * 仮想時計の上で満了時刻順のリストを処理する
+ */
+
+/** 満了時刻順のタイマのリスト */
+static struct SwTimer *timers = NULL;
+
+static void
+insertTimer(struct SwTimer *t)
+{
+	struct SwTimer **pp = &timers;
+
+	while (*pp != NULL && (*pp)->deadline <= t->deadline)
+		pp = &(*pp)->next;
+	t->next = *pp;
+	*pp = t;
+	t->armed = true;
+}
+
+static void
+removeTimer(struct SwTimer *t)
+{
+	struct SwTimer **pp = &timers;
+
+	if (!t->armed)
+		return;
+	while (*pp != NULL && *pp != t)
+		pp = &(*pp)->next;
+	if (*pp != NULL)
+		*pp = t->next;
+	t->next = NULL;
+	t->armed = false;
+}
+
+/**
+ * 次の満了時刻（μs、なければ UINT64_MAX）
+ */
+uint64_t
+simNextTimerDeadline(void)
+{
+	return timers == NULL ? UINT64_MAX : timers->deadline;
+}
+
+/**
+ * 満了したタイマのハンドラを呼ぶ
+ */
+void
+simDispatchTimers(void)
+{
+	for (;;) {
+		struct SwTimer *t = timers;
+		if (t == NULL || t->deadline > getTimerClock())
+			break;
+
+		removeTimer(t);
+		if (t->period != 0) {
+			t->deadline += t->period;
+			insertTimer(t);
+		}
+		t->handler();
+	}
+}
+
+void
+startTimerService(void)
+{
+	(void)0;
+}
+
+uint64_t
+getTimerClock(void)
+{
+	return simNow() / SIM_US;
+}
+
+void
+armTimerAt(struct SwTimer *t, uint64_t deadline, uint32_t period,
+		void (*handler)(void))
+{
+	removeTimer(t);
+	t->deadline = deadline;
+	t->period = period;
+	t->handler = handler;
+	insertTimer(t);
+}
+
+void
+armTimerIn(struct SwTimer *t, uint32_t delay, uint32_t period,
+		void (*handler)(void))
+{
+	armTimerAt(t, getTimerClock() + delay, period, handler);
+}
+
+void
+shiftTimer(struct SwTimer *t, int32_t delta)
+{
+	if (!t->armed)
+		return;
+	removeTimer(t);
+	t->deadline += delta;
+	insertTimer(t);
+}
+
+void
+cancelTimer(struct SwTimer *t)
+{
+	removeTimer(t);
+}
+
+uint64_t
+getTimerDeadline(const struct SwTimer *t)
+{
+	return t->deadline;
+}
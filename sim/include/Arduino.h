@@ -0,0 +1,104 @@
+#ifndef ARDUINO_H
+#define ARDUINO_H	1
+
+/**
+ * ホスト上で動かすための Arduino API の代用品
+ *
+ * 時刻は仮想時計（world.h）に従う。
+ * 割り込みは仮想時計のイベントとして、ファームウェアの待ち
+ * （delay() や WFI、シリアル通信の受信待ち）の間にだけ発生するので、
+ * 割り込みの禁止や許可は何もしない。
+ */
+
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <deque>
+#include <string>
+
+/** 端子番号（Seeed XIAO と同じ） */
+#define D0	0
+#define D1	1
+#define D2	2
+#define D3	3
+#define D4	4
+#define D5	5
+#define D6	6
+#define D7	7
+#define D8	8
+#define D9	9
+#define D10	10
+#define A0	D0
+#define A1	D1
+#define A2	D2
+#define A3	D3
+#define A4	D4
+#define A5	D5
+
+#define LOW	0
+#define HIGH	1
+
+#define INPUT	0
+#define OUTPUT	1
+
+#define CHANGE	2
+#define FALLING	3
+#define RISING	4
+
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int value);
+int digitalRead(int pin);
+int analogRead(int pin);
+void attachInterrupt(int pin, void (*isr)(void), int mode);
+void detachInterrupt(int pin);
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+
+static inline void noInterrupts(void) { }
+static inline void interrupts(void) { }
+static inline uint32_t __get_PRIMASK(void) { return 0; }
+static inline void __set_PRIMASK(uint32_t primask) { (void)primask; }
+static inline void __disable_irq(void) { }
+static inline void __enable_irq(void) { }
+
+/**
+ * シリアル通信
+ * 受信するものがなければ、仮想時計を次のイベントまで進めてから答える
+ */
+class SimSerial {
+public:
+	/** ファームウェアへの入力及びファームウェアからの出力 */
+	std::deque<uint8_t> input;
+	std::string output;
+
+	explicit operator bool() const { return true; }
+	void begin(unsigned long baud) { (void)baud; }
+	void flush(void) { }
+
+	int available(void);
+	int read(void);
+	int peek(void);
+
+	size_t write(uint8_t c);
+	size_t write(const uint8_t *buf, size_t len);
+	size_t print(char c) { return write((uint8_t)c); }
+	size_t print(const char *s);
+	size_t print(int n) { return printf("%d", n); }
+	size_t print(unsigned int n) { return printf("%u", n); }
+	size_t print(long n) { return printf("%ld", n); }
+	size_t print(unsigned long n) { return printf("%lu", n); }
+	size_t println(const char *s) { return print(s) + print("\r\n"); }
+	int printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+
+/** 受信機のシリアル通信（送信機の分は transmitter.cc にある） */
+extern SimSerial Serial;
+
+#endif	// !ARDUINO_H
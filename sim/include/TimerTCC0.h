@@ -0,0 +1,19 @@
+#ifndef TIMER_TCC0_H
+#define TIMER_TCC0_H	1
+
+/**
+ * ホスト上で動かすための TimerTCC0 の代用品（送信機の送信タイマ）
+ * 仮想時計の上で周期的に割り込みハンドラを呼ぶ
+ */
+class SimTimerTCC0 {
+public:
+	void initialize(double microseconds);
+	void setPeriod(double microseconds);
+	void attachInterrupt(void (*isr)(void));
+	void detachInterrupt(void);
+	void start(void);
+	void stop(void);
+	void restart(void);
+};
+
+#endif	// !TIMER_TCC0_H
@@ -0,0 +1,34 @@
+#ifndef TRANSMITTER_H
+#define TRANSMITTER_H	1
+
+#include <Arduino.h>
+
+/**
+ * 送信機を起動する
+ */
+void txSetup(void);
+
+/**
+ * 送信機の loop() を呼ぶ
+ */
+void txLoop(void);
+
+/**
+ * 送信機のシリアル通信
+ */
+SimSerial &txSerial(void);
+
+/**
+ * 送信中であるか
+ */
+bool txSending(void);
+
+/**
+ * 文字を送信機と同じ方法で送信パターンに変換する
+ * w[0][0] が最初の Layer 1 用、w[0][1] が最初の Layer 2 用
+ * w[1][0] がつぎの Layer 1 用、w[1][1] がつぎの Layer 2 用
+ * 送信機の状態には触れないので、どのスレッドから呼んでもよい
+ */
+void txEncodeChar(uint8_t c, uint32_t w[2][2]);
+
+#endif	// !TRANSMITTER_H
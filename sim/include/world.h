@@ -0,0 +1,90 @@
+#ifndef WORLD_H
+#define WORLD_H	1
+
+#include <stdint.h>
+
+/**
+ * 送信機と受信機とを載せる仮想世界
+ *
+ * 時刻は仮想時計（ns）で、次のイベントの時刻まで一気に進む。
+ * イベントは次の四つで、いずれも割り込みハンドラとして処理し、
+ * 処理の後に保留中の遅延処理（PendSV）を処理する。
+ *
+ * 	送信機の送信タイマ（TCC0）の満了
+ * 	受信機のタイマサービス（TC3）の満了
+ * 	受信機のキャリア検出器の立ち上がり
+ * 	ホスト（試験用のプログラム）の周期処理
+ */
+
+typedef uint64_t simtime_t;
+
+#define SIM_US	1000ULL
+#define SIM_MS	(1000 * SIM_US)
+#define SIM_S	(1000 * SIM_MS)
+
+/**
+ * 光の通信路のパラメータ
+ */
+struct SimChannel {
+	/** 各層の LED の受信強度（ADC の値） */
+	double gains[2];
+	/** 外乱光（ADC の値） */
+	double ambient;
+	/** 受信機の雑音の標準偏差（ADC の値） */
+	double noise;
+	/** LED の立ち上がり及び立ち下がりの時定数（ns） */
+	double riseTime;
+	/** 送信機のクロックのずれ（ppm） */
+	double clockOffset;
+	/** キャリア検出器の遅延（ns） */
+	simtime_t csDelay;
+};
+
+extern struct SimChannel simChannel;
+
+/**
+ * 現在の仮想時刻を得る
+ */
+simtime_t simNow(void);
+
+/**
+ * 次のイベントまで仮想時計を進め、そのイベントを処理する
+ */
+void simIdle(void);
+
+/**
+ * 乱数の種を設定する
+ */
+void simSeed(uint64_t seed);
+
+/**
+ * 標準正規分布に従う乱数を得る
+ */
+double simGaussian(void);
+
+/**
+ * ホストの周期処理を設定する
+ */
+void simSetHost(void (*tick)(void), simtime_t interval);
+
+/**
+ * 最初に LED が点灯した時刻（点灯していなければ 0）
+ */
+simtime_t simFirstLight(void);
+
+/* 受信機側（HAL の代用品及び arduino.cc から使う） */
+int simAnalogRead(void);
+void simAttachCS(void (*isr)(void));
+void simDetachCS(void);
+void simRunDeferred(void);
+void simPendDeferred(void);
+void simSetDeferredHandler(void (*handler)(void));
+uint64_t simNextTimerDeadline(void);
+void simDispatchTimers(void);
+
+/* 送信機側（transmitter.cc から使う） */
+void simSetLed(int layer, int on);
+void simSetTxTimer(double periodUs, void (*isr)(void));
+void simStopTxTimer(void);
+
+#endif	// !WORLD_H
@@ -0,0 +1,137 @@
+#include <Arduino.h>
+
+#include "world.h"
+
+/**
+ * ホスト上で動かすための Arduino API の代用品（受信機側）
+ */
+
+/** 光検出器及びキャリア検出器の端子（receiver/include/inputs.h と同じ） */
+#define PDINPUT	A2
+#define CSINPUT	D3
+
+SimSerial Serial;
+
+void
+pinMode(int pin, int mode)
+{
+	(void)pin;
+	(void)mode;
+}
+
+void
+digitalWrite(int pin, int value)
+{
+	// デバッグ用の出力しかないので捨てる
+	(void)pin;
+	(void)value;
+}
+
+int
+digitalRead(int pin)
+{
+	(void)pin;
+	return LOW;
+}
+
+int
+analogRead(int pin)
+{
+	return pin == PDINPUT ? simAnalogRead() : 0;
+}
+
+void
+attachInterrupt(int pin, void (*isr)(void), int mode)
+{
+	(void)mode;
+	if (pin == CSINPUT)
+		simAttachCS(isr);
+}
+
+void
+detachInterrupt(int pin)
+{
+	if (pin == CSINPUT)
+		simDetachCS();
+}
+
+unsigned long
+millis(void)
+{
+	return simNow() / SIM_MS;
+}
+
+unsigned long
+micros(void)
+{
+	return simNow() / SIM_US;
+}
+
+void
+delay(unsigned long ms)
+{
+	const simtime_t until = simNow() + ms * SIM_MS;
+
+	while (simNow() < until)
+		simIdle();
+}
+
+int
+SimSerial::available(void)
+{
+	if (input.empty())
+		simIdle();
+	return input.size();
+}
+
+int
+SimSerial::read(void)
+{
+	if (input.empty())
+		return -1;
+
+	const int c = input.front();
+	input.pop_front();
+	return c;
+}
+
+int
+SimSerial::peek(void)
+{
+	return input.empty() ? -1 : input.front();
+}
+
+size_t
+SimSerial::write(uint8_t c)
+{
+	output.push_back((char)c);
+	return 1;
+}
+
+size_t
+SimSerial::write(const uint8_t *buf, size_t len)
+{
+	output.append((const char *)buf, len);
+	return len;
+}
+
+size_t
+SimSerial::print(const char *s)
+{
+	return write((const uint8_t *)s, strlen(s));
+}
+
+int
+SimSerial::printf(const char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+
+	va_start(ap, fmt);
+	const int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (n > 0)
+		output.append(buf, (size_t)n < sizeof(buf) ? n : sizeof(buf) - 1);
+
+	return n;
+}
@@ -0,0 +1,481 @@
+#include <err.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "decoder.h"
+#include "transmitter.h"
+
+/**
+ * 光の通信路のシミュレータ
+ *
+ * 送信機と同じ方法で作った送信パターンを通信路に通し、
+ * 受信機と同じ方法（チップの読み込み時刻の補正及び復号器）で復号して、
+ * ビット誤り率を測定する。
+ * 同期及び強度推定の終端検出は扱わない（sim を使うこと）。
+ *
+ * 1 回の試行では強度推定のパターンと乱数の文字列とを送り、
+ * 受信機は強度推定のパターンで推定受信強度を求めてから文字列を復号する。
+ * 試行は SN 比ごとに全てのスレッドで分担する。
+ */
+
+#define CHIPRATE	"300"
+#define NBITS		1000000
+#define RUNLEN		1024
+
+/** 強度推定のパターン（transmitter の sendLevelCheck() と同じ） */
+static const uint8_t levelCheck[] = {
+	0x21, 0x94, 0x63, 0xAD, 0xB5, 0xF7, 0xCE, 0x08,
+};
+#define NLEVELCHECK	(sizeof(levelCheck) / sizeof(levelCheck[0]))
+
+/**
+ * 通信路のパラメータ
+ */
+struct Channel {
+	/** チップレート */
+	unsigned long chipRate;
+	/** 各層の受信強度、外乱光及び雑音の標準偏差（ADC の値） */
+	double gains[2];
+	double ambient;
+	double noise;
+	/** LED の立ち上がり及び立ち下がりの時定数（μs） */
+	double riseTime;
+	/** 送信機のクロックのずれ（ppm）及びその変化（ppm/s） */
+	double clockOffset;
+	double clockDrift;
+};
+
+/**
+ * 乱数生成器（xorshift64*、スレッドごとに持つ）
+ */
+struct Rng {
+	uint64_t s = 0;
+	bool hasSpare = false;
+	double spare = 0;
+};
+
+/**
+ * splitmix64 で混ぜる
+ */
+static uint64_t
+mix(uint64_t x)
+{
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ x >> 30) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ x >> 27) * 0x94D049BB133111EBULL;
+	return x ^ x >> 31;
+}
+
+static void
+seedRng(struct Rng *r, uint64_t seed)
+{
+	// 種が近くても系列が似ないように混ぜる
+	seed = mix(seed);
+	r->s = seed != 0 ? seed : 88172645463325252ULL;
+	r->hasSpare = false;
+}
+
+static uint64_t
+nextRng(struct Rng *r)
+{
+	r->s ^= r->s >> 12;
+	r->s ^= r->s << 25;
+	r->s ^= r->s >> 27;
+	return r->s * 2685821657736338717ULL;
+}
+
+/**
+ * 標準正規分布に従う乱数を得る（極座標法）
+ */
+static double
+gaussian(struct Rng *r)
+{
+	double u, v, s;
+
+	if (r->hasSpare) {
+		r->hasSpare = false;
+		return r->spare;
+	}
+
+	do {
+		u = (nextRng(r) >> 11) * (2.0 / 9007199254740992.0) - 1;
+		v = (nextRng(r) >> 11) * (2.0 / 9007199254740992.0) - 1;
+		s = u * u + v * v;
+	} while (s >= 1 || s == 0);
+	s = sqrt(-2 * log(s) / s);
+	r->spare = v * s;
+	r->hasSpare = true;
+	return u * s;
+}
+
+/**
+ * 1 回の試行の結果
+ */
+struct Result {
+	size_t bits;
+	size_t errors;
+};
+
+/**
+ * 1 回の試行を行う
+ * words は試行ごとに使い回す作業領域（各層 (NLEVELCHECK + len) * 2 ワード）
+ */
+static void
+runOnce(const struct Channel *ch, size_t len, uint64_t seed,
+		uint32_t *words[2], uint8_t *payload, struct Result *res)
+{
+	struct Rng rng;
+	uint32_t w[2][2];
+	size_t nWords;
+
+	seedRng(&rng, seed);
+
+	// 送信パターンを作る
+	nWords = 0;
+	for (size_t i = 0; i < NLEVELCHECK + len; i++) {
+		uint8_t c;
+		if (i < NLEVELCHECK) {
+			c = levelCheck[i];
+		} else {
+			c = nextRng(&rng) >> 56;
+			payload[i - NLEVELCHECK] = c;
+		}
+		txEncodeChar(c, w);
+		for (size_t j = 0; j < 2; j++) {
+			words[0][nWords] = w[j][0];
+			words[1][nWords] = w[j][1];
+			nWords++;
+		}
+	}
+	const size_t nSlots = nWords * 32;
+
+	// 送信機のスロット時間（μs）と受信機の推定クロック周期（μs）
+	const double slot = 500000.0 / ch->chipRate;
+	const double period = lround(2 * slot);
+	const double decay = ch->riseTime > 0 ? 1 / ch->riseTime : 0;
+
+	// 送信機の状態（プレアンブルの最終スロットは両層とも点灯）
+	size_t k = 0;
+	double slotStart = 0, slotEnd = slot;
+	double from[2] = { 1, 1 }, to[2];
+	double lastEdge = -2 * slot;
+	for (int l = 0; l < 2; l++)
+		to[l] = words[l][0] & 1;
+
+	// 受信機の状態（最初のチップの中央から読み込む）
+	struct Decoder dec;
+	int32_t frame[FRAME_CHIPS];
+	size_t nChips = 0, nFrames = 0, nBytes = 0;
+	int nibble = 0;
+	double sampleAt = period / 2;
+
+	initDecoder(&dec, NULL, 0);
+	while (nBytes < len) {
+		// 読み込み時刻まで送信機を進める
+		while (sampleAt >= slotEnd && k < nSlots) {
+			bool carrier = to[0] > 0 || to[1] > 0;
+			for (int l = 0; l < 2; l++) {
+				if (decay > 0)
+					from[l] = to[l] + (from[l] - to[l])
+						* exp(-(slotEnd - slotStart) * decay);
+				else
+					from[l] = to[l];
+			}
+			k++;
+			slotStart = slotEnd;
+			const double ppm = ch->clockOffset
+					+ ch->clockDrift * slotStart * 1e-6;
+			slotEnd += slot * (1 + ppm * 1e-6);
+			for (int l = 0; l < 2; l++)
+				to[l] = k < nSlots
+					? words[l][k / 32] >> (k % 32) & 1 : 0;
+			if (!carrier && (to[0] > 0 || to[1] > 0))
+				lastEdge = slotStart;
+		}
+		if (k >= nSlots)
+			break;
+
+		// チップ輝度を測定する（ADC と同じく 0 から 1023 に丸める）
+		double x = ch->ambient;
+		const double e = decay > 0
+				? exp(-(sampleAt - slotStart) * decay) : 0;
+		for (int l = 0; l < 2; l++)
+			x += ch->gains[l] * (to[l] + (from[l] - to[l]) * e);
+		if (ch->noise > 0)
+			x += ch->noise * gaussian(&rng);
+		frame[nChips++] = x < 0 ? 0 : x > 1023 ? 1023 : lround(x);
+
+		// 周期誤差補正（受信機と同じく次の読み込みを 3/8 周期ずらす）
+		const double diff = sampleAt - lastEdge;
+		sampleAt += period;
+		if (diff <= period) {
+			if (diff < period * 1/4)
+				sampleAt += period * 3/8;
+			else if (diff > period * 3/4)
+				sampleAt -= period * 3/8;
+		}
+
+		if (nChips != FRAME_CHIPS)
+			continue;
+		nChips = 0;
+
+		// 復号する（強度推定のパターンの後は受信状態と同じ重みで）
+		const int d = decodeFrame(&dec, frame, NULL);
+		if (++nFrames == NLEVELCHECK * 2) {
+			int32_t in[LEVELS];
+			for (int l = 0; l < LEVELS; l++)
+				in[l] = getIntensity(&dec, l);
+			initDecoder(&dec, in, 32);
+		}
+		if (nFrames <= NLEVELCHECK * 2)
+			continue;
+		if (nFrames % 2 == 1) {
+			nibble = d;
+			continue;
+		}
+		res->errors += __builtin_popcount(
+				(payload[nBytes++] ^ (nibble | d << 4)) & 0xFF);
+	}
+
+	// 受け取れなかった文字は全ビット誤りとする
+	res->bits += len * 8;
+	res->errors += (len - nBytes) * 8;
+}
+
+/**
+ * スレッド間で共有する測定点
+ */
+struct Point {
+	const struct Channel *ch;
+	size_t len;
+	uint64_t seed;
+	/** 試行の総数、次に割り当てる試行 */
+	size_t nRuns, next;
+	struct Result res;
+	pthread_mutex_t lock;
+};
+
+static void *
+worker(void *arg)
+{
+	struct Point *pt = (struct Point *)arg;
+	struct Result res = { 0, 0 };
+	uint32_t *words[2];
+	uint8_t *payload;
+
+	const size_t nWords = (NLEVELCHECK + pt->len) * 2;
+	words[0] = (uint32_t *)malloc(nWords * sizeof(uint32_t));
+	words[1] = (uint32_t *)malloc(nWords * sizeof(uint32_t));
+	payload = (uint8_t *)malloc(pt->len);
+	if (words[0] == NULL || words[1] == NULL || payload == NULL)
+		err(EXIT_FAILURE, "malloc");
+
+	for (;;) {
+		(void)pthread_mutex_lock(&pt->lock);
+		const size_t run = pt->next < pt->nRuns ? pt->next++ : SIZE_MAX;
+		(void)pthread_mutex_unlock(&pt->lock);
+		if (run == SIZE_MAX)
+			break;
+
+		// 試行ごとの種はスレッド数によらない
+		runOnce(pt->ch, pt->len, pt->seed + run, words, payload, &res);
+	}
+
+	(void)pthread_mutex_lock(&pt->lock);
+	pt->res.bits += res.bits;
+	pt->res.errors += res.errors;
+	(void)pthread_mutex_unlock(&pt->lock);
+
+	free(words[0]);
+	free(words[1]);
+	free(payload);
+
+	return NULL;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: chansim [-a ambient] [-d drift] [-e noise]"
+			" [-g gain1,gain2] [-j threads] [-l bytes]\n"
+			"\t[-n bits] [-p ppm] [-r seed] [-S from,to,step]"
+			" [-s speed] [-t rise]\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct Channel ch;
+	struct timespec ts0, ts1;
+	pthread_t *threads;
+	size_t len, nBits, nThreads, total;
+	unsigned long seed;
+	double snrFrom, snrTo, snrStep;
+	int c;
+	bool sweep;
+	char *endp, *speed;
+
+	memset(&ch, 0, sizeof(ch));
+	ch.gains[0] = 300;
+	ch.gains[1] = 150;
+	ch.ambient = 50;
+	speed = (char *)CHIPRATE;
+	len = RUNLEN;
+	nBits = NBITS;
+	nThreads = 0;
+	seed = 1;
+	sweep = false;
+	snrFrom = snrTo = snrStep = 0;
+	while ((c = getopt(argc, argv, "a:d:e:g:j:l:n:p:r:S:s:t:")) != -1)
+		switch (c) {
+		case 'a':
+			ch.ambient = strtod(optarg, &endp);
+			if (*endp != '\0')
+				errx(EXIT_FAILURE, "invalid ambient");
+			break;
+		case 'd':
+			ch.clockDrift = strtod(optarg, &endp);
+			if (*endp != '\0')
+				errx(EXIT_FAILURE, "invalid drift");
+			break;
+		case 'e':
+			ch.noise = strtod(optarg, &endp);
+			if (ch.noise < 0 || *endp != '\0')
+				errx(EXIT_FAILURE, "invalid noise");
+			break;
+		case 'g':
+			ch.gains[0] = strtod(optarg, &endp);
+			if (*endp != ',')
+				errx(EXIT_FAILURE, "invalid gains");
+			ch.gains[1] = strtod(endp + 1, &endp);
+			if (*endp != '\0')
+				errx(EXIT_FAILURE, "invalid gains");
+			break;
+		case 'j':
+			nThreads = strtoul(optarg, &endp, 0);
+			if (nThreads == 0 || *endp != '\0')
+				errx(EXIT_FAILURE, "invalid threads");
+			break;
+		case 'l':
+			len = strtoul(optarg, &endp, 0);
+			if (len == 0 || *endp != '\0')
+				errx(EXIT_FAILURE, "invalid bytes");
+			break;
+		case 'n':
+			nBits = strtoul(optarg, &endp, 0);
+			if (nBits == 0 || *endp != '\0')
+				errx(EXIT_FAILURE, "invalid bits");
+			break;
+		case 'p':
+			ch.clockOffset = strtod(optarg, &endp);
+			if (*endp != '\0')
+				errx(EXIT_FAILURE, "invalid ppm");
+			break;
+		case 'r':
+			seed = strtoul(optarg, &endp, 0);
+			if (*endp != '\0')
+				errx(EXIT_FAILURE, "invalid seed");
+			break;
+		case 'S':
+			snrFrom = strtod(optarg, &endp);
+			if (*endp != ',')
+				errx(EXIT_FAILURE, "invalid sweep");
+			snrTo = strtod(endp + 1, &endp);
+			if (*endp != ',')
+				errx(EXIT_FAILURE, "invalid sweep");
+			snrStep = strtod(endp + 1, &endp);
+			if (snrStep <= 0 || *endp != '\0')
+				errx(EXIT_FAILURE, "invalid sweep");
+			sweep = true;
+			break;
+		case 's':
+			speed = optarg;
+			if (strtoul(speed, &endp, 0) == 0 || *endp != '\0')
+				errx(EXIT_FAILURE, "invalid speed");
+			break;
+		case 't':
+			ch.riseTime = strtod(optarg, &endp);
+			if (ch.riseTime < 0 || *endp != '\0')
+				errx(EXIT_FAILURE, "invalid rise time");
+			break;
+		case '?':
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc != 0)
+		usage();
+	ch.chipRate = strtoul(speed, NULL, 0);
+
+	/* スレッド数は既定でオンラインの CPU の数 */
+	if (nThreads == 0) {
+		const long n = sysconf(_SC_NPROCESSORS_ONLN);
+		nThreads = n > 0 ? n : 1;
+	}
+	threads = (pthread_t *)malloc(nThreads * sizeof(pthread_t));
+	if (threads == NULL)
+		err(EXIT_FAILURE, "malloc");
+
+	printf("# chipRate=%lu gains=%g,%g ambient=%g rise=%g ppm=%g drift=%g\n",
+			ch.chipRate, ch.gains[0], ch.gains[1], ch.ambient,
+			ch.riseTime, ch.clockOffset, ch.clockDrift);
+	printf("# snr(dB) noise bits errors BER\n");
+
+	/* SN 比は弱い方の層の受信強度と雑音の標準偏差との比 */
+	const double weak = fmin(ch.gains[0], ch.gains[1]);
+	if (!sweep)
+		snrFrom = snrTo = ch.noise > 0 ? 20 * log10(weak / ch.noise)
+				: INFINITY;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts0);
+	total = 0;
+	for (int i = 0; ; i++) {
+		const double snr = snrFrom + snrStep * i;
+		if (snr > snrTo + snrStep * 1e-6 || (i > 0 && !sweep))
+			break;
+
+		struct Point pt;
+		ch.noise = isinf(snr) ? 0 : weak / pow(10, snr / 20);
+		pt.ch = &ch;
+		pt.len = len;
+		pt.seed = mix(mix(seed) + (uint64_t)i);
+		pt.nRuns = (nBits + len * 8 - 1) / (len * 8);
+		pt.next = 0;
+		pt.res.bits = pt.res.errors = 0;
+		(void)pthread_mutex_init(&pt.lock, NULL);
+
+		for (size_t t = 0; t < nThreads; t++)
+			if ((errno = pthread_create(&threads[t], NULL,
+					worker, &pt)) != 0)
+				err(EXIT_FAILURE, "pthread_create");
+		for (size_t t = 0; t < nThreads; t++)
+			(void)pthread_join(threads[t], NULL);
+		(void)pthread_mutex_destroy(&pt.lock);
+
+		printf("%6.2f %8.3f %10zu %8zu %g\n", snr, ch.noise,
+				pt.res.bits, pt.res.errors,
+				(double)pt.res.errors / pt.res.bits);
+		(void)fflush(stdout);
+		total += pt.res.bits;
+	}
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts1);
+
+	const double wall = (ts1.tv_sec - ts0.tv_sec)
+			+ (ts1.tv_nsec - ts0.tv_nsec) * 1e-9;
+	fprintf(stderr, "%zu bits in %.2f s: %.2f Mbit/s (%.2f Mbit/s/thread,"
+			" %zu threads)\n", total, wall, total / wall * 1e-6,
+			total / wall * 1e-6 / nThreads, nThreads);
+
+	free(threads);
+
+	return 0;
+}
@@ -0,0 +1,299 @@
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <Arduino.h>
+
+#include "chips.h"
+#include "lz.h"
+#include "mode.h"
+#include "packet.h"
+#include "state.h"
+#include "transmitter.h"
+#include "world.h"
+
+/**
+ * 送信機と受信機とのプログラムを仮想世界の上で動かし、
+ * 送った文字列が受信機から出てくるかを確かめる
+ */
+
+/* 受信機のプログラム（receiver/src/main.cc） */
+void setup(void);
+void loop(void);
+
+#define CHIPRATE	"300"
+#define NBYTE		64
+/** 受信がこれ以上途切れたら終了する（仮想時刻、s） */
+#define TIMEOUT		5
+
+/** 送信するチップレート、送信方式及び文字列 */
+static unsigned long chipRate;
+static const char *modes;
+static uint8_t mode;
+static uint8_t *payload;
+static size_t nByte;
+/** 送信機に渡す文字列（圧縮するなら圧縮したもの、符号化するなら符号化したもの） */
+static uint8_t *air;
+static size_t nAir;
+
+/** 送信機に渡した文字数及び渡せる文字数 */
+static size_t nSent;
+static double credit;
+/** チップレートを渡したか、送信機が送信を始めたか */
+static bool rateSent, started;
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: sim [-a ambient] [-e noise] [-g gain1,gain2]"
+			" [-m modes] [-n bytes] [-p ppm] [-r seed] [-s speed]"
+			" [-t rise] [-z]\n");
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * ホストの周期処理（送信機を制御する）
+ */
+static void
+hostTick(void)
+{
+	SimSerial &s = txSerial();
+
+	// プロンプトが出たらチップレートを送る
+	if (!rateSent && s.output.find('?') != std::string::npos) {
+		char buf[32];
+		(void)snprintf(buf, sizeof(buf), "%lu%s\r", chipRate,
+				modes);
+		for (const char *p = buf; *p != '\0'; p++)
+			s.input.push_back(*p);
+		rateSent = true;
+	}
+
+	// 送信が始まったら送信バッファが溢れない速さで文字を送る
+	if (!started) {
+		if (s.output.find('!') == std::string::npos)
+			return;
+		started = true;
+		// 送信バッファの 3600 ワードのうち 2000 ワード分を先に詰める
+		credit = mode & MODE_RAW ? 2000.0 * RAW_FRAME
+				: 2000.0 / modeByteFrames(mode);
+	}
+	credit += (double)chipRate / 1000 / (mode & MODE_RAW
+			? (double)MODE_FRAME_CHIPS / RAW_FRAME
+			: modeByteChips(mode));
+	while (nSent < nAir && credit >= 1) {
+		s.input.push_back(air[nSent++]);
+		credit--;
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long seed;
+	simtime_t acquired, lastOutput;
+	size_t lastSize, nBits, nErrors, nRecv, nPackets, nBad;
+	struct timespec ts0, ts1;
+	int c, zero;
+	char *endp, *speed;
+
+	speed = (char *)CHIPRATE;
+	modes = "";
+	nByte = NBYTE;
+	zero = 0;
+	seed = 1;
+	while ((c = getopt(argc, argv, "a:e:g:m:n:p:r:s:t:z")) != -1)
+		switch (c) {
+		case 'a':
+			simChannel.ambient = strtod(optarg, &endp);
+			if (*endp != '\0')
+				errx(EXIT_FAILURE, "invalid ambient");
+			break;
+		case 'e':
+			simChannel.noise = strtod(optarg, &endp);
+			if (simChannel.noise < 0 || *endp != '\0')
+				errx(EXIT_FAILURE, "invalid noise");
+			break;
+		case 'g':
+			simChannel.gains[0] = strtod(optarg, &endp);
+			if (*endp != ',')
+				errx(EXIT_FAILURE, "invalid gains");
+			simChannel.gains[1] = strtod(endp + 1, &endp);
+			if (*endp != '\0')
+				errx(EXIT_FAILURE, "invalid gains");
+			break;
+		case 'm':
+			modes = optarg;
+			if (parseMode(modes, &mode) == -1)
+				errx(EXIT_FAILURE, "invalid modes");
+			break;
+		case 'n':
+			nByte = strtoul(optarg, &endp, 0);
+			if (nByte == 0 || *endp != '\0')
+				errx(EXIT_FAILURE, "invalid bytes");
+			break;
+		case 'p':
+			simChannel.clockOffset = strtod(optarg, &endp);
+			if (*endp != '\0')
+				errx(EXIT_FAILURE, "invalid ppm");
+			break;
+		case 'r':
+			seed = strtoul(optarg, &endp, 0);
+			if (*endp != '\0')
+				errx(EXIT_FAILURE, "invalid seed");
+			break;
+		case 's':
+			speed = optarg;
+			if (strtoul(speed, &endp, 0) == 0 || *endp != '\0')
+				errx(EXIT_FAILURE, "invalid speed");
+			break;
+		case 't':
+			simChannel.riseTime = strtod(optarg, &endp) * SIM_US;
+			if (simChannel.riseTime < 0 || *endp != '\0')
+				errx(EXIT_FAILURE, "invalid rise time");
+			break;
+		case 'z':
+			zero = 1;
+			break;
+		case '?':
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc != 0)
+		usage();
+	chipRate = strtoul(speed, NULL, 0);
+
+	/* 送信する文字列を作る */
+	simSeed(seed);
+	srandom(seed);
+	payload = (uint8_t *)malloc(nByte);
+	if (payload == NULL)
+		err(EXIT_FAILURE, "malloc");
+	for (size_t i = 0; i < nByte; i++)
+		payload[i] = zero ? 0 : random() & 0xFF;
+
+	/* 圧縮するならホストと同じく圧縮してから渡す */
+	air = payload;
+	nAir = nByte;
+	if (mode & MODE_COMPRESS) {
+		air = (uint8_t *)malloc(LZ_BOUND(nByte));
+		if (air == NULL)
+			err(EXIT_FAILURE, "malloc");
+		nAir = compressLz(payload, nByte, air);
+	}
+	if (mode & MODE_RAW) {
+		uint8_t *coded = (uint8_t *)malloc(nAir * RAW_FRAME * FEC_FRAMES);
+		if (coded == NULL)
+			err(EXIT_FAILURE, "malloc");
+		size_t n = 0;
+		for (size_t i = 0; i < nAir; i++)
+			n += encodeRaw(air[i], mode, coded + n);
+		if (air != payload)
+			free(air);
+		air = coded;
+		nAir = n;
+	}
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts0);
+
+	/* 受信機、送信機の順に起動する */
+	setup();
+	txSetup();
+	simSetHost(hostTick, SIM_MS);
+
+	/* 受信が途切れるまで両方を動かす */
+	acquired = lastOutput = 0;
+	lastSize = 0;
+	for (;;) {
+		loop();
+		txLoop();
+
+		if (acquired == 0 && getState() == STATE_RECEIVING)
+			acquired = simNow();
+		if (Serial.output.size() != lastSize) {
+			lastSize = Serial.output.size();
+			lastOutput = simNow();
+		}
+		if (nSent == nAir && !txSending()
+				&& simNow() - lastOutput > TIMEOUT * SIM_S)
+			break;
+		if (!started && simNow() > TIMEOUT * SIM_S)
+			errx(EXIT_FAILURE, "transmitter did not start");
+	}
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts1);
+
+	/* 送った文字列と受け取った文字列とを比べる */
+	nBits = nByte * 8;
+	nErrors = nPackets = nBad = 0;
+	if (!(mode & MODE_FRAMED)) {
+		nRecv = Serial.output.size() < nByte
+				? Serial.output.size() : nByte;
+		nErrors = (nByte - nRecv) * 8;
+		for (size_t i = 0; i < nRecv; i++)
+			nErrors += __builtin_popcount((payload[i]
+					^ (uint8_t)Serial.output[i]) & 0xFF);
+	} else {
+		/*
+		 * 枠にしたなら、CRC の合った枠の中身を送った文字列の中に探す
+		 * 失った枠は誤りとせず、届いた分だけで比べる
+		 */
+		const std::string sent((const char *)payload, nByte);
+		struct packet pk;
+		size_t at = 0, pos;
+
+		nRecv = 0;
+		huntPacket(&pk);
+		for (char ch : Serial.output)
+			switch (feedPacket(&pk, (uint8_t)ch)) {
+			case PACKET_GOOD:
+				pos = sent.find(std::string((const char *)pk.data,
+						pk.len), at);
+				if (pos == std::string::npos) {
+					nErrors += pk.len * 8;
+					pos = at;
+				}
+				at = pos + pk.len;
+				nRecv += pk.len;
+				nPackets++;
+				break;
+			case PACKET_BAD:
+				nBad++;
+				break;
+			}
+		nBits = nRecv * 8;
+	}
+
+	const double wall = (ts1.tv_sec - ts0.tv_sec)
+			+ (ts1.tv_nsec - ts0.tv_nsec) * 1e-9;
+	const double virt = (double)simNow() / SIM_S;
+	printf("chipRate: %lu\n", chipRate);
+	printf("   nByte: %zu\n", nByte);
+	printf("received: %zu\n", nRecv);
+	if (mode & (MODE_COMPRESS | MODE_RAW))
+		printf("     air: %zu\n", nAir);
+	if (mode & MODE_FRAMED)
+		printf(" packets: %zu (bad %zu, lost %zu bytes)\n",
+				nPackets, nBad, nByte - nRecv);
+	printf("  errors: %zu\n", nErrors);
+	printf("     BER: %g\n", nBits > 0 ? (double)nErrors / nBits : 0);
+	if (acquired != 0)
+		printf(" acquire: %llu us\n", (unsigned long long)
+				((acquired - simFirstLight()) / SIM_US));
+	printf(" speedup: %.1f\n", virt / wall);
+	printf("frames/s: %.0f\n", nByte * modeByteFrames(mode) / wall);
+
+	if (air != payload)
+		free(air);
+	free(payload);
+
+	return nErrors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
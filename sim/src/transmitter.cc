@@ -0,0 +1,157 @@
+#include <Arduino.h>
+#include <TimerTCC0.h>
+
+#include "world.h"
+
+#include "transmitter.h"
+
+/**
+ * 送信機のプログラム（transmitter/src/main.cc）をホスト上で動かす
+ *
+ * 受信機のプログラムと同じ実行ファイルに入れるので、
+ * 名前が衝突しないように名前空間 tx の中に取り込み、
+ * 端子やシリアル通信、送信タイマは送信機用のものに差し替える。
+ */
+namespace tx {
+
+SimSerial Serial;
+
+/** LED の端子（transmitter/src/main.cc と同じ） */
+static int
+ledLayer(int pin)
+{
+	switch (pin) {
+	case D4:
+		return 0;
+	case D5:
+		return 1;
+	default:
+		return -1;
+	}
+}
+
+static void
+pinMode(int pin, int mode)
+{
+	(void)pin;
+	(void)mode;
+}
+
+static void
+digitalWrite(int pin, int value)
+{
+	const int layer = ledLayer(pin);
+	if (layer >= 0)
+		simSetLed(layer, value != LOW);
+}
+
+/** 送信タイマ */
+static double timerPeriod = 0;
+static void (*timerIsr)(void) = NULL;
+
+static SimTimerTCC0 TimerTcc0;
+
+#include "../../transmitter/src/main.cc"
+
+}	// namespace tx
+
+void
+SimTimerTCC0::initialize(double microseconds)
+{
+	tx::timerPeriod = microseconds;
+}
+
+void
+SimTimerTCC0::setPeriod(double microseconds)
+{
+	tx::timerPeriod = microseconds;
+	if (tx::timerIsr != NULL)
+		simSetTxTimer(tx::timerPeriod, tx::timerIsr);
+}
+
+void
+SimTimerTCC0::attachInterrupt(void (*isr)(void))
+{
+	tx::timerIsr = isr;
+	simSetTxTimer(tx::timerPeriod, tx::timerIsr);
+}
+
+void
+SimTimerTCC0::detachInterrupt(void)
+{
+	tx::timerIsr = NULL;
+	simStopTxTimer();
+}
+
+void
+SimTimerTCC0::start(void)
+{
+	if (tx::timerIsr != NULL)
+		simSetTxTimer(tx::timerPeriod, tx::timerIsr);
+}
+
+void
+SimTimerTCC0::stop(void)
+{
+	simStopTxTimer();
+}
+
+void
+SimTimerTCC0::restart(void)
+{
+	start();
+}
+
+/**
+ * 送信機を起動する
+ */
+void
+txSetup(void)
+{
+	tx::setup();
+}
+
+/**
+ * 送信機の loop() を呼ぶ
+ * 一度プロンプトを表示した後は、送信中でなく、受け取った文字もなければ
+ * 行の入力待ちで止まってしまうので呼ばない
+ */
+void
+txLoop(void)
+{
+	if (tx::sending || !tx::Serial.input.empty()
+			|| tx::Serial.output.empty())
+		tx::loop();
+}
+
+/**
+ * 送信機のシリアル通信
+ */
+SimSerial &
+txSerial(void)
+{
+	return tx::Serial;
+}
+
+/**
+ * 文字を送信パターンに変換する
+ */
+void
+txEncodeChar(uint8_t c, uint32_t w[2][2])
+{
+	uint16_t p[2][2];
+
+	tx::charToChips(c, p);
+	for (size_t i = 0; i < 2; i++)
+		for (size_t j = 0; j < 2; j++)
+			w[i][j] = tx::chipsToPattern(p[i][j]);
+}
+
+/**
+ * 送信中であるか
+ */
+bool
+txSending(void)
+{
+	return tx::sending;
+}
@@ -0,0 +1,282 @@
+#include <math.h>
+#include <stdint.h>
+
+#include <deque>
+
+#include "world.h"
+
+/**
+ * 送信機と受信機とを載せる仮想世界
+ */
+
+struct SimChannel simChannel = {
+	{ 300, 150 },	// gains
+	50,		// ambient
+	0,		// noise
+	0,		// riseTime
+	0,		// clockOffset
+	0,		// csDelay
+};
+
+/** 現在の仮想時刻 */
+static simtime_t now = 0;
+
+/** 送信タイマの周期（ns）、次の満了時刻及びハンドラ */
+static double txPeriod = 0;
+static double txNext = 0;
+static void (*txIsr)(void) = NULL;
+
+/** キャリア検出器の割り込みハンドラ及び保留中の立ち上がり */
+static void (*csIsr)(void) = NULL;
+static std::deque<simtime_t> csEdges;
+
+/** 遅延処理のハンドラ及び保留中であるか */
+static void (*deferredHandler)(void) = NULL;
+static bool deferredPending = false;
+
+/** ホストの周期処理 */
+static void (*hostTick)(void) = NULL;
+static simtime_t hostInterval = 0, hostNext = 0;
+
+/** 各層の LED の状態（変化した時刻、変化した時点の明るさ、目標の明るさ） */
+static struct {
+	simtime_t changed;
+	double from, to;
+} leds[2];
+static simtime_t firstLight = 0;
+
+/** 乱数の状態（xorshift64*） */
+static uint64_t rng = 88172645463325252ULL;
+
+/**
+ * 現在の仮想時刻を得る
+ */
+simtime_t
+simNow(void)
+{
+	return now;
+}
+
+/**
+ * 乱数の種を設定する
+ */
+void
+simSeed(uint64_t seed)
+{
+	rng = seed != 0 ? seed : 88172645463325252ULL;
+}
+
+/**
+ * 一様乱数（0, 1] を得る
+ */
+static double
+uniform(void)
+{
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return ((rng * 2685821657736338717ULL >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * 標準正規分布に従う乱数を得る
+ */
+double
+simGaussian(void)
+{
+	static bool hasSpare = false;
+	static double spare;
+
+	if (hasSpare) {
+		hasSpare = false;
+		return spare;
+	}
+
+	const double r = sqrt(-2 * log(uniform()));
+	const double th = 2 * M_PI * uniform();
+	spare = r * sin(th);
+	hasSpare = true;
+	return r * cos(th);
+}
+
+/**
+ * 層 layer の LED の現在の明るさ（0 から 1）
+ */
+static double
+ledLevel(int layer)
+{
+	const double tau = simChannel.riseTime;
+	if (tau <= 0)
+		return leds[layer].to;
+
+	const double dt = (double)(now - leds[layer].changed);
+	return leds[layer].to + (leds[layer].from - leds[layer].to) * exp(-dt / tau);
+}
+
+/**
+ * 受信機の光検出器の値を読む
+ */
+int
+simAnalogRead(void)
+{
+	double v = simChannel.ambient;
+	for (int l = 0; l < 2; l++)
+		v += simChannel.gains[l] * ledLevel(l);
+	if (simChannel.noise > 0)
+		v += simChannel.noise * simGaussian();
+
+	if (v < 0)
+		return 0;
+	if (v > 1023)
+		return 1023;
+	return (int)lround(v);
+}
+
+/**
+ * キャリア検出器の出力（どちらかの LED が点灯しているか）
+ */
+static bool
+carrier(void)
+{
+	return leds[0].to > 0 || leds[1].to > 0;
+}
+
+/**
+ * 送信機の LED を点灯または消灯する
+ */
+void
+simSetLed(int layer, int on)
+{
+	const double to = on ? 1 : 0;
+	if (leds[layer].to == to)
+		return;
+
+	const bool before = carrier();
+	leds[layer].from = ledLevel(layer);
+	leds[layer].to = to;
+	leds[layer].changed = now;
+	if (on && firstLight == 0)
+		firstLight = now;
+
+	// キャリア検出器の立ち上がり
+	if (!before && carrier() && csIsr != NULL)
+		csEdges.push_back(now + simChannel.csDelay);
+}
+
+/**
+ * 最初に LED が点灯した時刻
+ */
+simtime_t
+simFirstLight(void)
+{
+	return firstLight;
+}
+
+/**
+ * 送信タイマを設定する
+ */
+void
+simSetTxTimer(double periodUs, void (*isr)(void))
+{
+	txPeriod = periodUs * SIM_US * (1 + simChannel.clockOffset * 1e-6);
+	txNext = now + txPeriod;
+	txIsr = isr;
+}
+
+/**
+ * 送信タイマを止める
+ */
+void
+simStopTxTimer(void)
+{
+	txIsr = NULL;
+}
+
+void
+simAttachCS(void (*isr)(void))
+{
+	csIsr = isr;
+	csEdges.clear();
+}
+
+void
+simDetachCS(void)
+{
+	csIsr = NULL;
+	csEdges.clear();
+}
+
+void
+simSetDeferredHandler(void (*handler)(void))
+{
+	deferredHandler = handler;
+}
+
+void
+simPendDeferred(void)
+{
+	deferredPending = true;
+}
+
+/**
+ * 保留中の遅延処理を処理する（割り込みハンドラの後に続けて呼ぶ）
+ */
+void
+simRunDeferred(void)
+{
+	while (deferredPending) {
+		deferredPending = false;
+		if (deferredHandler != NULL)
+			deferredHandler();
+	}
+}
+
+/**
+ * ホストの周期処理を設定する
+ */
+void
+simSetHost(void (*tick)(void), simtime_t interval)
+{
+	hostTick = tick;
+	hostInterval = interval;
+	hostNext = now + interval;
+}
+
+/**
+ * 次のイベントまで仮想時計を進め、そのイベントを処理する
+ */
+void
+simIdle(void)
+{
+	// 最も近いイベントの時刻を探す
+	simtime_t next = now + SIM_MS;
+	if (txIsr != NULL && (simtime_t)txNext < next)
+		next = (simtime_t)txNext;
+	const uint64_t deadline = simNextTimerDeadline();
+	if (deadline != UINT64_MAX && deadline * SIM_US < next)
+		next = deadline * SIM_US;
+	if (!csEdges.empty() && csEdges.front() < next)
+		next = csEdges.front();
+	if (hostTick != NULL && hostNext < next)
+		next = hostNext;
+	if (next > now)
+		now = next;
+
+	// 時刻の来たイベントを処理する
+	if (hostTick != NULL && hostNext <= now) {
+		hostNext += hostInterval;
+		hostTick();
+	}
+	if (txIsr != NULL && (simtime_t)txNext <= now) {
+		txNext += txPeriod;
+		txIsr();
+	}
+	while (!csEdges.empty() && csEdges.front() <= now) {
+		csEdges.pop_front();
+		if (csIsr != NULL)
+			csIsr();
+		simRunDeferred();
+	}
+	simDispatchTimers();
+	simRunDeferred();
+}
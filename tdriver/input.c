@@ -0,0 +1,256 @@
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "input.h"
+
+/* 一度に読み込む最大の文字数 */
+#define READ_MAX	65536
+
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+#define MAX(a, b)	((a) > (b) ? (a) : (b))
+
+/*
+ * 次のファイルを開く（もう無ければ -1 を返す）
+ * '-' のときは標準入力を相手にする
+ */
+static int
+openInput(char ***argv, const char **filename)
+{
+	int fd;
+
+	while (**argv != NULL) {
+		*filename = *(*argv)++;
+		if (strcmp(*filename, "-") == 0) {
+			*filename = "stdin";
+			return STDIN_FILENO;
+		}
+		fd = open(*filename, O_RDONLY | O_NOCTTY);
+		if (fd != -1)
+			return fd;
+		warn("%s", *filename);
+	}
+
+	return -1;
+}
+
+/*
+ * 読み込んだことを知らせる（ロックを取って呼ぶ）
+ * 受け取られるまでは何度も知らせない
+ */
+static void
+notify(struct input *in)
+{
+	if (in->signalled)
+		return;
+	in->signalled = 1;
+	if (write(in->wake[1], "", 1) == -1)
+		err(EXIT_FAILURE, "write");
+}
+
+/*
+ * 読み込み用のスレッド
+ */
+static void *
+reader(void *arg)
+{
+	struct input *in = arg;
+	const char *filename;
+	size_t room, tail;
+	ssize_t bytes;
+	int fd;
+
+	while ((fd = openInput(&in->argv, &filename)) != -1) {
+#ifdef POSIX_FADV_SEQUENTIAL
+		/* 通常のファイルなら先読みを促す */
+		(void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+		for (;;) {
+			/* 空きができるまで待つ */
+			(void)pthread_mutex_lock(&in->mu);
+			while (in->len == in->size)
+				(void)pthread_cond_wait(&in->cv, &in->mu);
+			tail = (in->head + in->len) % in->size;
+			room = MIN(in->size - in->len, in->size - tail);
+			(void)pthread_mutex_unlock(&in->mu);
+
+			/* 空きの部分には自分しか触らないので、ロックを離して読む */
+			bytes = read(fd, in->ring + tail, MIN(room, READ_MAX));
+			if (bytes == -1 && errno == EINTR)
+				continue;
+			if (bytes <= 0) {
+				if (bytes == -1)
+					warn("%s", filename);
+				break;
+			}
+
+			(void)pthread_mutex_lock(&in->mu);
+			in->len += bytes;
+			notify(in);
+			(void)pthread_mutex_unlock(&in->mu);
+		}
+
+		/* ファイルを閉じる */
+		if (fd != STDIN_FILENO)
+			(void)close(fd);
+	}
+
+	(void)pthread_mutex_lock(&in->mu);
+	in->eof = 1;
+	notify(in);
+	(void)pthread_mutex_unlock(&in->mu);
+
+	return NULL;
+}
+
+/*
+ * 先読みを始める
+ */
+void
+startInput(struct input *in, char **argv, size_t size)
+{
+	memset(in, 0, sizeof(*in));
+	in->argv = argv;
+	in->size = size;
+	in->ring = malloc(size);
+	if (in->ring == NULL)
+		err(EXIT_FAILURE, "malloc");
+	if (pipe(in->wake) == -1)
+		err(EXIT_FAILURE, "pipe");
+	if (fcntl(in->wake[0], F_SETFL, O_NONBLOCK) == -1)
+		err(EXIT_FAILURE, "fcntl");
+	if ((errno = pthread_mutex_init(&in->mu, NULL)) != 0
+			|| (errno = pthread_cond_init(&in->cv, NULL)) != 0)
+		err(EXIT_FAILURE, "pthread");
+	if ((errno = pthread_create(&in->th, NULL, reader, in)) != 0)
+		err(EXIT_FAILURE, "pthread_create");
+}
+
+/*
+ * 読み込んだことを知らせる記述子
+ */
+int
+inputFd(const struct input *in)
+{
+	return in->wake[0];
+}
+
+/*
+ * 知らせを受け取る
+ */
+void
+ackInput(struct input *in)
+{
+	char c;
+
+	(void)pthread_mutex_lock(&in->mu);
+	if (in->signalled && read(in->wake[0], &c, 1) == 1)
+		in->signalled = 0;
+	(void)pthread_mutex_unlock(&in->mu);
+}
+
+/*
+ * 詰まっている文字数
+ */
+size_t
+pendingInput(struct input *in)
+{
+	size_t n;
+
+	(void)pthread_mutex_lock(&in->mu);
+	n = in->len;
+	(void)pthread_mutex_unlock(&in->mu);
+
+	return n;
+}
+
+/*
+ * 最大 n 文字を取り出す
+ */
+size_t
+takeInput(struct input *in, uint8_t *buf, size_t n)
+{
+	size_t first;
+
+	(void)pthread_mutex_lock(&in->mu);
+	n = MIN(n, in->len);
+	first = MIN(n, in->size - in->head);
+	memcpy(buf, in->ring + in->head, first);
+	memcpy(buf + first, in->ring, n - first);
+	in->head = (in->head + n) % in->size;
+	in->len -= n;
+	(void)pthread_cond_signal(&in->cv);
+	(void)pthread_mutex_unlock(&in->mu);
+
+	return n;
+}
+
+/*
+ * 全て読み終えて取り出したか
+ */
+int
+finishedInput(struct input *in)
+{
+	int r;
+
+	(void)pthread_mutex_lock(&in->mu);
+	r = in->eof && in->len == 0;
+	(void)pthread_mutex_unlock(&in->mu);
+
+	return r;
+}
+
+/*
+ * 全て読み込むまで待ち、まとめて取り出す
+ */
+uint8_t *
+loadInput(struct input *in, size_t *len)
+{
+	struct pollfd pfd;
+	uint8_t *buf, *tmp;
+	size_t cap, n;
+
+	buf = NULL;
+	cap = *len = 0;
+	pfd.fd = in->wake[0];
+	pfd.events = POLLIN;
+	for (;;) {
+		n = pendingInput(in);
+		if (n == 0) {
+			if (finishedInput(in))
+				break;
+			if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+				err(EXIT_FAILURE, "poll");
+			ackInput(in);
+			continue;
+		}
+		if (*len + n > cap) {
+			cap = MAX(2 * cap, *len + n);
+			tmp = realloc(buf, cap);
+			if (tmp == NULL)
+				err(EXIT_FAILURE, "realloc");
+			buf = tmp;
+		}
+		*len += takeInput(in, buf + *len, n);
+	}
+
+	return buf;
+}
+
+/*
+ * 先読みを終える
+ */
+void
+stopInput(struct input *in)
+{
+	(void)pthread_join(in->th, NULL);
+	(void)pthread_mutex_destroy(&in->mu);
+	(void)pthread_cond_destroy(&in->cv);
+	(void)close(in->wake[0]);
+	(void)close(in->wake[1]);
+	free(in->ring);
+}
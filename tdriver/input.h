@@ -0,0 +1,66 @@
+#ifndef INPUT_H
+#define INPUT_H	1
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 先読みする入力
+ *
+ * 読み込み用のスレッドが各ファイルを順に読み、リングバッファに詰めていく。
+ * ファイルの読み込みが遅くても、送信機に渡す側は詰まっている分だけ渡し続けられる。
+ */
+struct input {
+	char **argv;		/* 残りのファイル（'-' は標準入力） */
+	uint8_t *ring;		/* リングバッファ、その大きさ、先頭及び長さ */
+	size_t size, head, len;
+	int eof;		/* 全てのファイルを読み終えた */
+	int signalled;		/* 読み込んだことを知らせてある */
+	int wake[2];		/* 読み込んだことを知らせるパイプ */
+	pthread_mutex_t mu;
+	pthread_cond_t cv;
+	pthread_t th;
+};
+
+/*
+ * 先読みを始める
+ */
+void startInput(struct input *in, char **argv, size_t size);
+
+/*
+ * 読み込んだことを知らせる記述子
+ */
+int inputFd(const struct input *in);
+
+/*
+ * 知らせを受け取る（記述子が読めるようになったら呼ぶ）
+ */
+void ackInput(struct input *in);
+
+/*
+ * 詰まっている文字数
+ */
+size_t pendingInput(struct input *in);
+
+/*
+ * 最大 n 文字を取り出す
+ */
+size_t takeInput(struct input *in, uint8_t *buf, size_t n);
+
+/*
+ * 全て読み終えて取り出したか
+ */
+int finishedInput(struct input *in);
+
+/*
+ * 全て読み込むまで待ち、まとめて取り出す（長さを len に入れ、free で解放する）
+ */
+uint8_t *loadInput(struct input *in, size_t *len);
+
+/*
+ * 先読みを終える（全て読み終えてから呼ぶ）
+ */
+void stopInput(struct input *in);
+
+#endif	/* !INPUT_H */
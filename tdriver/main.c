@@ -1,11 +1,19 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#else
 #include <sys/select.h>
+#endif
 
 #include <err.h>
+#include <errno.h>
 #include <fcntl.h>
-#include <signal.h>
+#include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,55 +21,500 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "chips.h"
+#include "fountain.h"
+#include "input.h"
+#include "lz.h"
+#include "mode.h"
+#include "stripe.h"
+
 #define BUFLEN	1024
 #define DEVICE	"/dev/modem"
 #define GIGA	1000000000
 #define SPEED	"300"
 
+/* 方式なしで 1 文字の送信にかかるチップ数（buflen 及び OVERHEAD の単位） */
+#define BYTE_CHIPS	32
+/* 送信ごとのプレアンブル、レベルチェック及び送信方式（文字数） */
+#define OVERHEAD	15
+/* 受信機が全てを忘却するまでのチップ数 */
+#define FORGET_CHIPS	16
+/* 送信機に一度に送る文字数の目安（これだけ空くまで待つ） */
+#define QUANTUM		64
+/* 送信機が送り終えるのを待つ時間の余裕（秒） */
+#define DRAIN_MARGIN	1
+/* 送信機が速度に応答するまでの制限時間（秒） */
+#define START_TIMEOUT	5
+/* 先読みする文字数（少なくとも buflen の 4 倍） */
+#define READAHEAD	65536
+/* 送信機ごとに渡しておく塊の最大数（writev でまとめて書く） */
+#define QUEUE		16
+
+/* 入力が読めるようになった */
+#define EV_INPUT	1
+
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
 #define MAX(a, b)	((a) > (b) ? (a) : (b))
 
+/*
+ * 送信機の状態
+ */
+enum state {
+	IDLE,		/* 次の送信時に速度を送る必要がある */
+	STARTING,	/* 速度を送り、応答（'!'）を待っている */
+	SENDING,	/* 送信中 */
+	FORGETTING,	/* 送り終え、受信機が全てを忘却するのを待っている */
+};
+
+/*
+ * 送信機のバッファの空きの見積もり（トークンバケット）
+ * 送信機は 1 秒あたり rate 文字を送り出すので、空きは rate で増えて depth で飽和する
+ * 送信ごとに、プレアンブル等の overhead の分だけ埋まった状態から始まる
+ * いずれも送信方式で 1 文字の送信にかかるチップ数で換算した文字数
+ */
+struct bucket {
+	double tokens, depth, rate, overhead;
+	struct timespec last;
+};
+
+/*
+ * 送信機に渡す塊
+ */
+struct chunk {
+	size_t len;
+	uint8_t data[];
+};
+
+/*
+ * 噴水符号で繰り返し送るファイル
+ */
+struct carousel {
+	int on;
+	struct fountain fs;
+	uint8_t *data;		/* ファイルの内容 */
+	uint32_t *idx;		/* シンボルのもとになるブロックの番号 */
+	uint32_t esi, total;	/* 次の ESI 及び送るシンボルの数（0 なら終わりなく） */
+};
+
+/*
+ * 送信機
+ */
+struct tx {
+	const char *name;
+	int fd;			/* 故障して外したら -1 */
+	enum state state;
+	struct bucket bk;
+	struct timespec due;	/* 応答または忘却の期限、送信中は次に送れる時刻 */
+	struct chunk *queue[QUEUE];	/* 渡した塊、先頭の送った位置及び残りの文字数 */
+	size_t nQueue, off, queued;
+	int ready;		/* 何か言っている */
+};
+
+#ifdef __linux__
+/* epoll の記述子及び期限のための timerfd */
+static int ep = -1, tfd = -1;
+/* epoll に登録した timerfd 及び入力の印 */
+#define TAG_TIMER	UINT64_MAX
+#define TAG_INPUT	(UINT64_MAX - 1)
+#endif
+
 static void
 usage(void)
 {
-	fprintf(stderr, "usage: tdrive [-b buflen] [-d transmitter] [-s speed]"
-			" [file ...]\n");
+	fprintf(stderr, "usage: tdrive [-b buflen] [-c chunklen] [-d transmitter]"
+			" [-f ratio] [-m modes] [-s speed] [file ...]\n");
 	exit(EXIT_FAILURE);
 }
 
+/*
+ * 時刻の差（秒）
+ */
+static double
+elapsed(const struct timespec *from, const struct timespec *to)
+{
+	return (double)(to->tv_sec - from->tv_sec)
+			+ (double)(to->tv_nsec - from->tv_nsec) / GIGA;
+}
+
+/*
+ * 時刻を進める
+ */
 static void
-handler(int sig)
+advance(struct timespec *ts, double sec)
 {
-	/* Nothing to do */
+	long nsec;
+
+	ts->tv_sec += (time_t)sec;
+	nsec = ts->tv_nsec + (long)((sec - (time_t)sec) * GIGA);
+	ts->tv_sec += nsec / GIGA;
+	ts->tv_nsec = nsec % GIGA;
 }
 
-int
-main(int argc, char *argv[])
+/*
+ * 早い方の期限にする
+ */
+static void
+earlier(struct timespec **deadline, struct timespec *ts)
+{
+	if (*deadline == NULL || elapsed(ts, *deadline) > 0)
+		*deadline = ts;
+}
+
+/*
+ * 経過時間の分だけ空きを増やす
+ */
+static void
+refill(struct bucket *bk, const struct timespec *now)
+{
+	bk->tokens += elapsed(&bk->last, now) * bk->rate;
+	if (bk->tokens > bk->depth)
+		bk->tokens = bk->depth;
+	bk->last = *now;
+}
+
+/*
+ * 送信機のバッファの空きの見積もり
+ * 送信を始める前なら、プレアンブル及びレベルチェックの分を除いて全て空いている
+ */
+static double
+room(struct tx *t, const struct timespec *now)
+{
+	if (t->state != SENDING)
+		return t->bk.depth - t->bk.overhead;
+	refill(&t->bk, now);
+
+	return t->bk.tokens;
+}
+
+/*
+ * 待つ準備をする
+ */
+static void
+initEvents(int wake)
+{
+#ifdef __linux__
+	struct epoll_event ev;
+
+	ep = epoll_create1(EPOLL_CLOEXEC);
+	if (ep == -1)
+		err(EXIT_FAILURE, "epoll_create1");
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (tfd == -1)
+		err(EXIT_FAILURE, "timerfd_create");
+	ev.events = EPOLLIN;
+	ev.data.u64 = TAG_TIMER;
+	if (epoll_ctl(ep, EPOLL_CTL_ADD, tfd, &ev) == -1)
+		err(EXIT_FAILURE, "epoll_ctl");
+	ev.data.u64 = TAG_INPUT;
+	if (epoll_ctl(ep, EPOLL_CTL_ADD, wake, &ev) == -1)
+		err(EXIT_FAILURE, "epoll_ctl");
+#else
+	(void)wake;
+#endif
+}
+
+/*
+ * 送信機を開く
+ */
+static void
+openDevice(struct tx *t, size_t i)
 {
-	struct itimerspec it;
-	struct sigaction sa;
-	struct sigevent sigev;
 	struct termios tos;
-	struct timespec tv;
+#ifdef __linux__
+	struct epoll_event ev;
+#endif
+
+	t->fd = open(t->name, O_RDWR | O_NOCTTY);
+	if (t->fd == -1)
+		err(EXIT_FAILURE, "%s", t->name);
+	/* 送信機を RAW モードにする（XXX） */
+	if (tcgetattr(t->fd, &tos) == -1)
+		err(EXIT_FAILURE, "%s", t->name);
+	cfmakeraw(&tos);
+	if (tcsetattr(t->fd, TCSANOW, &tos) == -1)
+		err(EXIT_FAILURE, "%s", t->name);
+
+#ifdef __linux__
+	ev.events = EPOLLIN;
+	ev.data.u64 = i;
+	if (epoll_ctl(ep, EPOLL_CTL_ADD, t->fd, &ev) == -1)
+		err(EXIT_FAILURE, "epoll_ctl");
+#else
+	(void)i;
+#endif
+}
+
+/*
+ * 送信機か入力が読めるか、期限（NULL なら無し）が来るまで待つ
+ * 何か言っている送信機の ready を立て、入力が読めれば EV_INPUT を返す
+ */
+static int
+await(struct tx *tx, size_t n, int wake, const struct timespec *deadline)
+{
+#ifdef __linux__
+	struct epoll_event evs[16];
+	struct itimerspec it;
+	uint64_t ticks;
+	int i, m, r;
+
+	(void)wake;
+
+	/* 期限を設定する（過ぎていればすぐに満了する） */
+	memset(&it, 0, sizeof(it));
+	if (deadline != NULL) {
+		it.it_value = *deadline;
+		if (it.it_value.tv_sec == 0 && it.it_value.tv_nsec == 0)
+			it.it_value.tv_nsec = 1;
+	}
+	if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &it, NULL) == -1)
+		err(EXIT_FAILURE, "timerfd_settime");
+
+	m = epoll_wait(ep, evs, sizeof(evs) / sizeof(evs[0]), -1);
+	if (m == -1) {
+		if (errno == EINTR)
+			return 0;
+		err(EXIT_FAILURE, "epoll_wait");
+	}
+	r = 0;
+	for (i = 0; i < m; i++)
+		if (evs[i].data.u64 == TAG_TIMER)
+			(void)read(tfd, &ticks, sizeof(ticks));
+		else if (evs[i].data.u64 == TAG_INPUT)
+			r |= EV_INPUT;
+		else if (evs[i].data.u64 < n)
+			tx[evs[i].data.u64].ready = 1;
+
+	return r;
+#else
+	struct timespec now;
+	struct timeval tv, *tvp;
 	fd_set rfds;
-	size_t buflen;
+	double d;
+	size_t i;
+	int nfds, r;
+
+	/* epoll の無いシステムでは select の時間切れで期限を待つ */
+	FD_ZERO(&rfds);
+	FD_SET(wake, &rfds);
+	nfds = wake + 1;
+	for (i = 0; i < n; i++)
+		if (tx[i].fd != -1) {
+			FD_SET(tx[i].fd, &rfds);
+			nfds = MAX(nfds, tx[i].fd + 1);
+		}
+	tvp = NULL;
+	if (deadline != NULL) {
+		if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+			err(EXIT_FAILURE, "clock_gettime");
+		d = MAX(elapsed(&now, deadline), 0);
+		tv.tv_sec = (time_t)d;
+		tv.tv_usec = (suseconds_t)((d - (time_t)d) * 1000000) + 1;
+		tvp = &tv;
+	}
+	if (select(nfds, &rfds, NULL, NULL, tvp) == -1) {
+		if (errno == EINTR)
+			return 0;
+		err(EXIT_FAILURE, "select");
+	}
+	r = 0;
+	for (i = 0; i < n; i++)
+		if (tx[i].fd != -1 && FD_ISSET(tx[i].fd, &rfds))
+			tx[i].ready = 1;
+	if (FD_ISSET(wake, &rfds))
+		r |= EV_INPUT;
+
+	return r;
+#endif
+}
+
+/*
+ * まだ渡す塊があるか
+ */
+static int
+more(struct input *in, const struct carousel *cs, size_t nOrphan)
+{
+	if (nOrphan > 0)
+		return 1;
+	if (cs->on)
+		return cs->total == 0 || cs->esi < cs->total;
+
+	return pendingInput(in) > 0;
+}
+
+/*
+ * 全て渡し終えたか
+ */
+static int
+finished(struct input *in, const struct carousel *cs, size_t nOrphan)
+{
+	if (nOrphan > 0)
+		return 0;
+	if (cs->on)
+		return !more(in, cs, nOrphan);
+
+	return finishedInput(in);
+}
+
+/*
+ * 全てのファイルを読み込み、噴水符号で送る準備をする
+ */
+static void
+loadCarousel(struct carousel *cs, struct input *in, size_t symlen,
+		double ratio)
+{
+	size_t len;
+
+	cs->data = loadInput(in, &len);
+	if (len == 0)
+		errx(EXIT_FAILURE, "nothing to send");
+	if (len > UINT32_MAX)
+		errx(EXIT_FAILURE, "input too large");
+	if (initFountain(&cs->fs, len, symlen,
+			fountainCrc(0, cs->data, len)) == -1)
+		err(EXIT_FAILURE, "initFountain");
+	cs->idx = malloc(cs->fs.k * sizeof(*cs->idx));
+	if (cs->idx == NULL)
+		err(EXIT_FAILURE, "malloc");
+	cs->esi = 0;
+	cs->total = ratio > 0 ? (uint32_t)MIN(ceil(ratio * cs->fs.k),
+			UINT32_MAX) : 0;
+}
+
+/*
+ * 作った塊を送信方式に従って圧縮あるいは符号化し、その長さを返す
+ * 圧縮してから符号化するなら、work に圧縮したものを置く
+ */
+static size_t
+transform(uint8_t mode, const uint8_t *in, size_t n, uint8_t *work,
+		uint8_t *out)
+{
+	size_t i, m;
+
+	if (mode & MODE_COMPRESS) {
+		if (!(mode & MODE_RAW))
+			return compressLz(in, n, out);
+		n = compressLz(in, n, work);
+		in = work;
+	}
+	for (i = m = 0; i < n; i++)
+		m += encodeRaw(in[i], mode, out + m);
+
+	return m;
+}
+
+/*
+ * 渡した塊をまとめて書く（最大 n 文字）
+ */
+static ssize_t
+flushQueue(struct tx *t, size_t n)
+{
+	struct iovec iov[QUEUE];
+	size_t i, skip, total;
 	ssize_t bytes;
-	timer_t timerid;
-	unsigned long period, pnprev, pnsec;
-	int c, dev, fd, i, j, nfds, psec, reqSpeed;
-	char *buf, *device, *endp, *filename, *speed;
+
+	total = 0;
+	for (i = 0; i < t->nQueue && total < n; i++) {
+		skip = i == 0 ? t->off : 0;
+		iov[i].iov_base = t->queue[i]->data + skip;
+		iov[i].iov_len = MIN(t->queue[i]->len - skip, n - total);
+		total += iov[i].iov_len;
+	}
+	bytes = writev(t->fd, iov, i);
+	if (bytes == -1)
+		return -1;
+
+	/* 書き終えた塊を捨てる */
+	t->queued -= bytes;
+	for (total = bytes; total > 0; ) {
+		if (total < t->queue[0]->len - t->off) {
+			t->off += total;
+			break;
+		}
+		total -= t->queue[0]->len - t->off;
+		free(t->queue[0]);
+		memmove(t->queue, t->queue + 1,
+				--t->nQueue * sizeof(t->queue[0]));
+		t->off = 0;
+	}
+
+	return bytes;
+}
+
+/*
+ * 故障した送信機を外し、書きかけの塊を引き取る
+ */
+static void
+fail(struct tx *t, const char *why, struct chunk **orphans, size_t *nOrphan)
+{
+	size_t i;
+
+	warnx("%s: %s, dropping", t->name, why);
+	(void)close(t->fd);
+	t->fd = -1;
+	for (i = 0; i < t->nQueue; i++)
+		orphans[(*nOrphan)++] = t->queue[i];
+	t->nQueue = t->off = t->queued = 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	static char *stdinOnly[] = { "-", NULL };
+	struct carousel cs;
+	struct chunk *ck, **orphans;
+	uint8_t *raw, *scratch, *work;
+	struct input in;
+	struct timespec drained, now, wake, *deadline;
+	struct tx *t, *tx;
+	size_t buflen, chunklen, chunkmax, i, j, nOrphan, nTx, payload, quantum;
+	size_t ckmax;
+	ssize_t bytes, k;
+	uint32_t seq;
+	double byteChips, chipRate, most, r, ratio;
+	int again, c, draining, ev, live, striping;
+	uint8_t mode;
+	char *endp, *modes, *speed;
+	char reply[64];
 
 	buflen = BUFLEN;
-	device = DEVICE;
+	chunklen = STRIPE_CHUNK;
 	speed = SPEED;
-	while ((c = getopt(argc, argv, "b:d:s:")) != -1)
+	modes = "";
+	mode = 0;
+	striping = 0;
+	memset(&cs, 0, sizeof(cs));
+	ratio = 0;
+	tx = calloc(argc, sizeof(*tx));
+	if (tx == NULL)
+		err(EXIT_FAILURE, "calloc");
+	nTx = 0;
+	while ((c = getopt(argc, argv, "b:c:d:f:m:s:")) != -1)
 		switch (c) {
 		case 'b':
 			buflen = strtoul(optarg, &endp, 0);
 			if (buflen == 0 || *endp != '\0')
 				errx(EXIT_FAILURE, "invalid buffer length");
 			break;
+		case 'c':
+			chunklen = strtoul(optarg, &endp, 0);
+			if (chunklen == 0 || chunklen > STRIPE_MAX
+					|| *endp != '\0')
+				errx(EXIT_FAILURE, "invalid chunk length");
+			striping = 1;
+			break;
 		case 'd':
-			device = optarg;
+			tx[nTx++].name = optarg;
+			break;
+		case 'f':
+			ratio = strtod(optarg, &endp);
+			if (ratio < 0 || *endp != '\0')
+				errx(EXIT_FAILURE, "invalid ratio");
+			cs.on = 1;
+			break;
+		case 'm':
+			modes = optarg;
+			if (parseMode(modes, &mode) == -1)
+				errx(EXIT_FAILURE, "invalid modes");
 			break;
 		case 's':
 			speed = optarg;
@@ -74,130 +527,288 @@ main(int argc, char *argv[])
 		}
 	argc -= optind;
 	argv += optind;
+	/* 引数がないときは標準入力を相手にする */
+	if (argc == 0)
+		argv = stdinOnly;
+	/* 送信機が指定されなければ既定のものを使う */
+	if (nTx == 0)
+		tx[nTx++].name = DEVICE;
+	/* 送信機が複数なら塊に分けて送る（噴水符号のシンボルはそのままで良い） */
+	if (nTx > 1 && !cs.on)
+		striping = 1;
+
+	/* 圧縮したブロックは枠の中身になるので、受信機が伸長できない */
+	if ((mode & MODE_COMPRESS) && (mode & MODE_FRAMED))
+		errx(EXIT_FAILURE, "cannot compress framed data");
+	/* 送信ごとに始め直す白色化や枠は、送信の区切りを知らないと符号化できない */
+	if ((mode & MODE_RAW) && (mode & (MODE_SCRAMBLE | MODE_FRAMED)))
+		errx(EXIT_FAILURE, "cannot encode scrambled or framed data");
 
 	/* バッファの確保 */
-	buf = malloc(buflen);
-	if (buf == NULL)
-		err(EXIT_FAILURE, "malloc");
+	payload = striping ? chunklen : buflen;
+	chunkmax = STRIPE_HEADER + payload;
+	orphans = calloc(nTx * QUEUE, sizeof(*orphans));
+	if (orphans == NULL)
+		err(EXIT_FAILURE, "calloc");
+	nOrphan = 0;
+
+	/* 送信機のバッファに先行して詰めるのは buflen 文字まで */
+	chipRate = strtoul(speed, NULL, 0);
+	byteChips = mode & MODE_RAW ? (double)MODE_FRAME_CHIPS / RAW_FRAME
+			: modeByteChips(mode);
+	quantum = MAX(1, MIN(QUANTUM, buflen / 2));
 
-	/* シグナルハンドラの設定 */
-	sa.sa_handler = handler;
-	(void)sigemptyset(&sa.sa_mask);
-	if (sigaction(SIGRTMIN, &sa, NULL) == -1)
-		err(EXIT_FAILURE, "sigaction");
-
-	/* タイマを作る */
-	sigev.sigev_notify = SIGEV_SIGNAL;
-	sigev.sigev_signo = SIGRTMIN;
-	if (timer_create(CLOCK_MONOTONIC, &sigev, &timerid) == -1)
-		err(EXIT_FAILURE, "timer_create");
-	/* 16 周期分のタイマ時間を用意しておく */
-	period = GIGA / strtoul(speed, NULL, 0);
-	pnprev = pnsec = psec = 0;
-	for (i = 0; i < 16; i++) {
-		pnsec = (pnprev + period) % GIGA;
-		if (pnsec < pnprev)
-			psec++;
-		pnprev = pnsec;
+	/* 各ファイルの先読みを始める */
+	startInput(&in, argv, MAX(READAHEAD, 4 * buflen));
+	initEvents(inputFd(&in));
+	if (cs.on) {
+		/* 噴水符号なら全て読み込み、シンボルを塊として渡す */
+		loadCarousel(&cs, &in, chunklen, ratio);
+		chunkmax = fountainSize(&cs.fs);
+	}
+	/* 圧縮または符号化するなら、塊を作ってから変換する */
+	ckmax = chunkmax;
+	scratch = work = NULL;
+	if (mode & (MODE_COMPRESS | MODE_RAW)) {
+		if (mode & MODE_COMPRESS)
+			ckmax = LZ_BOUND(ckmax);
+		if ((mode & MODE_COMPRESS) && (mode & MODE_RAW)) {
+			work = malloc(ckmax);
+			if (work == NULL)
+				err(EXIT_FAILURE, "malloc");
+		}
+		if (mode & MODE_RAW)
+			ckmax *= RAW_FRAME * modeByteFrames(mode);
+		scratch = malloc(chunkmax);
+		if (scratch == NULL)
+			err(EXIT_FAILURE, "malloc");
 	}
-	it.it_interval.tv_sec = it.it_interval.tv_nsec = 0;
-	it.it_value.tv_sec = period / GIGA * 16 + psec;
-	it.it_value.tv_nsec = pnsec;
 
 	/* 送信機を開く */
-	dev = open(device, O_RDWR | O_NOCTTY);
-	if (dev == -1)
-		err(EXIT_FAILURE, "%s", device);
-	/* 送信機を RAW モードにする（XXX） */
-	if (tcgetattr(dev, &tos) == -1)
-		err(EXIT_FAILURE, "%s", device);
-	cfmakeraw(&tos);
-	if (tcsetattr(dev, TCSANOW, &tos) == -1)
-		err(EXIT_FAILURE, "%s", device);
-	/* 次の送信時にスピードを送る必要がある */
-	reqSpeed = 1;
+	for (i = 0; i < nTx; i++) {
+		t = &tx[i];
+		t->bk.rate = chipRate / byteChips;
+		t->bk.depth = buflen * BYTE_CHIPS / byteChips;
+		t->bk.overhead = OVERHEAD * BYTE_CHIPS / byteChips;
+		openDevice(t, i);
+		/* 次の送信時にスピードを送る必要がある */
+		t->state = IDLE;
+	}
 
 	/* 各ファイルを送信する */
-	for (i = 0; argv[i] != NULL || i == 0; i++) {
-		/* 引数がないか '-' のときは標準入力を相手にする */
-		if (argv[i] == NULL || strcmp(argv[i], "-") == 0) {
-			filename = "stdin";
-			fd = STDIN_FILENO;
-		} else {
-			filename = argv[i];
-			fd = open(filename, O_RDONLY | O_NOCTTY);
+	seq = 0;
+	draining = 0;
+	for (;;) {
+		if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+			err(EXIT_FAILURE, "clock_gettime");
+
+		/* 期限の来た送信機の状態を進める */
+		for (i = 0; i < nTx; i++) {
+			t = &tx[i];
+			if (t->fd == -1 || elapsed(&t->due, &now) < 0)
+				continue;
+			/* 受信機が全てを忘却したら、次の送信時に速度を再度送る */
+			if (t->state == FORGETTING)
+				t->state = IDLE;
+			else if (t->state == STARTING)
+				fail(t, "not responding", orphans, &nOrphan);
 		}
-		if (fd == -1) {
-			warn("%s", filename);
-			continue;
+
+		/*
+		 * 空きの最も多い送信機に塊を渡す
+		 * 空きを超えて渡しておくのは、何も渡していない送信機だけ
+		 */
+		for (;;) {
+			if (!more(&in, &cs, nOrphan))
+				break;
+			t = NULL;
+			most = 0;
+			for (i = 0; i < nTx; i++) {
+				if (tx[i].fd == -1 || tx[i].nQueue == QUEUE
+						|| tx[i].state == FORGETTING)
+					continue;
+				r = room(&tx[i], &now) - tx[i].queued;
+				if (tx[i].nQueue > 0 && r <= 0)
+					continue;
+				if (t == NULL || r > most) {
+					t = &tx[i];
+					most = r;
+				}
+			}
+			if (t == NULL)
+				break;
+			if (nOrphan > 0) {
+				/* 引き取った塊を先に送る */
+				ck = orphans[--nOrphan];
+			} else {
+				ck = malloc(sizeof(*ck) + ckmax);
+				if (ck == NULL)
+					err(EXIT_FAILURE, "malloc");
+				raw = scratch != NULL ? scratch : ck->data;
+				if (cs.on) {
+					encodeFountain(&cs.fs, cs.data,
+							cs.esi++, cs.idx, raw);
+					j = fountainSize(&cs.fs);
+				} else if (striping) {
+					j = takeInput(&in, raw + STRIPE_HEADER,
+							payload);
+					putStripeHeader(raw, seq++, j);
+					j += STRIPE_HEADER;
+				} else {
+					j = takeInput(&in, raw, payload);
+				}
+				ck->len = scratch != NULL ? transform(mode,
+						raw, j, work, ck->data) : j;
+			}
+			t->queue[t->nQueue++] = ck;
+			t->queued += ck->len;
 		}
 
-		do {
-			/* 送信機とファイルとを同時に監視する */
-			FD_ZERO(&rfds);
-			FD_SET(dev, &rfds);
-			FD_SET(fd, &rfds);
-			nfds = MAX(dev, fd) + 1;
-			if (select(nfds, &rfds, NULL, NULL, NULL) == -1)
-				err(EXIT_FAILURE, "select");
-
-			/* 送信機が何か言っているなら読み込む */
-			if (FD_ISSET(dev, &rfds)) {
-				bytes = read(dev, buf, buflen);
-				if (bytes == -1)
-					err(EXIT_FAILURE, "%s", device);
-				/* 送信終了でなければ無視する */
-				if (strncmp(buf, "?", bytes) != 0)
+		/* 見積もった空きの範囲で各送信機に送る */
+		again = 0;
+		for (i = 0; i < nTx; i++) {
+			t = &tx[i];
+			if (t->fd == -1 || t->nQueue == 0)
+				continue;
+			if (t->state == IDLE) {
+				if (dprintf(t->fd, "\r%s%s\r", speed, modes) < 0) {
+					fail(t, strerror(errno),
+							orphans, &nOrphan);
 					continue;
-				/* 受信機が全てを忘却するまで待つ */
-				if (timer_settime(timerid, 0, &it, NULL) == -1)
-					err(EXIT_FAILURE, "timer_settime");
-				(void)pause();
-				/* 速度を再度送信する */
-				reqSpeed = 1;
+				}
+				t->due = now;
+				advance(&t->due, START_TIMEOUT);
+				t->state = STARTING;
+			}
+			if (t->state != SENDING)
+				continue;
+			refill(&t->bk, &now);
+			if (t->bk.tokens < 1)
+				continue;
+			bytes = flushQueue(t, (size_t)t->bk.tokens);
+			if (bytes == -1) {
+				fail(t, strerror(errno), orphans, &nOrphan);
 				continue;
 			}
+			t->bk.tokens -= bytes;
+			/* 書き終えたら次の塊を渡す */
+			if (t->nQueue == 0 && more(&in, &cs, nOrphan))
+				again = 1;
+		}
+		if (again)
+			continue;
 
-			/* ファイルから読んで送信機に送る */
-			bytes = read(fd, buf, buflen);
-			if (bytes <= 0)
+		/* 生き残っている送信機がなければおしまい */
+		for (live = 0, i = 0; i < nTx; i++)
+			live += tx[i].fd != -1;
+		if (live == 0)
+			errx(EXIT_FAILURE, "no transmitter left");
+
+		/* 全て渡し終えたら、送信機が送り終えるのを待っておしまい */
+		if (finished(&in, &cs, nOrphan)) {
+			for (j = 0, i = 0; i < nTx; i++)
+				j += tx[i].fd != -1 && (tx[i].nQueue > 0
+						|| tx[i].state == STARTING
+						|| tx[i].state == SENDING);
+			if (j == 0)
 				break;
-			if (reqSpeed && dprintf(dev, "\r%s\r", speed) < 0)
-					err(EXIT_FAILURE, "%s", device);
-			if (write(dev, buf, bytes) == -1)
-				err(EXIT_FAILURE, "%s", device);
-			reqSpeed = 0;
-
-			/* 送信機のバッファが溢れないように少し待つ */
-			pnprev = pnsec = psec = 0;
-			for (j = 0; j < 32 * bytes; j++) {
-				pnsec = (pnprev + period) % GIGA;
-				if (pnsec < pnprev)
-					psec++;
-				pnprev = pnsec;
+			for (j = 0, i = 0; i < nTx; i++)
+				j += tx[i].fd != -1 && tx[i].nQueue > 0;
+			if (j == 0 && !draining) {
+				drained = now;
+				for (i = 0; i < nTx; i++) {
+					t = &tx[i];
+					if (t->fd == -1 || t->state != SENDING)
+						continue;
+					refill(&t->bk, &now);
+					wake = now;
+					advance(&wake, (t->bk.depth
+							- t->bk.tokens)
+							/ t->bk.rate);
+					if (elapsed(&drained, &wake) > 0)
+						drained = wake;
+				}
+				advance(&drained, DRAIN_MARGIN);
+				draining = 1;
 			}
-			tv.tv_sec = period / GIGA * 32 * bytes + psec;
-			tv.tv_nsec = pnsec;
-			if (nanosleep(&tv, NULL) == -1)
-				err(EXIT_FAILURE, "nanosleep");
-		} while (bytes > 0);
-		if (bytes == -1)
-			warn("%s", filename);
-
-		/* ファイルを閉じる */
-		if (fd != STDIN_FILENO)
-			(void)close(fd);
-
-		/* 引数なしの場合はここでおしまい */
-		if (argv[i] == NULL)
-			break;
+			if (draining && elapsed(&drained, &now) >= 0)
+				break;
+		}
+
+		/* 次に何かすべき時刻を決める */
+		deadline = draining ? &drained : NULL;
+		for (i = 0; i < nTx; i++) {
+			t = &tx[i];
+			if (t->fd == -1)
+				continue;
+			if (t->state == STARTING || t->state == FORGETTING) {
+				earlier(&deadline, &t->due);
+			} else if (t->state == SENDING && t->nQueue > 0) {
+				t->due = now;
+				advance(&t->due, MAX(MIN(t->queued, quantum)
+						- t->bk.tokens, 0)
+						/ t->bk.rate);
+				earlier(&deadline, &t->due);
+			}
+		}
+
+		/* 送信機と入力とを同時に監視する */
+		ev = await(tx, nTx, inputFd(&in), deadline);
+		if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+			err(EXIT_FAILURE, "clock_gettime");
+		if (ev & EV_INPUT)
+			ackInput(&in);
+
+		/* 送信機が何か言っているなら読み込む */
+		for (i = 0; i < nTx; i++) {
+			t = &tx[i];
+			if (!t->ready)
+				continue;
+			t->ready = 0;
+			if (t->fd == -1)
+				continue;
+			bytes = read(t->fd, reply, sizeof(reply));
+			if (bytes <= 0) {
+				fail(t, bytes == 0 ? "hangup" : strerror(errno),
+						orphans, &nOrphan);
+				continue;
+			}
+			for (k = 0; k < bytes; k++)
+				if (reply[k] == '!' && t->state == STARTING) {
+					/* 送信開始、プレアンブル等の分だけ埋まっている */
+					t->bk.tokens = t->bk.depth - t->bk.overhead;
+					t->bk.last = now;
+					t->state = SENDING;
+				} else if (reply[k] == '?' && t->state == SENDING) {
+					/* 送信終了、受信機が全てを忘却するまで待つ */
+					t->due = now;
+					advance(&t->due, FORGET_CHIPS / chipRate);
+					t->state = FORGETTING;
+				}
+		}
 	}
 
 	/* 送信機を閉じる */
-	(void)close(dev);
+	for (i = 0; i < nTx; i++) {
+		if (tx[i].fd != -1)
+			(void)close(tx[i].fd);
+		for (j = 0; j < tx[i].nQueue; j++)
+			free(tx[i].queue[j]);
+	}
+	for (i = 0; i < nOrphan; i++)
+		free(orphans[i]);
+	stopInput(&in);
+	if (cs.on) {
+		freeFountain(&cs.fs);
+		free(cs.data);
+		free(cs.idx);
+	}
 
 	/* バッファを解放する */
-	free(buf);
+	free(scratch);
+	free(work);
+	free(orphans);
+	free(tx);
 
 	return 0;
 }
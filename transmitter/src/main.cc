@@ -1,6 +1,12 @@
 #include <Arduino.h>
 #include <TimerTCC0.h>
 
+#include "chips.h"
+#include "fec.h"
+#include "mode.h"
+#include "packet.h"
+#include "scramble.h"
+
 /** 端子指定 */
 #define LED_L1 D4
 #define LED_L2 D5
@@ -9,49 +15,6 @@
 #define ON	HIGH
 #define OFF	LOW
 
-/**
- * 2 bit のかたまりに対応する同強度のチップパターンを得る
- * パターンは Layer 1 用であるから、Layer 2 の場合は b2 を反転してから入力する
- */
-static uint16_t
-bit2ToChips(uint8_t b2)
-{
-#define PATTERN(b00, b01, b02, b03, b10, b11, b12, b13, \
-			b20, b21, b22, b23, b30, b31, b32, b33) \
-		(0B ## b33 ## b32 ## b31 ## b30 ## b23 ## b22 ## b21 ## b20 \
-			## b13 ## b12 ## b11 ## b10 ## b03 ## b02 ## b01 ## b00)
-	/**
-	 * チップパターン（2 チャネル多重済）
-	 *
-	 * n-th item | Code 1 | Code 2
-	 * ----------|--------|--------
-	 *      0    |    0   |    0
-	 *      1    |    1   |    0
-	 *      2    |    0   |    1
-	 *      3    |    1   |    1
-	 */
-	constexpr uint16_t convTab[] = {
-		PATTERN(1, 1, 0, 0,  0, 0, 1, 1,  0, 0, 1, 1,  1, 1, 0, 0),
-		PATTERN(0, 1, 1, 0,  1, 0, 0, 1,  0, 1, 1, 0,  1, 0, 0, 1),
-		PATTERN(1, 0, 0, 1,  0, 1, 1, 0,  1, 0, 0, 1,  0, 1, 1, 0),
-		PATTERN(0, 0, 1, 1,  1, 1, 0, 0,  1, 1, 0, 0,  0, 0, 1, 1),
-	};
-#undef PATTERN
-
-	return convTab[b2 & 0x03];
-}
-
-/**
- * 4 bit のかたまりに対応するチップパターンを得る
- * p[0] が Layer 1 用、p[1] が Layer 2 用
- */
-static void
-bit4ToChips(uint8_t b4, uint16_t p[2])
-{
-	p[0] = bit2ToChips( b4 >> 0 & 0x03);
-	p[1] = bit2ToChips(~b4 >> 2 & 0x03);
-}
-
 /**
  * 文字に対応するチップパターンを得る
  * p[0][0] が最初の Layer 1 用、p[0][1] が最初の Layer 2 用
@@ -64,22 +27,6 @@ charToChips(uint8_t c, uint16_t p[2][2])
 	bit4ToChips(c >> 4 & 0x0F, p[1]);
 }
 
-/**
- * チップパターンを送信パターンに変換する
- * 0b10100101 → 0b1100110000110011
- */
-static uint32_t
-chipsToPattern(uint16_t p)
-{
-	uint32_t r = 0;
-
-	for (size_t i = 0; i < 16; i++)
-		r |= (p & (1 << i)) << i;
-	r |= r << 1;
-
-	return r;
-}
-
 /** 送信バッファ */
 #define BUFLEN	3600
 static volatile uint32_t buffer[2][BUFLEN];
@@ -112,6 +59,25 @@ sendPreamble(void)
 	bufTail %= BUFLEN;
 }
 
+/** 送信方式及び白色化の系列の状態 */
+static uint8_t mode = 0;
+static uint16_t scrambler;
+
+/**
+ * 1 フレーム分の情報信号（4 bit あるいは 8 bit）を送信方式に従って送信する
+ */
+static void
+sendFrame(uint8_t b)
+{
+	uint16_t tmp[2];
+
+	frameToChips(b, mode, tmp);
+	for (size_t j = 0; j < 2; j++)
+		buffer[j][bufTail] = chipsToPattern(tmp[j]);
+	bufTail++;
+	bufTail %= BUFLEN;
+}
+
 /**
  * 文字を送信する
  */
@@ -145,6 +111,100 @@ sendLevelCheck(void)
 	sendChar(0x08);
 }
 
+/**
+ * 送信方式を送信する
+ */
+static void
+sendMode(void)
+{
+	for (int i = 0; i < MODE_HEADER; i++)
+		sendChar(mode);
+}
+
+/**
+ * 文字を白色化せずに送信方式に従って送信する
+ */
+static void
+sendCoded(uint8_t c)
+{
+	// 誤り訂正するなら符号化し、Walsh 系列を選ぶなら 1 フレームに 8 bit ずつ送る
+	uint8_t b[FEC_FRAMES];
+	const size_t n = byteToFrames(c, mode, b);
+	for (size_t k = 0; k < n; k++)
+		sendFrame(b[k]);
+}
+
+/**
+ * データの文字を送信方式に従って送信する
+ */
+static void
+sendData(uint8_t c)
+{
+	// 白色化するなら系列を重ねる
+	if (mode & MODE_SCRAMBLE)
+		c ^= scrambleNext(&scrambler);
+
+	sendCoded(c);
+}
+
+/** 枠に詰めている中身、その長さ及び枠の通し番号 */
+static uint8_t packet[PACKET_MAX];
+static size_t packetLen = 0;
+static uint8_t packetSeq = 0;
+
+/**
+ * 枠に詰めた中身を送信する
+ */
+static void
+sendPacket(void)
+{
+	uint16_t crc = 0xFFFF;
+
+	// 同期語は白色化せず、その直後から系列を始め直す
+	sendCoded(PACKET_SYNC0);
+	sendCoded(PACKET_SYNC1);
+	scrambler = SCRAMBLE_SEED;
+	crc = packetCrc(crc, packetLen);
+	sendData(packetLen);
+	crc = packetCrc(crc, packetSeq);
+	sendData(packetSeq++);
+	for (size_t i = 0; i < packetLen; i++) {
+		crc = packetCrc(crc, packet[i]);
+		sendData(packet[i]);
+	}
+	sendData(crc & 0xFF);
+	sendData(crc >> 8);
+	packetLen = 0;
+}
+
+/** ホストから受け取っている送信パターン及びその文字数 */
+static uint8_t raw[RAW_FRAME];
+static size_t rawLen = 0;
+
+/**
+ * ホストから受け取った 1 フレーム分の送信パターンをそのまま送信する
+ */
+static void
+sendRaw(void)
+{
+	for (size_t j = 0; j < 2; j++)
+		buffer[j][bufTail] = (uint32_t)raw[4*j + 0] << 0
+				| (uint32_t)raw[4*j + 1] << 8
+				| (uint32_t)raw[4*j + 2] << 16
+				| (uint32_t)raw[4*j + 3] << 24;
+	bufTail++;
+	bufTail %= BUFLEN;
+}
+
+/**
+ * 送信バッファに溜まっているワード数
+ */
+static size_t
+bufferedWords(void)
+{
+	return (bufTail + BUFLEN - bufHead) % BUFLEN;
+}
+
 /**
  * 送信を開始する
  */
@@ -235,19 +295,20 @@ loop(void)
 {
 	// 送信開始前であれば
 	if (!sending) {
-		// 送信チップレートを受け取る
+		// 送信チップレート及び送信方式を受け取る
 		unsigned long chipRate;
 		char buf[16], *endp;
 		do {
 			// プロンプトを表示する
 			Serial.print('?');
 
-			// 一行受け取って数値に変換
+			// 一行受け取って数値に変換し、残りを送信方式とする
 			(void)getLine(buf, sizeof(buf));
 			chipRate = strtoul(buf, &endp, 0);
-		} while (*endp != '\0' || chipRate == 0);
+		} while (parseMode(endp, &mode) == -1 || chipRate == 0);
 
 		Serial.print(chipRate);
+		Serial.print(endp);
 
 		// チップレートをクロック周期に変換してタイマーを開始する
 		TimerTcc0.initialize(1.0 / chipRate * 500000L);
@@ -256,6 +317,11 @@ loop(void)
 		// プレアンブルを準備する
 		sendPreamble();
 		sendLevelCheck();
+		sendMode();
+		scrambler = SCRAMBLE_SEED;
+		packetLen = 0;
+		packetSeq = 0;
+		rawLen = 0;
 
 		// プロンプトを表示する
 		Serial.print('!');
@@ -265,6 +331,25 @@ loop(void)
 	}
 
 	// 受信可能な文字があれば読み込んで送信する
-	if (Serial.available())
-		sendChar(Serial.read());
+	// 枠にするなら、枠が満杯になるか、送信バッファが尽きそうになったら送信する
+	// 符号化済みなら、1 フレーム分揃うごとにそのまま送信する
+	constexpr size_t PACKET_LOW_WATER = 32;
+	if (Serial.available()) {
+		const uint8_t c = Serial.read();
+		if (mode & MODE_RAW) {
+			raw[rawLen++] = c;
+			if (rawLen == RAW_FRAME) {
+				sendRaw();
+				rawLen = 0;
+			}
+		} else if (!(mode & MODE_FRAMED)) {
+			sendData(c);
+		} else {
+			packet[packetLen++] = c;
+			if (packetLen == PACKET_MAX)
+				sendPacket();
+		}
+	} else if (packetLen > 0 && bufferedWords() <= PACKET_LOW_WATER) {
+		sendPacket();
+	}
 }